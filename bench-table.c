@@ -0,0 +1,116 @@
+// bench-table.c - times rendering of extent tables, without retrieving extents
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Renders a table of made-up extents to standard output, a page at a time as
+// fiemap does, and reports how many rows per second were shown. Run it with
+// output redirected to /dev/null to time only the formatting.
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "pager.h"
+#include "table.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+enum bench_constants {
+    k_default_pages = 20000,   // 10,240,000 rows
+    k_extent_spacing = 1 << 20 // each made-up extent starts 1 MiB on
+};
+
+// Reads the monotonic clock, in seconds.
+static double read_seconds(void)
+{
+    struct timespec now = { 0 };
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+        die("can't read clock: %s", strerror(errno));
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Fills a page with extents whose values have varying numbers of digits.
+ATTRIBUTE((nonnull))
+static void fill_page(struct fiemap_extent *const extents, const __u64 first)
+{
+    for (__u64 i = 0u; i < k_extents_per_page; ++i) {
+        const __u64 n = first + i;
+
+        extents[i] = (struct fiemap_extent){
+            .fe_logical = n * k_extent_spacing,
+            .fe_physical = n * k_extent_spacing * 3u + (n % 7u) * 4096u,
+            .fe_length = 4096u * (1u + n % 256u)
+        };
+    }
+}
+
+// Parses a positive page count, quitting if it's malformed.
+ATTRIBUTE((nonnull))
+static unsigned long parse_pages(const char *const text)
+{
+    char *end = NULL;
+    errno = 0;
+    const unsigned long pages = strtoul(text, &end, 10);
+
+    if (errno || end == text || *end != '\0' || pages == 0u)
+        die("\"%s\" is not a positive page count", text);
+
+    return pages;
+}
+
+int main(int argc, char **argv)
+{
+    set_progname(argc > 0 ? argv[0] : "bench-table");
+
+    if (argc > 3) die("usage: %s [COLUMNS [PAGES]]", progname());
+
+    const char *const columns = (argc > 1 ? argv[1] : "lifc");
+    const unsigned long pages = (argc > 2 ? parse_pages(argv[2])
+                                          : k_default_pages);
+
+    const __u64 extent_count = (__u64)pages * k_extents_per_page;
+    const struct table_bounds bounds = {
+        .logical = extent_count * k_extent_spacing,
+        .physical = extent_count * k_extent_spacing * 4u
+    };
+
+    struct fiemap_extent *const extents =
+            xcalloc(k_extents_per_page, sizeof *extents);
+
+    const double start = read_seconds();
+    struct tablespec *const tsp = start_extent_table(stdout, columns, 0u,
+                                                     bounds.logical, &bounds);
+
+    for (unsigned long page = 0u; page < pages; ++page) {
+        fill_page(extents, (__u64)page * k_extents_per_page);
+        show_extent_rows(tsp, extents, k_extents_per_page);
+    }
+
+    finish_extent_table(tsp);
+    if (fflush(stdout) != 0) die("can't write output: %s", strerror(errno));
+    const double elapsed = read_seconds() - start;
+
+    fprintf(stderr, "%llu rows of \"%s\" in %.3f s: %.2fM rows/s\n",
+            extent_count, columns, elapsed,
+            (double)extent_count / elapsed / 1e6);
+
+    free(extents);
+    return EXIT_SUCCESS;
+}
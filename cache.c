@@ -0,0 +1,626 @@
+// cache.c - remembering files' extents between runs (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "cache.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const unsigned char k_cache_magic[k_cache_magic_size] = {
+    0x89, 'E', 'X', 'T', 'C', 'A', 'C', 'H'
+};
+
+// The most bytes a varint of a 64-bit value takes.
+enum { k_max_varint_size = 10 };
+
+ATTRIBUTE((nonnull))
+static struct cache_key make_key(const struct stat *const stp)
+{
+    assert(stp);
+
+    return (struct cache_key){
+        .dev = (__u64)stp->st_dev,
+        .ino = (__u64)stp->st_ino,
+        .size = (__u64)stp->st_size,
+        .mtime = (__u64)stp->st_mtim.tv_sec,
+        .ctime = (__u64)stp->st_ctim.tv_sec,
+        .mtime_nsec = (__u32)stp->st_mtim.tv_nsec,
+        .ctime_nsec = (__u32)stp->st_ctim.tv_nsec
+    };
+}
+
+ATTRIBUTE((nonnull, pure))
+static bool keys_equal(const struct cache_key *const lhs,
+                       const struct cache_key *const rhs)
+{
+    return lhs->dev == rhs->dev && lhs->ino == rhs->ino
+            && lhs->size == rhs->size
+            && lhs->mtime == rhs->mtime && lhs->mtime_nsec == rhs->mtime_nsec
+            && lhs->ctime == rhs->ctime && lhs->ctime_nsec == rhs->ctime_nsec;
+}
+
+// Hashes a device and inode number, which are all that entries are looked up
+// by, so that a changed file's entry is found and replaced.
+ATTRIBUTE((const))
+static __u64 hash_file(const __u64 dev, const __u64 ino)
+{
+    __u64 x = dev * 0x9E3779B97F4A7C15uLL ^ ino;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9uLL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBuLL;
+    return x ^ (x >> 31);
+}
+
+// Finds the slot holding the entry for a file, or the empty slot where one
+// would go.
+ATTRIBUTE((nonnull, pure))
+static size_t find_slot(const struct extent_cache *restrict const ecp,
+                        const struct cache_key *restrict const kp)
+{
+    assert(ecp);
+    assert(kp);
+    assert(ecp->slot_count != 0u);
+
+    const size_t mask = ecp->slot_count - 1u;
+    size_t slot = (size_t)hash_file(kp->dev, kp->ino) & mask;
+
+    for (;;) {
+        const size_t i = ecp->slots[slot];
+        if (i == SIZE_MAX) return slot;
+
+        const struct cache_key *const other = &ecp->entries[i].key;
+        if (other->dev == kp->dev && other->ino == kp->ino) return slot;
+
+        slot = (slot + 1u) & mask;
+    }
+}
+
+// Rebuilds the hash table with the given number of slots.
+ATTRIBUTE((nonnull))
+static void rehash(struct extent_cache *const ecp, const size_t slot_count)
+{
+    assert(ecp);
+    assert(slot_count > ecp->count * 2u);
+    assert((slot_count & (slot_count - 1u)) == 0u);
+
+    free(ecp->slots);
+    ecp->slots = xreallocarray(NULL, slot_count, sizeof ecp->slots[0]);
+    ecp->slot_count = slot_count;
+
+    for (size_t slot = 0u; slot < slot_count; ++slot)
+        ecp->slots[slot] = SIZE_MAX;
+
+    for (size_t i = 0u; i < ecp->count; ++i)
+        ecp->slots[find_slot(ecp, &ecp->entries[i].key)] = i;
+}
+
+// Makes room for one more entry, growing the array and hash table as needed.
+ATTRIBUTE((nonnull))
+static void reserve_entry(struct extent_cache *const ecp)
+{
+    assert(ecp);
+
+    if (ecp->count == ecp->capacity) {
+        ecp->capacity = (ecp->capacity ? ecp->capacity * 2u : 256u);
+        ecp->entries = xreallocarray(ecp->entries, ecp->capacity,
+                                     sizeof ecp->entries[0]);
+    }
+
+    if ((ecp->count + 1u) * 2u >= ecp->slot_count) {
+        if (ecp->slot_count > SIZE_MAX / 4u) die("out of memory");
+        rehash(ecp, (ecp->slot_count ? ecp->slot_count * 2u : 512u));
+    }
+}
+
+// Adds an entry for a file that has none.
+ATTRIBUTE((nonnull))
+static void add_entry(struct extent_cache *restrict const ecp,
+                      const struct cache_entry *restrict const entryp)
+{
+    assert(ecp);
+    assert(entryp);
+
+    reserve_entry(ecp);
+
+    const size_t slot = find_slot(ecp, &entryp->key);
+    assert(ecp->slots[slot] == SIZE_MAX);
+
+    ecp->slots[slot] = ecp->count;
+    ecp->entries[ecp->count++] = *entryp;
+    ecp->bytes += k_cache_entry_size + entryp->size;
+}
+
+// Empties a slot, moving later entries of its cluster back so every entry can
+// still be found by probing from where it hashes.
+ATTRIBUTE((nonnull))
+static void clear_slot(struct extent_cache *const ecp, size_t slot)
+{
+    assert(ecp);
+    assert(ecp->slots[slot] != SIZE_MAX);
+
+    const size_t mask = ecp->slot_count - 1u;
+
+    for (size_t next = (slot + 1u) & mask; ecp->slots[next] != SIZE_MAX;
+            next = (next + 1u) & mask) {
+        const struct cache_key *const kp = &ecp->entries[ecp->slots[next]].key;
+        const size_t home = (size_t)hash_file(kp->dev, kp->ino) & mask;
+
+        // An entry stays put if it hashes after the empty slot.
+        const bool stays = (slot <= next ? slot < home && home <= next
+                                         : slot < home || home <= next);
+        if (stays) continue;
+
+        ecp->slots[slot] = ecp->slots[next];
+        slot = next;
+    }
+
+    ecp->slots[slot] = SIZE_MAX;
+}
+
+ATTRIBUTE((nonnull))
+static unsigned char *put_varint(unsigned char *bytes, __u64 value)
+{
+    assert(bytes);
+
+    for (; value >= 0x80u; value >>= 7)
+        *bytes++ = (unsigned char)(value | 0x80u);
+
+    *bytes++ = (unsigned char)value;
+    return bytes;
+}
+
+// Decodes a varint from [*bytesp, end), advancing *bytesp past it. Returns
+// false if it runs past end or is too long.
+ATTRIBUTE((nonnull))
+static bool get_varint(const unsigned char **restrict const bytesp,
+                       const unsigned char *restrict const end,
+                       __u64 *restrict const valuep)
+{
+    assert(bytesp);
+    assert(end);
+    assert(valuep);
+
+    __u64 value = 0u;
+
+    for (unsigned shift = 0u; shift < 64u; shift += 7u) {
+        if (*bytesp == end) return false;
+
+        const unsigned byte = *(*bytesp)++;
+        value |= (__u64)(byte & 0x7Fu) << shift;
+
+        if (!(byte & 0x80u)) {
+            *valuep = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Maps a difference, which may be negative (modulo 2 to the 64th power), to a
+// value that is small when the difference is small in either direction.
+ATTRIBUTE((const))
+static __u64 zigzag(const __u64 delta)
+{
+    return (delta << 1) ^ (0u - (delta >> 63));
+}
+
+ATTRIBUTE((const))
+static __u64 unzigzag(const __u64 value)
+{
+    return (value >> 1) ^ (0u - (value & 1u));
+}
+
+// Encodes extents into newly allocated memory, setting *sizep to its size.
+ATTRIBUTE((nonnull(3), malloc, returns_nonnull))
+static unsigned char *encode_extents(const struct fiemap_extent *const extents,
+                                     const size_t count, size_t *const sizep)
+{
+    assert(sizep);
+    assert(extents || count == 0u);
+
+    if (count > (SIZE_MAX - k_max_varint_size) / (4u * k_max_varint_size))
+        die("out of memory");
+
+    unsigned char *const data =
+            xreallocarray(NULL, 1u, k_max_varint_size
+                                    + count * 4u * k_max_varint_size);
+    unsigned char *p = put_varint(data, count);
+    __u64 logical = 0u, physical = 0u;
+
+    for (size_t i = 0u; i < count; ++i) {
+        const struct fiemap_extent *const fep = &extents[i];
+
+        p = put_varint(p, zigzag(fep->fe_logical - logical));
+        p = put_varint(p, zigzag(fep->fe_physical - physical));
+        p = put_varint(p, fep->fe_length);
+        p = put_varint(p, fep->fe_flags);
+
+        logical = fep->fe_logical + fep->fe_length;
+        physical = fep->fe_physical + fep->fe_length;
+    }
+
+    *sizep = (size_t)(p - data);
+    return xreallocarray(data, *sizep, 1u);
+}
+
+// Decodes an entry's extents into the cache's extent buffer. Returns false if
+// they are malformed.
+ATTRIBUTE((nonnull))
+static bool decode_extents(struct extent_cache *restrict const ecp,
+                           const struct cache_entry *restrict const entryp,
+                           size_t *restrict const countp)
+{
+    assert(ecp);
+    assert(entryp);
+    assert(countp);
+
+    const unsigned char *p = entryp->data;
+    const unsigned char *const end = p + entryp->size;
+
+    __u64 count = 0u;
+    if (!get_varint(&p, end, &count) || count > entryp->size) return false;
+
+    // Even a file with no extents gets a buffer, so a hit is never mistaken
+    // for a miss.
+    if (count > ecp->extent_capacity || !ecp->extents) {
+        const size_t capacity = (count != 0u ? (size_t)count : 1u);
+        ecp->extents = xreallocarray(ecp->extents, capacity,
+                                     sizeof ecp->extents[0]);
+        ecp->extent_capacity = capacity;
+    }
+
+    __u64 logical = 0u, physical = 0u;
+
+    for (size_t i = 0u; i < count; ++i) {
+        __u64 logical_delta = 0u, physical_delta = 0u, length = 0u, flags = 0u;
+
+        if (!get_varint(&p, end, &logical_delta)
+                || !get_varint(&p, end, &physical_delta)
+                || !get_varint(&p, end, &length)
+                || !get_varint(&p, end, &flags)
+                || flags > UINT32_MAX)
+            return false;
+
+        ecp->extents[i] = (struct fiemap_extent){
+            .fe_logical = logical + unzigzag(logical_delta),
+            .fe_physical = physical + unzigzag(physical_delta),
+            .fe_length = length,
+            .fe_flags = (__u32)flags
+        };
+
+        logical = ecp->extents[i].fe_logical + length;
+        physical = ecp->extents[i].fe_physical + length;
+    }
+
+    if (p != end) return false;
+
+    *countp = (size_t)count;
+    return true;
+}
+
+// Reads the whole cache file, returning a null pointer if it doesn't exist.
+ATTRIBUTE((nonnull, malloc))
+static unsigned char *read_cache_file(const char *restrict const path,
+                                      size_t *restrict const sizep)
+{
+    assert(path);
+    assert(sizep);
+
+    FILE *const fp = fopen(path, "rb");
+    if (!fp) {
+        if (errno == ENOENT) return NULL;
+        die("%s: %s", path, strerror(errno));
+    }
+
+    unsigned char *bytes = NULL;
+    size_t size = 0u, capacity = 0u;
+
+    for (;;) {
+        if (size == capacity) {
+            capacity = (capacity ? capacity * 2u : 65536u);
+            bytes = xreallocarray(bytes, capacity, 1u);
+        }
+
+        const size_t len = fread(bytes + size, 1u, capacity - size, fp);
+        size += len;
+        if (len != 0u) continue;
+
+        if (ferror(fp)) die("%s: %s", path, strerror(errno));
+        break;
+    }
+
+    fclose(fp);
+    *sizep = size;
+    return bytes;
+}
+
+// Decodes the entries from the contents of a cache file. Returns false if it
+// is malformed, leaving whatever entries were decoded.
+ATTRIBUTE((nonnull))
+static bool parse_cache(struct extent_cache *restrict const ecp,
+                        const unsigned char *restrict const bytes,
+                        const size_t size)
+{
+    assert(ecp);
+    assert(bytes);
+
+    if (size < k_cache_header_size
+            || memcmp(bytes, k_cache_magic, k_cache_magic_size) != 0
+            || get_le32(bytes + 8) != k_cache_version)
+        return false;
+
+    ecp->clock = get_le64(bytes + 16);
+    const __u64 count = get_le64(bytes + 24);
+    size_t offset = k_cache_header_size;
+
+    for (__u64 i = 0u; i < count; ++i) {
+        if (size - offset < k_cache_entry_size) return false;
+
+        const unsigned char *const p = bytes + offset;
+        struct cache_entry entry = {
+            .key = {
+                .dev = get_le64(p),
+                .ino = get_le64(p + 8),
+                .size = get_le64(p + 16),
+                .mtime = get_le64(p + 24),
+                .ctime = get_le64(p + 32),
+                .mtime_nsec = get_le32(p + 40),
+                .ctime_nsec = get_le32(p + 44)
+            },
+            .last_used = get_le64(p + 48),
+            .size = get_le32(p + 56)
+        };
+
+        offset += k_cache_entry_size;
+        if (size - offset < entry.size) return false;
+
+        if (ecp->slot_count != 0u
+                && ecp->slots[find_slot(ecp, &entry.key)] != SIZE_MAX)
+            return false;
+
+        entry.data = xreallocarray(NULL, entry.size, 1u);
+        memcpy(entry.data, bytes + offset, entry.size);
+        offset += entry.size;
+
+        add_entry(ecp, &entry);
+    }
+
+    return offset == size;
+}
+
+void init_extent_cache(struct extent_cache *const ecp, const size_t limit)
+{
+    assert(ecp);
+
+    *ecp = (struct extent_cache){ .limit = limit,
+                                  .bytes = k_cache_header_size };
+}
+
+void load_extent_cache(struct extent_cache *restrict const ecp,
+                       const char *restrict const path, const size_t limit)
+{
+    assert(ecp);
+    assert(path);
+
+    init_extent_cache(ecp, limit);
+
+    size_t size = 0u;
+    unsigned char *const bytes = read_cache_file(path, &size);
+    if (!bytes) return;
+
+    if (!parse_cache(ecp, bytes, size)) {
+        msg("ignoring malformed cache %s", path);
+        destroy_extent_cache(ecp);
+        init_extent_cache(ecp, limit);
+    }
+
+    free(bytes);
+}
+
+const struct fiemap_extent *
+find_cached_extents(struct extent_cache *restrict const ecp,
+                    const struct stat *restrict const stp,
+                    size_t *restrict const countp)
+{
+    assert(ecp);
+    assert(stp);
+    assert(countp);
+
+    if (ecp->count != 0u) {
+        const struct cache_key key = make_key(stp);
+        const size_t i = ecp->slots[find_slot(ecp, &key)];
+
+        if (i != SIZE_MAX && keys_equal(&ecp->entries[i].key, &key)
+                && decode_extents(ecp, &ecp->entries[i], countp)) {
+            ecp->entries[i].last_used = ++ecp->clock;
+            ++ecp->hits;
+            return ecp->extents;
+        }
+    }
+
+    ++ecp->misses;
+    return NULL;
+}
+
+void cache_extents(struct extent_cache *restrict const ecp,
+                   const struct stat *restrict const stp,
+                   const struct fiemap_extent *restrict const extents,
+                   const size_t count)
+{
+    assert(ecp);
+    assert(stp);
+
+    struct cache_entry entry = { .key = make_key(stp) };
+    entry.data = encode_extents(extents, count, &entry.size);
+    entry.last_used = ++ecp->clock;
+
+    if (entry.size > UINT32_MAX) {
+        free(entry.data);
+        return;
+    }
+
+    if (ecp->slot_count != 0u) {
+        const size_t i = ecp->slots[find_slot(ecp, &entry.key)];
+
+        if (i != SIZE_MAX) {
+            ecp->bytes -= ecp->entries[i].size;
+            ecp->bytes += entry.size;
+            free(ecp->entries[i].data);
+            ecp->entries[i] = entry;
+            return;
+        }
+    }
+
+    add_entry(ecp, &entry);
+}
+
+// Compares entries so the most recently used one comes first.
+ATTRIBUTE((nonnull, pure))
+static int compare_recency(const void *const first, const void *const second)
+{
+    const struct cache_entry *const lhs = first, *const rhs = second;
+
+    if (lhs->last_used != rhs->last_used)
+        return lhs->last_used > rhs->last_used ? -1 : 1;
+    return 0;
+}
+
+void forget_cached_extents(struct extent_cache *const ecp, const __u64 dev,
+                           const __u64 ino)
+{
+    assert(ecp);
+
+    if (ecp->count == 0u) return;
+
+    const struct cache_key key = { .dev = dev, .ino = ino };
+    const size_t slot = find_slot(ecp, &key);
+    const size_t i = ecp->slots[slot];
+    if (i == SIZE_MAX) return;
+
+    ecp->bytes -= k_cache_entry_size + ecp->entries[i].size;
+    free(ecp->entries[i].data);
+    clear_slot(ecp, slot);
+
+    // Fill the gap in the entries array with the last entry.
+    const size_t last = --ecp->count;
+    if (i != last) {
+        ecp->entries[i] = ecp->entries[last];
+        ecp->slots[find_slot(ecp, &ecp->entries[i].key)] = i;
+    }
+}
+
+void trim_extent_cache(struct extent_cache *const ecp, const size_t target)
+{
+    assert(ecp);
+
+    if (ecp->bytes <= target || ecp->count == 0u) return;
+
+    qsort(ecp->entries, ecp->count, sizeof ecp->entries[0], compare_recency);
+
+    size_t total = k_cache_header_size, kept = 0u;
+    for (; kept < ecp->count; ++kept) {
+        const size_t size = k_cache_entry_size + ecp->entries[kept].size;
+        if (total > target || size > target - total) break;
+        total += size;
+    }
+
+    for (size_t i = kept; i < ecp->count; ++i) free(ecp->entries[i].data);
+
+    ecp->evicted += ecp->count - kept;
+    ecp->count = kept;
+    ecp->bytes = total;
+    rehash(ecp, ecp->slot_count);
+}
+
+ATTRIBUTE((nonnull))
+static void write_bytes(FILE *restrict const fp,
+                        const void *restrict const bytes, const size_t len,
+                        const char *restrict const path)
+{
+    assert(fp);
+    assert(bytes || len == 0u);
+    assert(path);
+
+    if (len != 0u && fwrite(bytes, 1u, len, fp) != len)
+        die("%s: %s", path, strerror(errno));
+}
+
+void save_extent_cache(struct extent_cache *restrict const ecp,
+                       const char *restrict const path)
+{
+    assert(ecp);
+    assert(path);
+
+    trim_extent_cache(ecp, ecp->limit);
+
+    static const char suffix[] = ".part";
+    char *const partial_path = xcalloc(strlen(path) + sizeof suffix, 1u);
+    strcat(strcpy(partial_path, path), suffix);
+
+    FILE *const fp = fopen(partial_path, "wb");
+    if (!fp) die("%s: %s", partial_path, strerror(errno));
+
+    unsigned char header[k_cache_header_size] = { 0 };
+    memcpy(header, k_cache_magic, k_cache_magic_size);
+    put_le32(header + 8, k_cache_version);
+    put_le64(header + 16, ecp->clock);
+    put_le64(header + 24, ecp->count);
+    write_bytes(fp, header, sizeof header, partial_path);
+
+    for (size_t i = 0u; i < ecp->count; ++i) {
+        const struct cache_entry *const entryp = &ecp->entries[i];
+        unsigned char bytes[k_cache_entry_size] = { 0 };
+
+        put_le64(bytes, entryp->key.dev);
+        put_le64(bytes + 8, entryp->key.ino);
+        put_le64(bytes + 16, entryp->key.size);
+        put_le64(bytes + 24, entryp->key.mtime);
+        put_le64(bytes + 32, entryp->key.ctime);
+        put_le32(bytes + 40, entryp->key.mtime_nsec);
+        put_le32(bytes + 44, entryp->key.ctime_nsec);
+        put_le64(bytes + 48, entryp->last_used);
+        put_le32(bytes + 56, (__u32)entryp->size);
+
+        write_bytes(fp, bytes, sizeof bytes, partial_path);
+        write_bytes(fp, entryp->data, entryp->size, partial_path);
+    }
+
+    if (fclose(fp) != 0) die("%s: %s", partial_path, strerror(errno));
+    if (rename(partial_path, path) != 0)
+        die("can't rename %s to %s: %s", partial_path, path, strerror(errno));
+
+    free(partial_path);
+}
+
+void destroy_extent_cache(struct extent_cache *const ecp)
+{
+    assert(ecp);
+
+    for (size_t i = 0u; i < ecp->count; ++i) free(ecp->entries[i].data);
+
+    free(ecp->extents);
+    free(ecp->slots);
+    free(ecp->entries);
+    ecp->entries = NULL;
+    ecp->slots = NULL;
+    ecp->extents = NULL;
+    ecp->count = ecp->capacity = ecp->slot_count = ecp->extent_capacity = 0u;
+    ecp->bytes = k_cache_header_size;
+}
@@ -0,0 +1,166 @@
+// cache.h - remembering files' extents between runs
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A cache holds the extents of files seen before, keyed by what stat()
+// reports about them, so a file that hasn't changed needn't be opened and
+// asked for its extents again. A file is assumed unchanged if its device,
+// inode number, size, modification time, and status change time are all the
+// same. (Changing a file's extents changes its status change time, and a new
+// file given a deleted file's inode number has a new status change time too.)
+//
+// The cache file is a header, then the entries, in no particular order. All
+// integers are little-endian.
+//
+// Header (k_cache_header_size bytes):
+//
+//    0  magic          k_cache_magic (8 bytes)
+//    8  version        u32, k_cache_version
+//   12  (reserved)     u32, zero
+//   16  clock          u64, the last time any entry was used (see below)
+//   24  entry count    u64
+//
+// Entry (k_cache_entry_size bytes, then the encoded extents):
+//
+//    0  device         u64, st_dev
+//    8  inode          u64, st_ino
+//   16  size           u64, st_size
+//   24  mtime          u64, st_mtim.tv_sec, two's complement
+//   32  ctime          u64, st_ctim.tv_sec, two's complement
+//   40  mtime (ns)     u32, st_mtim.tv_nsec
+//   44  ctime (ns)     u32, st_ctim.tv_nsec
+//   48  last used      u64, the clock reading when the entry was last used
+//   56  data size      u32, how many bytes of encoded extents follow
+//   60  (reserved)     u32, zero
+//
+// The clock counts uses of the cache across all runs, so entries can be
+// evicted least recently used first when the cache would exceed its limit.
+//
+// The extents are a varint count, then for each extent, in logical order,
+// varints for how far it starts after the previous one ended, logically and
+// physically (zigzag encoded, as either may be negative), its length, and its
+// flags. A varint holds 7 bits per byte, least significant first, with the
+// high bit set on every byte but the last. Since a file's extents usually
+// follow one another closely, most take only a few bytes.
+
+#ifndef HAVE_EXTENTS_FIEMAP_CACHE_H_
+#define HAVE_EXTENTS_FIEMAP_CACHE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+#include <sys/stat.h>
+
+enum cache_constants {
+    k_cache_version = 1,
+    k_cache_header_size = 32,
+    k_cache_entry_size = 64,
+    k_cache_magic_size = 8,
+    k_default_cache_limit = 64 * 1024 * 1024
+};
+
+// The first bytes of every cache file.
+extern const unsigned char k_cache_magic[k_cache_magic_size];
+
+// What identifies a version of a file.
+struct cache_key {
+    __u64 dev;
+    __u64 ino;
+    __u64 size;
+    __u64 mtime;
+    __u64 ctime;
+    __u32 mtime_nsec;
+    __u32 ctime_nsec;
+};
+
+// A file's extents, encoded, and when they were last used.
+struct cache_entry {
+    struct cache_key key;
+    __u64 last_used;
+    unsigned char *data;
+    size_t size;
+};
+
+// A cache, loaded into memory. Entries are found by device and inode number
+// in an open addressing hash table of indices into the entries array.
+struct extent_cache {
+    struct cache_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t *slots;      // entry indices, or SIZE_MAX for an empty slot
+    size_t slot_count;  // a power of two, more than twice count
+    __u64 clock;
+    size_t limit;       // the most bytes the cache file may take
+    size_t bytes;       // how many bytes the cache file would take now
+    struct fiemap_extent *extents; // extents decoded by the last lookup
+    size_t extent_capacity;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evicted;
+};
+
+// Starts an empty cache, kept only in memory, limited to limit bytes as if it
+// were to be saved.
+ATTRIBUTE((nonnull))
+void init_extent_cache(struct extent_cache *ecp, size_t limit);
+
+// Loads the cache at path, which will be limited to limit bytes when saved.
+// If there is no such file, the cache starts out empty. If the file isn't a
+// well-formed cache, that is reported and the cache starts out empty.
+ATTRIBUTE((nonnull))
+void load_extent_cache(struct extent_cache *restrict ecp,
+                       const char *restrict path, size_t limit);
+
+// Looks up the extents of the file stp describes. If they are cached and the
+// file is unchanged, returns them, setting *countp to how many there are. The
+// extents are valid until the next lookup. The pointer isn't null even if
+// there are no extents. Otherwise returns a null pointer. Either way, updates
+// the hit and miss statistics.
+ATTRIBUTE((nonnull))
+const struct fiemap_extent *
+find_cached_extents(struct extent_cache *restrict ecp,
+                    const struct stat *restrict stp, size_t *restrict countp);
+
+// Caches count extents of the file stp describes, replacing any extents
+// cached for an earlier version of it.
+ATTRIBUTE((nonnull(1, 2)))
+void cache_extents(struct extent_cache *restrict ecp,
+                   const struct stat *restrict stp,
+                   const struct fiemap_extent *restrict extents, size_t count);
+
+// Removes any extents cached for the file with device dev and inode number
+// ino, whatever version of it they were for.
+ATTRIBUTE((nonnull))
+void forget_cached_extents(struct extent_cache *ecp, __u64 dev, __u64 ino);
+
+// Evicts the least recently used entries until the cache would take no more
+// than target bytes as a file.
+ATTRIBUTE((nonnull))
+void trim_extent_cache(struct extent_cache *ecp, size_t target);
+
+// Evicts the least recently used entries until the cache fits in its limit,
+// then writes it to path, replacing the file atomically. Quits on failure.
+ATTRIBUTE((nonnull))
+void save_extent_cache(struct extent_cache *restrict ecp,
+                       const char *restrict path);
+
+// Frees the memory the cache holds.
+ATTRIBUTE((nonnull))
+void destroy_extent_cache(struct extent_cache *ecp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_CACHE_H_
@@ -0,0 +1,145 @@
+// coalesce.c - merging extents that are contiguous (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "coalesce.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+
+// Flags that say nothing about an extent's data, so they don't stop merging.
+static const __u32 k_ignored_flags = FIEMAP_EXTENT_LAST | FIEMAP_EXTENT_MERGED;
+
+// Flags that mean an extent's location or contents aren't ordinary, so it
+// mustn't be merged with anything.
+static const __u32 k_unmergeable_flags =
+        FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED
+        | FIEMAP_EXTENT_DATA_ENCRYPTED | FIEMAP_EXTENT_NOT_ALIGNED
+        | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL;
+
+void init_extent_coalescer(struct extent_coalescer *const ecp,
+                           struct extent_pager *const pgp, const bool enabled)
+{
+    assert(ecp);
+    assert(pgp);
+
+    *ecp = (struct extent_coalescer){
+        .pgp = pgp,
+        .enabled = enabled,
+        .fmp = (enabled ? xcalloc(1u, sizeof(struct fiemap)
+                                      + sizeof(struct fiemap_extent)
+                                        * (size_t)k_extents_per_page)
+                        : NULL)
+    };
+}
+
+// Checks if the second extent continues the first, so they can be merged.
+ATTRIBUTE((nonnull, pure))
+static bool can_merge(const struct fiemap_extent *restrict const first,
+                      const struct fiemap_extent *restrict const second)
+{
+    assert(first);
+    assert(second);
+
+    if ((first->fe_flags | second->fe_flags) & k_unmergeable_flags)
+        return false;
+
+    if ((first->fe_flags & ~k_ignored_flags)
+            != (second->fe_flags & ~k_ignored_flags))
+        return false;
+
+    if (first->fe_length > ULLONG_MAX - first->fe_logical
+            || first->fe_length > ULLONG_MAX - first->fe_physical)
+        return false;
+
+    return first->fe_logical + first->fe_length == second->fe_logical
+            && first->fe_physical + first->fe_length == second->fe_physical;
+}
+
+// Adds the pending extent to the page being built.
+ATTRIBUTE((nonnull))
+static void emit_pending(struct extent_coalescer *const ecp)
+{
+    assert(ecp);
+    assert(ecp->have_pending);
+    assert(ecp->fmp->fm_mapped_extents < k_extents_per_page);
+
+    ecp->fmp->fm_extents[ecp->fmp->fm_mapped_extents++] = ecp->pending;
+    ecp->have_pending = false;
+}
+
+// Merges or holds back each extent of a page retrieved from the pager.
+ATTRIBUTE((nonnull))
+static void coalesce_page(struct extent_coalescer *restrict const ecp,
+                          const struct fiemap *restrict const in)
+{
+    assert(ecp);
+    assert(in);
+
+    for (__u32 i = 0u; i < in->fm_mapped_extents; ++i) {
+        const struct fiemap_extent *const fep = &in->fm_extents[i];
+
+        if (ecp->have_pending && can_merge(&ecp->pending, fep)) {
+            ecp->pending.fe_length += fep->fe_length;
+            ecp->pending.fe_flags |= fep->fe_flags | FIEMAP_EXTENT_MERGED;
+            ++ecp->removed;
+            continue;
+        }
+
+        if (ecp->have_pending) emit_pending(ecp);
+        ecp->pending = *fep;
+        ecp->have_pending = true;
+    }
+
+    ecp->input_count += in->fm_mapped_extents;
+}
+
+const struct fiemap *next_coalesced_page(struct extent_coalescer *const ecp)
+{
+    assert(ecp);
+
+    if (!ecp->enabled) {
+        const struct fiemap *const fmp = next_extent_page(ecp->pgp);
+        if (fmp) ecp->input_count += fmp->fm_mapped_extents;
+        return fmp;
+    }
+
+    ecp->fmp->fm_mapped_extents = 0u;
+
+    // Each extent retrieved causes at most one merged extent (the one pending
+    // before it) to be emitted, so a page never yields more than it had.
+    while (ecp->fmp->fm_mapped_extents == 0u) {
+        const struct fiemap *const in = next_extent_page(ecp->pgp);
+
+        if (!in) {
+            if (!ecp->have_pending) return NULL;
+            emit_pending(ecp);
+            break;
+        }
+
+        coalesce_page(ecp, in);
+    }
+
+    return ecp->fmp;
+}
+
+void destroy_extent_coalescer(struct extent_coalescer *const ecp)
+{
+    assert(ecp);
+
+    free(ecp->fmp);
+    ecp->fmp = NULL;
+}
@@ -0,0 +1,58 @@
+// coalesce.h - merging extents that are contiguous both logically and on disk
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_COALESCE_H_
+#define HAVE_EXTENTS_FIEMAP_COALESCE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "pager.h"
+
+#include <stdbool.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+// State for coalescing the pages a pager retrieves. Filesystems often split a
+// run that is contiguous on disk into several extents (ext4 extents are at
+// most 128 MiB, for example). When enabled, each extent that begins, both
+// logically and physically, where the one before it ends, and whose flags are
+// compatible, is merged into it. The most recent merged extent is held back,
+// since it may merge with the first extent of the next page.
+struct extent_coalescer {
+    struct extent_pager *pgp;
+    bool enabled;
+    bool have_pending;
+    struct fiemap_extent pending; // merged extent not yet returned
+    struct fiemap *fmp;           // merged extents to return
+    __u64 input_count;            // how many extents the pager has given
+    __u64 removed;                // how many were merged into others
+};
+
+// Prepares to retrieve pages from the pager, coalescing them if enabled is
+// true and passing them through unchanged otherwise.
+ATTRIBUTE((nonnull))
+void init_extent_coalescer(struct extent_coalescer *ecp,
+                           struct extent_pager *pgp, bool enabled);
+
+// Retrieves the next page of (possibly) coalesced extents, like
+// next_extent_page(). Pages returned are never empty.
+ATTRIBUTE((nonnull))
+const struct fiemap *next_coalesced_page(struct extent_coalescer *ecp);
+
+// Frees the coalescer's buffer. Doesn't destroy the pager.
+ATTRIBUTE((nonnull))
+void destroy_extent_coalescer(struct extent_coalescer *ecp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_COALESCE_H_
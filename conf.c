@@ -14,12 +14,16 @@
 
 #include "conf.h"
 
+#include "constants.h"
+#include "scan.h"
 #include "util.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifndef NO_LONGOPTS
@@ -50,9 +54,17 @@ static noreturn void show_help_and_quit(void)
 {
     puts("Usage:\n");
 
-    printf("  %s [-t licfLICF] PATH\n", progname());
-    printf("  %s -B PATH\n", progname());
-    printf("  %s -s PATH\n", progname());
+    printf("  %s [-m] [-t licfLICF] [-w OFFSET:LENGTH] PATH\n", progname());
+    printf("  %s [-m] -B PATH\n", progname());
+    printf("  %s [-m] -s PATH\n", progname());
+    printf("  %s [-m] -b PATH >LISTING\n", progname());
+    printf("  %s [-m] -r PATH\n", progname());
+    printf("  %s [-m] [-t licfLICF | -b | -r] -y SPEC\n", progname());
+    printf("  %s [-m] [-t licfLICF | -b | -r] -e IMAGE PATH\n", progname());
+    printf("  %s [-m] [-t licfLICF | -r] [-j JOBS] { -R PATH... | -f LIST"
+            " [PATH...] }\n", progname());
+    printf("  %s -S SOCKET\n", progname());
+    printf("  %s [-b] -D OLD NEW\n", progname());
     printf("  %s { -V | -h }\n\n", progname());
 
     if (k_accept_longopts == (0)) {
@@ -67,16 +79,96 @@ static noreturn void show_help_and_quit(void)
     puts("  f or F   final block on disk, in sectors (f) or bytes (F)");
     puts("  c or C   count of blocks in file, in sectors (c) or bytes (C)\n");
 
-    puts("Mutliple column specifications don't combine. The last one wins.\n");
+    puts("Mutliple column specifications don't combine. The last one wins."
+            " Likewise,\n-b and -r override -t and each other.\n");
+
+    puts("SPEC describes made-up extents to show instead of a file's, for"
+            " testing and\nbenchmarking. It is count=N, optionally followed"
+            " by any of:\n");
+    puts("  ,seed=N         seed for the pseudorandom generator (default 1)");
+    puts("  ,size=MIN:MAX   extent lengths, in bytes (default 4K:1M)");
+    puts("  ,gap=MIN:MAX    space on disk before each extent (default 0:1M)");
+    puts("  ,hole=MIN:MAX   hole in the file before each extent"
+            " (default 0)\n");
+    puts("Byte counts must be multiples of 4K and may have a K, M, or G"
+            " suffix.\n");
+
+    puts("OFFSET:LENGTH limits the listing to that part of the file, as if"
+            " it ended there.\nExtents crossing its ends are cut off. Both are"
+            " in bytes, must be multiples of\n512, and may have a K, M, or G"
+            " suffix. -w works with every form but -S.\n");
+
+    puts("IMAGE is an unmounted ext4 filesystem, on a device or in a file,"
+            " whose own\nstructures are read to find the extents of the file"
+            " at PATH inside it. PATH\nmay also be <N>, for inode number N."
+            " The file must use extents.\n");
+
+    printf("With -R, each PATH may be a directory, and every regular file at"
+            " or under it is\nshown, in no particular order, each headed by"
+            " \"==> FILE <==\". Files are mapped by\nJOBS threads (default"
+            " %d). LIST names more paths, one per line, or is - for\nstandard"
+            " input. Binary output is only for one file.\n\n",
+            k_default_scan_jobs);
+
+    puts("With -S, fiemap runs until interrupted, answering batches of"
+            " queries sent to\nSOCKET, each for a path or an open file"
+            " descriptor, with binary listings.\nExtents are cached until"
+            " files change. See serve.h for the protocol.\n");
+
+    puts("With -D, OLD and NEW are snapshots of one file, binary listings"
+            " from fiemap -b\ntaken at different times, and each range whose"
+            " data moved, appeared, or\ndisappeared is shown as \"KIND"
+            " OFFSET LENGTH\", in bytes. With -b, a binary\nlisting of NEW's"
+            " extents in moved and appeared ranges is written instead.\n");
+
+    puts("Any form but the last may also have -M FILE, to write timings and"
+            " counts of\nsystem calls and bytes to FILE, or to standard error"
+            " if FILE is -, as key=value\nlines.\n");
 
     if (k_accept_longopts == (0)) {
         puts("The -B option means -t LIFC.");
         puts("The -s option means -t lifc, which is the default.");
+        puts("The -b option writes binary extent records instead of a"
+                " table.");
+        puts("The -r option shows a fragmentation report instead of a"
+                " table.");
+        puts("The -m option merges extents that continue each other, both"
+                " logically and on\ndisk, and reports how many rows that"
+                " removed.");
+        puts("The -y option shows synthetic extents as SPEC describes.");
+        puts("The -e option reads PATH's extents from the ext4 filesystem"
+                " IMAGE.");
+        puts("The -R option shows every regular file under each PATH.");
+        puts("The -f option reads paths from LIST. It implies -R.");
+        puts("The -j option specifies JOBS.");
+        puts("The -w option maps only OFFSET:LENGTH of the file.");
+        puts("The -S option serves queries on SOCKET.");
+        puts("The -D option compares snapshots OLD and NEW.");
+        puts("The -M option writes statistics to FILE.");
         puts("The -V option prints brief version information.");
         puts("The -h option prints this help message.\n");
     } else {
         puts("The -B (--bytes) option means -t LIFC.");
         puts("The -s (--sectors) option means -t lifc, which is the default.");
+        puts("The -b (--binary) option writes binary extent records instead"
+                " of a table.");
+        puts("The -r (--report) option shows a fragmentation report instead"
+                " of a table.");
+        puts("The -m (--merge) option merges extents that continue each other,"
+                " both\nlogically and on disk, and reports how many rows that"
+                " removed.");
+        puts("The -y (--synthetic) option shows synthetic extents as SPEC"
+                " describes.");
+        puts("The -e (--ext4) option reads PATH's extents from the ext4"
+                " filesystem IMAGE.");
+        puts("The -R (--recursive) option shows every regular file under each"
+                " PATH.");
+        puts("The -f (--from) option reads paths from LIST. It implies -R.");
+        puts("The -j (--jobs) option specifies JOBS.");
+        puts("The -w (--range) option maps only OFFSET:LENGTH of the file.");
+        puts("The -S (--serve) option serves queries on SOCKET.");
+        puts("The -D (--diff) option compares snapshots OLD and NEW.");
+        puts("The -M (--stats) option writes statistics to FILE.");
         puts("The -V (--version) option prints brief version information.");
         puts("The -h (--help) option prints this help message.");
     }
@@ -85,7 +177,7 @@ static noreturn void show_help_and_quit(void)
 }
 
 // Short options this program accepts, in the getopt() shortopts notation.
-static const char *const k_shortopts = ":t:BsVh";
+static const char *const k_shortopts = ":t:Bsbrmy:e:Rf:j:w:S:D:M:Vh";
 
 #ifdef NO_LONGOPTS
 // Processes short options.
@@ -96,6 +188,18 @@ static const struct option k_longopts[] = {
     { "bytes", no_argument, NULL, 'B' },
     { "sectors", no_argument, NULL, 's' },
     { "secs", no_argument, NULL, 's' },
+    { "binary", no_argument, NULL, 'b' },
+    { "report", no_argument, NULL, 'r' },
+    { "merge", no_argument, NULL, 'm' },
+    { "synthetic", required_argument, NULL, 'y' },
+    { "ext4", required_argument, NULL, 'e' },
+    { "recursive", no_argument, NULL, 'R' },
+    { "from", required_argument, NULL, 'f' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "range", required_argument, NULL, 'w' },
+    { "serve", required_argument, NULL, 'S' },
+    { "diff", required_argument, NULL, 'D' },
+    { "stats", required_argument, NULL, 'M' },
     { "version", no_argument, NULL, 'V' },
     { "help", no_argument, NULL, 'h' },
     { 0 }
@@ -116,6 +220,37 @@ static noreturn void die_unrecognized_option(char *const *const argv)
         die(BUG("unrecognized option diagnostic failed"));
 }
 
+// Parses a byte count for -w, which may be zero and must be a whole number of
+// sectors. Quits on failure.
+ATTRIBUTE((nonnull))
+static __u64 parse_range_bytes(const char *const text)
+{
+    assert(text);
+
+    const __u64 bytes = (strcmp(text, "0") == 0
+                            ? 0u : parse_number(text, ULLONG_MAX, true));
+    if (bytes % k_sector_size != 0u)
+        die("%s is not a multiple of %d bytes", text, k_sector_size);
+    return bytes;
+}
+
+// Parses the operand of -w, OFFSET:LENGTH. Quits on failure.
+ATTRIBUTE((nonnull))
+static void parse_range(char *restrict const text,
+                        struct conf *restrict const cp)
+{
+    assert(text);
+    assert(cp);
+
+    char *const colon = strchr(text, ':');
+    if (!colon) die("range must be OFFSET:LENGTH");
+    *colon = '\0';
+
+    cp->range_start = parse_range_bytes(text);
+    cp->range_length = parse_range_bytes(colon + 1);
+    cp->ranged = true;
+}
+
 // Process a single command-line option, including its operand(s) if any.
 static void process_option(char *const *restrict const argv, const int opt,
                            struct conf *restrict const cp)
@@ -123,14 +258,71 @@ static void process_option(char *const *restrict const argv, const int opt,
     switch (opt) {
     case 't':
         cp->columns = optarg;
+        cp->columns_chosen = true;
         break;
 
     case 'B':
         cp->columns = k_columns_default_in_bytes;
+        cp->columns_chosen = true;
         break;
 
     case 's':
         cp->columns = k_columns_default_in_sectors;
+        cp->columns_chosen = true;
+        break;
+
+    case 'b':
+        cp->output = k_output_binary;
+        break;
+
+    case 'r':
+        cp->output = k_output_report;
+        break;
+
+    case 'm':
+        cp->coalesce = true;
+        break;
+
+    case 'y':
+        parse_synthetic_spec(optarg, &cp->synthetic_spec);
+        cp->synthetic = true;
+        break;
+
+    case 'e':
+        cp->ext4_image = optarg;
+        break;
+
+    case 'R':
+        cp->recursive = true;
+        break;
+
+    case 'f':
+        if (optarg[0] == '\0') die("path list is empty");
+        cp->list_path = optarg;
+        cp->recursive = true;
+        break;
+
+    case 'j':
+        cp->jobs = (unsigned)parse_number(optarg, k_max_scan_jobs, false);
+        break;
+
+    case 'w':
+        parse_range(optarg, cp);
+        break;
+
+    case 'S':
+        if (optarg[0] == '\0') die("socket path is empty");
+        cp->serve_path = optarg;
+        break;
+
+    case 'D':
+        if (optarg[0] == '\0') die("snapshot path is empty");
+        cp->diff_path = optarg;
+        break;
+
+    case 'M':
+        if (optarg[0] == '\0') die("statistics path is empty");
+        cp->stats_path = optarg;
         break;
 
     case 'V':
@@ -160,10 +352,41 @@ int get_table_configuration(int argc, char **restrict const argv,
     set_progname(argv[0]);
 
     cp->columns = k_columns_default_in_sectors;
+    cp->columns_chosen = false;
+    cp->output = k_output_table;
+    cp->coalesce = false;
+    cp->synthetic = false;
+    cp->ext4_image = NULL;
+    cp->recursive = false;
+    cp->list_path = NULL;
+    cp->jobs = k_default_scan_jobs;
+    cp->serve_path = NULL;
+    cp->diff_path = NULL;
+    cp->stats_path = NULL;
+    cp->ranged = false;
+    cp->range_start = cp->range_length = 0u;
 
     opterr = false;
     for (int opt = 0; (opt = GETOPT(argc, argv)) != -1; )
         process_option(argv, opt, cp);
 
+    if (cp->synthetic && cp->ext4_image) die("-y and -e don't combine");
+    if (cp->recursive && (cp->synthetic || cp->ext4_image))
+        die("-R doesn't combine with -y or -e");
+    if (cp->recursive && cp->output == k_output_binary)
+        die("binary output is only for one file");
+    if (cp->serve_path && (cp->synthetic || cp->ext4_image || cp->recursive
+                           || cp->coalesce || cp->ranged
+                           || cp->columns_chosen
+                           || cp->output != k_output_table))
+        die("-S doesn't combine with -y, -e, -R, -m, -w, -t, -B, -s, -b,"
+                " or -r");
+    if (cp->diff_path && (cp->synthetic || cp->ext4_image || cp->recursive
+                          || cp->serve_path || cp->coalesce || cp->ranged
+                          || cp->columns_chosen
+                          || cp->output == k_output_report))
+        die("-D doesn't combine with -y, -e, -R, -S, -m, -w, -t, -B, -s,"
+                " or -r");
+
     return optind - 1;
 }
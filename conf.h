@@ -18,11 +18,36 @@
 #include "feature-test.h"
 
 #include "attribute.h"
+#include "synthetic.h"
 
-// User-provided configuration. Currently this just contains the columns string
-// but in future versions it may be expanded with more fields.
+#include <stdbool.h>
+#include <linux/types.h>
+
+// What fiemap writes.
+enum output_mode {
+    k_output_table,  // a table, with an intro and an interpretation guide
+    k_output_binary, // binary records (see record.h)
+    k_output_report  // a summary of how fragmented the file is
+};
+
+// User-provided configuration.
 struct conf {
     const char *columns;
+    bool columns_chosen; // -t, -B, or -s was given
+    enum output_mode output;
+    bool coalesce; // merge extents that are contiguous logically and on disk
+    bool synthetic; // make up extents instead of examining a file
+    struct synthetic_spec synthetic_spec;
+    const char *ext4_image; // read this ext4 filesystem instead of mapping
+    bool recursive;         // survey every regular file under the paths
+    const char *list_path;  // a file listing more paths to survey, if any
+    unsigned jobs;          // how many threads survey files
+    const char *serve_path; // a socket to answer queries on, if serving
+    const char *diff_path;  // an older snapshot to compare with, if diffing
+    const char *stats_path; // where to report statistics, if anywhere
+    bool ranged;            // map only part of each file:
+    __u64 range_start;      //   from this logical offset,
+    __u64 range_length;     //   for this many bytes
 };
 
 // Parses options and their operands out of command-line arguments using
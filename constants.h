@@ -15,6 +15,11 @@
 #ifndef HAVE_EXTENTS_FIEMAP_CONSTANTS_H_
 #define HAVE_EXTENTS_FIEMAP_CONSTANTS_H_
 
-enum filesystem_constants { k_sector_size = 512 };
+#include <assert.h>
+
+enum filesystem_constants { k_sector_size = 512, k_sector_shift = 9 };
+
+static_assert(k_sector_size == 1 << k_sector_shift,
+        "The sector size should be 2 to the power of the sector shift.");
 
 #endif // ! HAVE_EXTENTS_FIEMAP_CONSTANTS_H_
@@ -0,0 +1,227 @@
+// copy-splice.c - copying a file's data from the disk inside the kernel
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "copy.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// State for a copy. Data go straight from disk_fd to out_fd with
+// copy_file_range() if the kernel allows it for these files. Otherwise they go
+// through a pipe with splice(), which still never copies them to userspace.
+struct splice_copy {
+    int disk_fd;
+    int out_fd;
+    bool positioned;
+    bool try_copy_file_range;
+    int pipe_fds[2];
+    size_t pipe_size; // the most one splice() into the pipe should move
+};
+
+// Checks if a copy_file_range() error just means it can't copy between these
+// files, so splice() should be used instead.
+static bool is_unsupported(const int err)
+{
+    return err == EXDEV || err == EINVAL || err == EOPNOTSUPP
+            || err == ENOSYS || err == EBADF;
+}
+
+// Makes the pipe, enlarging it to about the chunk size if the kernel allows.
+ATTRIBUTE((nonnull))
+static void open_pipe(struct splice_copy *const scp, const size_t chunk_size)
+{
+    assert(scp);
+
+    if (pipe(scp->pipe_fds) != 0)
+        die("can't make pipe: %s", strerror(errno));
+
+    const int wanted = (chunk_size > INT_MAX ? INT_MAX : (int)chunk_size);
+    int size = fcntl(scp->pipe_fds[1], F_SETPIPE_SZ, wanted);
+    if (size <= 0) size = fcntl(scp->pipe_fds[1], F_GETPIPE_SZ);
+    if (size <= 0) die("can't get pipe size: %s", strerror(errno));
+
+    scp->pipe_size = (size_t)size;
+}
+
+ATTRIBUTE((nonnull))
+static void close_pipe(struct splice_copy *const scp)
+{
+    assert(scp);
+
+    if (scp->pipe_fds[1] < 0) return;
+
+    if (close(scp->pipe_fds[0]) != 0 || close(scp->pipe_fds[1]) != 0)
+        die("can't close pipe: %s", strerror(errno));
+
+    scp->pipe_fds[0] = scp->pipe_fds[1] = -1;
+}
+
+// Quits with a message about a failed read of part of a chunk.
+ATTRIBUTE((nonnull))
+static noreturn void die_reading(const struct chunk *const cp,
+                                 const size_t done, const char *const reason)
+{
+    assert(cp);
+    assert(reason);
+
+    die("can't read %zu bytes at byte %llu (row %zu): %s",
+            cp->length - done, cp->physical + done, cp->row, reason);
+}
+
+// Tries to copy the rest of a chunk with copy_file_range(). Returns false,
+// having copied nothing more, if that isn't supported for these files.
+ATTRIBUTE((nonnull))
+static bool copy_range(struct splice_copy *restrict const scp,
+                       const struct chunk *restrict const cp, size_t *donep)
+{
+    assert(scp);
+    assert(cp);
+    assert(donep);
+
+    const __u64 start = start_timing();
+
+    while (*donep < cp->length) {
+        loff_t in_offset = (loff_t)(cp->physical + *donep);
+        loff_t out_offset = (loff_t)(cp->logical + *donep);
+        const ssize_t ret = copy_file_range(scp->disk_fd, &in_offset,
+                                            scp->out_fd,
+                                            (scp->positioned ? &out_offset
+                                                             : NULL),
+                                            cp->length - *donep, 0u);
+
+        if (ret < 0 && errno == EINTR) continue;
+
+        if (ret < 0 && is_unsupported(errno)) {
+            scp->try_copy_file_range = false;
+            stop_timing(k_phase_io, start);
+            return false;
+        }
+
+        if (ret < 0) die_reading(cp, *donep, strerror(errno));
+        if (ret == 0) die_reading(cp, *donep, "unexpected end of device");
+
+        // Each call both reads and writes.
+        count_stat(k_stat_reads, 1u);
+        count_stat(k_stat_read_bytes, (__u64)ret);
+        count_stat(k_stat_writes, 1u);
+        count_stat(k_stat_written_bytes, (__u64)ret);
+        *donep += (size_t)ret;
+    }
+
+    stop_timing(k_phase_io, start);
+    return true;
+}
+
+// Moves len bytes, which must already be in the pipe, to the output. If the
+// copy is positioned, they are written at out_offset.
+ATTRIBUTE((nonnull))
+static void drain_pipe(const struct splice_copy *const scp, size_t len,
+                       __u64 out_offset)
+{
+    assert(scp);
+
+    while (len != 0u) {
+        loff_t offset = (loff_t)out_offset;
+        const ssize_t ret = splice(scp->pipe_fds[0], NULL, scp->out_fd,
+                                   (scp->positioned ? &offset : NULL),
+                                   len, SPLICE_F_MOVE);
+
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0)
+            die("can't write output: %s",
+                    (ret < 0 ? strerror(errno) : "nothing written"));
+
+        count_stat(k_stat_writes, 1u);
+        count_stat(k_stat_written_bytes, (__u64)ret);
+        len -= (size_t)ret;
+        out_offset += (size_t)ret;
+    }
+}
+
+// Copies the rest of a chunk through the pipe with splice().
+ATTRIBUTE((nonnull))
+static void splice_range(const struct splice_copy *restrict const scp,
+                         const struct chunk *restrict const cp, size_t done)
+{
+    assert(scp);
+    assert(cp);
+
+    const __u64 start = start_timing();
+
+    while (done < cp->length) {
+        const size_t remaining = cp->length - done;
+        const size_t len = (remaining < scp->pipe_size ? remaining
+                                                       : scp->pipe_size);
+        loff_t in_offset = (loff_t)(cp->physical + done);
+
+        const ssize_t ret = splice(scp->disk_fd, &in_offset,
+                                   scp->pipe_fds[1], NULL, len, SPLICE_F_MOVE);
+
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) die_reading(cp, done, strerror(errno));
+        if (ret == 0) die_reading(cp, done, "unexpected end of device");
+
+        count_stat(k_stat_reads, 1u);
+        count_stat(k_stat_read_bytes, (__u64)ret);
+        drain_pipe(scp, (size_t)ret, cp->logical + done);
+        done += (size_t)ret;
+    }
+
+    stop_timing(k_phase_io, start);
+}
+
+void copy_segments_splice(struct plan *restrict const pp,
+                          const int disk_fd, const int out_fd,
+                          const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+    assert(cop->chunk_size != 0u);
+
+    struct splice_copy sc = {
+        .disk_fd = disk_fd,
+        .out_fd = out_fd,
+        .positioned = cop->positioned,
+        .try_copy_file_range = true,
+        .pipe_fds = { -1, -1 }
+    };
+
+    struct chunker chunker = { 0 };
+    init_chunker(&chunker, pp, cop->chunk_size, 1u, !cop->positioned);
+
+    for (struct chunk chunk = { 0 }; next_chunk(&chunker, &chunk); ) {
+        if (chunk.zero) {
+            write_zeros(out_fd, chunk.length);
+            continue;
+        }
+
+        size_t done = 0u;
+        if (sc.try_copy_file_range && copy_range(&sc, &chunk, &done)) continue;
+
+        if (sc.pipe_fds[1] < 0) open_pipe(&sc, cop->chunk_size);
+        splice_range(&sc, &chunk, done);
+    }
+
+    close_pipe(&sc);
+}
@@ -0,0 +1,124 @@
+// copy-threads.c - copying a file's data from the disk with several threads
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "copy.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// State shared by the threads. The chunker is the work queue: each thread
+// takes the next chunk from it, holding the lock only while doing so. (If the
+// plan is incomplete, that includes the time to read the next row.)
+struct thread_copy {
+    pthread_mutex_t lock;
+    struct chunker chunker;
+    size_t buffer_size;
+    size_t alignment;
+    int disk_fd;
+    int out_fd;
+};
+
+// Takes the next chunk from the shared chunker. Returns false if none remain.
+ATTRIBUTE((nonnull))
+static bool take_chunk(struct thread_copy *restrict const tcp,
+                       struct chunk *restrict const cp)
+{
+    assert(tcp);
+    assert(cp);
+
+    if (pthread_mutex_lock(&tcp->lock) != 0) die(BUG("can't lock mutex"));
+    const bool ret = next_chunk(&tcp->chunker, cp);
+    if (pthread_mutex_unlock(&tcp->lock) != 0) die(BUG("can't unlock mutex"));
+
+    return ret;
+}
+
+// Copies chunks until there are none left. This is each thread's start
+// routine.
+static void *run_worker(void *const arg)
+{
+    struct thread_copy *const tcp = arg;
+    assert(tcp);
+
+    char *const buf = xaligned_alloc(tcp->alignment, tcp->buffer_size);
+
+    for (struct chunk chunk = { 0 }; take_chunk(tcp, &chunk); ) {
+        read_chunk(tcp->disk_fd, buf, &chunk);
+        write_chunk(tcp->out_fd, buf, &chunk, true);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+// Reserves space for the whole output file, so writes at scattered offsets
+// don't fragment it. It's no error if the filesystem can't do that.
+static void preallocate(const int out_fd, const __u64 size)
+{
+    if (size == 0u) return;
+
+    const int err = posix_fallocate(out_fd, 0, (off_t)size);
+    if (err != 0 && err != EOPNOTSUPP && err != EINVAL)
+        die("can't allocate output: %s", strerror(err));
+}
+
+void copy_segments_threads(struct plan *restrict const pp,
+                           const int disk_fd, const int out_fd,
+                           const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+    assert(cop->thread_count != 0u && cop->chunk_size != 0u);
+
+    if (!is_regular_file(out_fd))
+        die("the threads engine can only write to a regular file");
+
+    struct thread_copy tc = { .disk_fd = disk_fd, .out_fd = out_fd };
+    if (pthread_mutex_init(&tc.lock, NULL) != 0)
+        die("can't initialize mutex");
+
+    init_chunker(&tc.chunker, pp, cop->chunk_size, cop->alignment, false);
+    tc.buffer_size = chunk_buffer_size(&tc.chunker);
+    tc.alignment = cop->alignment;
+
+    // Preallocating would fill in the holes of a sparse file.
+    if (pp->complete && !pp->sparse) preallocate(out_fd, pp->size);
+
+    pthread_t *const threads = xcalloc(cop->thread_count, sizeof threads[0]);
+
+    for (unsigned i = 0u; i < cop->thread_count; ++i) {
+        const int err = pthread_create(&threads[i], NULL, run_worker, &tc);
+        if (err != 0) die("can't create thread: %s", strerror(err));
+    }
+
+    for (unsigned i = 0u; i < cop->thread_count; ++i) {
+        const int err = pthread_join(threads[i], NULL);
+        if (err != 0) die(BUG("can't join thread: %s"), strerror(err));
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&tc.lock);
+    assert(pp->complete);
+
+    if (ftruncate(out_fd, (off_t)pp->size) != 0)
+        die("can't truncate output: %s", strerror(errno));
+}
@@ -0,0 +1,216 @@
+// copy-uring.c - copying a file's data from the disk with io_uring
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "copy.h"
+
+#include "ring.h"
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A buffer for one chunk, and how far reading that chunk into it has gotten.
+// The read is complete once the chunk's data are read, even if that is short
+// of the end of the aligned range, as may happen at the end of the device.
+struct slot {
+    char *buf;
+    struct chunk chunk;
+    size_t done;
+    bool complete;
+};
+
+// State for a copy. Chunk number n (counting from 0) is read into slot
+// n % depth, and the slot isn't reused until that chunk has been written. So
+// the slots are also a bounded buffer for reordering completed reads.
+struct uring_copy {
+    struct ring ring;
+    struct chunker chunker;
+    struct slot *slots;
+    char *buffers;
+    unsigned depth;
+    int disk_fd;
+    int out_fd;
+    bool positioned;
+    __u64 issued;  // how many chunks have been assigned to slots
+    __u64 emitted; // how many chunks have been written to the output
+    unsigned in_flight; // how many slots are waiting for reads
+};
+
+// Requests a read of whatever part of a slot's chunk hasn't been read yet.
+ATTRIBUTE((nonnull))
+static void queue_read(struct uring_copy *const ucp, const unsigned index)
+{
+    assert(ucp);
+    assert(index < ucp->depth);
+
+    const struct slot *const slotp = &ucp->slots[index];
+    assert(slotp->done < slotp->chunk.skip + slotp->chunk.length);
+
+    struct io_uring_sqe *const sqep = get_sqe(&ucp->ring);
+    if (!sqep) die(BUG("no room in the io_uring submission queue"));
+
+    sqep->opcode = IORING_OP_READ;
+    sqep->fd = ucp->disk_fd;
+    sqep->off = slotp->chunk.read_offset + slotp->done;
+    sqep->addr = (__u64)(uintptr_t)(slotp->buf + slotp->done);
+    sqep->len = (__u32)(slotp->chunk.read_length - slotp->done);
+    sqep->user_data = index;
+}
+
+// Assigns chunks to free slots and requests reads for them.
+ATTRIBUTE((nonnull))
+static void fill_slots(struct uring_copy *const ucp)
+{
+    assert(ucp);
+
+    while (ucp->issued - ucp->emitted < ucp->depth) {
+        const unsigned index = (unsigned)(ucp->issued % ucp->depth);
+        struct slot *const slotp = &ucp->slots[index];
+        assert(!slotp->complete);
+
+        if (!next_chunk(&ucp->chunker, &slotp->chunk)) break;
+
+        slotp->done = 0u;
+        ++ucp->issued;
+
+        if (slotp->chunk.zero) {
+            slotp->complete = true; // there's nothing to read
+        } else {
+            queue_read(ucp, index);
+            ++ucp->in_flight;
+        }
+    }
+}
+
+// Records the result of a read. Requests another read if the chunk is still
+// incomplete, as happens after a short read or an interruption.
+ATTRIBUTE((nonnull))
+static void handle_completion(struct uring_copy *restrict const ucp,
+                              const struct io_uring_cqe *restrict const cqep)
+{
+    assert(ucp);
+    assert(cqep);
+
+    if (cqep->user_data >= ucp->depth)
+        die(BUG("io_uring completion for unknown slot %llu"),
+                cqep->user_data);
+
+    const unsigned index = (unsigned)cqep->user_data;
+    struct slot *const slotp = &ucp->slots[index];
+    const size_t needed = slotp->chunk.skip + slotp->chunk.length;
+    const int res = cqep->res;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        queue_read(ucp, index);
+        return;
+    }
+
+    if (res <= 0) {
+        die("can't read %zu bytes at byte %llu (row %zu): %s",
+                needed - slotp->done,
+                slotp->chunk.read_offset + slotp->done, slotp->chunk.row,
+                (res < 0 ? strerror(-res) : "unexpected end of device"));
+    }
+
+    count_stat(k_stat_reads, 1u);
+    count_stat(k_stat_read_bytes, (__u64)res);
+    slotp->done += (size_t)res;
+    assert(slotp->done <= slotp->chunk.read_length);
+
+    if (slotp->done < needed) {
+        queue_read(ucp, index);
+    } else {
+        slotp->complete = true;
+        --ucp->in_flight;
+    }
+}
+
+// Writes out chunks, in the order they were issued, for as long as the next
+// one has been read.
+ATTRIBUTE((nonnull))
+static void emit_ready_chunks(struct uring_copy *const ucp)
+{
+    assert(ucp);
+
+    while (ucp->emitted != ucp->issued) {
+        struct slot *const slotp = &ucp->slots[ucp->emitted % ucp->depth];
+        if (!slotp->complete) break;
+
+        write_chunk(ucp->out_fd, slotp->buf, &slotp->chunk, ucp->positioned);
+        slotp->complete = false;
+        ++ucp->emitted;
+    }
+}
+
+ATTRIBUTE((nonnull))
+static void run_copy(struct uring_copy *const ucp)
+{
+    assert(ucp);
+
+    fill_slots(ucp);
+
+    while (ucp->emitted != ucp->issued) {
+        // If only zero chunks are waiting, there's no completion to wait for.
+        if (ucp->in_flight != 0u) {
+            enter_ring(&ucp->ring, 1u);
+
+            for (const struct io_uring_cqe *cqep = NULL;
+                    (cqep = peek_cqe(&ucp->ring)); consume_cqe(&ucp->ring))
+                handle_completion(ucp, cqep);
+        }
+
+        emit_ready_chunks(ucp);
+        fill_slots(ucp);
+    }
+}
+
+bool copy_segments_uring(struct plan *restrict const pp,
+                         const int disk_fd, const int out_fd,
+                         const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+    assert(cop->queue_depth != 0u && cop->chunk_size != 0u);
+
+    struct uring_copy uc = {
+        .depth = cop->queue_depth,
+        .disk_fd = disk_fd,
+        .out_fd = out_fd,
+        .positioned = cop->positioned
+    };
+
+    if (!open_ring(&uc.ring, uc.depth)) return false;
+
+    init_chunker(&uc.chunker, pp, cop->chunk_size, cop->alignment,
+                 !cop->positioned);
+    const size_t buffer_size = chunk_buffer_size(&uc.chunker);
+    if (buffer_size > SIZE_MAX / uc.depth) die("out of memory");
+
+    uc.slots = xcalloc(uc.depth, sizeof uc.slots[0]);
+    uc.buffers = xaligned_alloc(cop->alignment, buffer_size * uc.depth);
+
+    for (unsigned i = 0u; i < uc.depth; ++i)
+        uc.slots[i].buf = uc.buffers + (size_t)i * buffer_size;
+
+    run_copy(&uc);
+
+    free(uc.buffers);
+    free(uc.slots);
+    close_ring(&uc.ring);
+    return true;
+}
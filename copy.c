@@ -0,0 +1,239 @@
+// copy.c - copying a file's data from the disk to the output (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "copy.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+size_t get_direct_alignment(const int disk_fd)
+{
+    int logical = 0;
+    unsigned physical = 0u;
+
+    if (ioctl(disk_fd, BLKSSZGET, &logical) != 0)
+        die("can't get logical block size: %s", strerror(errno));
+    if (ioctl(disk_fd, BLKPBSZGET, &physical) != 0)
+        die("can't get physical block size: %s", strerror(errno));
+    count_stat(k_stat_ioctls, 2u);
+
+    msg("The disk has %d-byte logical and %u-byte physical blocks.",
+            logical, physical);
+
+    if (logical <= 0 || (logical & (logical - 1)) != 0)
+        die("logical block size %d is not a power of two", logical);
+
+    if (physical < (unsigned)logical || (physical & (physical - 1u)) != 0u)
+        return (size_t)logical;
+
+    return physical;
+}
+
+void read_chunk(const int disk_fd, char *restrict const buf,
+                const struct chunk *restrict const cp)
+{
+    assert(buf);
+    assert(cp);
+
+    if (cp->zero) return;
+
+    const size_t needed = cp->skip + cp->length;
+    const __u64 start = start_timing();
+
+    for (size_t done = 0u; done < needed; ) {
+        const ssize_t ret = pread(disk_fd, buf + done, cp->read_length - done,
+                                  (off_t)(cp->read_offset + done));
+
+        if (ret < 0 && errno == EINTR) continue;
+
+        if (ret <= 0) {
+            die("can't read %zu bytes at byte %llu (row %zu): %s",
+                    needed - done, cp->read_offset + done, cp->row,
+                    (ret < 0 ? strerror(errno) : "unexpected end of device"));
+        }
+
+        count_stat(k_stat_reads, 1u);
+        count_stat(k_stat_read_bytes, (__u64)ret);
+        done += (size_t)ret;
+    }
+
+    stop_timing(k_phase_io, start);
+}
+
+void write_chunk(const int out_fd, const char *restrict const buf,
+                 const struct chunk *restrict const cp, const bool positioned)
+{
+    assert(buf);
+    assert(cp);
+
+    if (cp->zero) {
+        if (!positioned) write_zeros(out_fd, cp->length);
+        return;
+    }
+
+    if (!positioned) {
+        write_fully(out_fd, buf + cp->skip, cp->length);
+        return;
+    }
+
+    const __u64 start = start_timing();
+
+    for (size_t done = 0u; done < cp->length; ) {
+        const ssize_t ret = pwrite(out_fd, buf + cp->skip + done,
+                                   cp->length - done,
+                                   (off_t)(cp->logical + done));
+
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0)
+            die("can't write output: %s",
+                    (ret < 0 ? strerror(errno) : "nothing written"));
+
+        count_stat(k_stat_writes, 1u);
+        count_stat(k_stat_written_bytes, (__u64)ret);
+        done += (size_t)ret;
+    }
+
+    stop_timing(k_phase_io, start);
+}
+
+// Seeks length bytes past out_fd's current position, which must be in a
+// regular file, then extends the file to there if it is shorter.
+static void skip_output(const int out_fd, const __u64 length)
+{
+    const off_t start = lseek(out_fd, 0, SEEK_CUR);
+    if (start < 0) die("can't seek in output: %s", strerror(errno));
+
+    if (length > (__u64)(INT64_MAX - start))
+        die("can't seek in output: %s", strerror(EOVERFLOW));
+
+    const off_t end = start + (off_t)length;
+    if (lseek(out_fd, end, SEEK_SET) != end)
+        die("can't seek in output: %s", strerror(errno));
+
+    struct stat st;
+    if (fstat(out_fd, &st) != 0)
+        die("can't examine output: %s", strerror(errno));
+
+    if (st.st_size < end && ftruncate(out_fd, end) != 0)
+        die("can't extend output: %s", strerror(errno));
+}
+
+void write_zeros(const int out_fd, __u64 length)
+{
+    if (is_regular_file(out_fd)) {
+        skip_output(out_fd, length);
+        return;
+    }
+
+    static const char zeros[64 * 1024];
+
+    for (size_t len = 0u; length != 0u; length -= len) {
+        len = (length < sizeof zeros ? (size_t)length : sizeof zeros);
+        write_fully(out_fd, zeros, len);
+    }
+}
+
+// Extends the output, if it is a regular file, to size bytes, in case the
+// file ends in a hole that was never written to. This is for positioned
+// copies, which write nothing for zero chunks.
+static void extend_output(const int out_fd, const __u64 size)
+{
+    struct stat st;
+    if (fstat(out_fd, &st) != 0 || !S_ISREG(st.st_mode)) return;
+
+    if ((__u64)st.st_size < size && ftruncate(out_fd, (off_t)size) != 0)
+        die("can't extend output: %s", strerror(errno));
+}
+
+void copy_segments_pread(struct plan *restrict const pp,
+                         const int disk_fd, const int out_fd,
+                         const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+
+    struct chunker chunker = { 0 };
+    init_chunker(&chunker, pp, cop->chunk_size, cop->alignment,
+                 !cop->positioned);
+
+    char *const buf = xaligned_alloc(cop->alignment,
+                                     chunk_buffer_size(&chunker));
+
+    for (struct chunk chunk = { 0 }; next_chunk(&chunker, &chunk); ) {
+        read_chunk(disk_fd, buf, &chunk);
+        write_chunk(out_fd, buf, &chunk, cop->positioned);
+    }
+
+    free(buf);
+}
+
+bool is_regular_file(const int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+void copy_segments(struct plan *restrict const pp, const int disk_fd,
+                   const int out_fd,
+                   const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+
+    switch (cop->engine) {
+    case k_engine_auto:
+        if (!cop->direct && is_regular_file(out_fd)) {
+            copy_segments_splice(pp, disk_fd, out_fd, cop);
+            break;
+        }
+        if (copy_segments_uring(pp, disk_fd, out_fd, cop)) break;
+        msg("io_uring is unavailable (%s); using pread().", strerror(errno));
+        copy_segments_pread(pp, disk_fd, out_fd, cop);
+        break;
+
+    case k_engine_pread:
+        copy_segments_pread(pp, disk_fd, out_fd, cop);
+        break;
+
+    case k_engine_uring:
+        if (!copy_segments_uring(pp, disk_fd, out_fd, cop))
+            die("io_uring is unavailable: %s", strerror(errno));
+        break;
+
+    case k_engine_splice:
+        assert(!cop->direct);
+        copy_segments_splice(pp, disk_fd, out_fd, cop);
+        break;
+
+    case k_engine_threads:
+        copy_segments_threads(pp, disk_fd, out_fd, cop);
+        break;
+
+    default:
+        die(BUG("unrecognized copy engine"));
+    }
+
+    if (cop->positioned) extend_output(out_fd, pp->size);
+}
@@ -0,0 +1,123 @@
+// copy.h - copying a file's data from the disk to the output
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_COPY_H_
+#define HAVE_EXTENTS_FIEMAP_COPY_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "plan.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum copy_constants {
+    k_default_queue_depth = 16,
+    k_default_chunk_size = 1024 * 1024,
+    k_max_queue_depth = 4096,
+    k_max_chunk_size = 1024 * 1024 * 1024,
+    k_default_thread_count = 4,
+    k_max_thread_count = 1024
+};
+
+// Ways of reading data from the disk.
+enum copy_engine {
+    k_engine_auto,   // splice if output is a regular file, else io_uring if
+                     // available, otherwise pread()
+    k_engine_pread,  // one synchronous pread() at a time
+    k_engine_uring,  // up to queue_depth reads in flight with io_uring
+    k_engine_splice, // copy_file_range() or splice(), never via userspace
+    k_engine_threads // thread_count threads, each pwrite()ing what it reads
+};
+
+struct copy_options {
+    enum copy_engine engine;
+    unsigned queue_depth;  // at most this many chunks are read concurrently
+    size_t chunk_size;     // no single read is much bigger than this
+    unsigned thread_count; // how many threads read and write concurrently
+    bool direct;           // the disk is opened with O_DIRECT
+    bool positioned;       // write each chunk at its logical offset
+    size_t alignment;      // reads and buffers are aligned to this
+};
+
+// Finds the alignment direct I/O on disk_fd needs: the device's physical block
+// size, or its logical block size if that is bigger. Quits on failure.
+size_t get_direct_alignment(int disk_fd);
+
+// Checks if fd refers to a regular file, which the kernel can copy into and
+// which can be written at any offset.
+bool is_regular_file(int fd);
+
+// Reads a chunk from disk_fd into buf, which must be aligned as the chunker
+// that made the chunk requires. Stops once the chunk's data are read, even if
+// that is before the end of the aligned range. Quits on failure, including if
+// the device ends first. A zero chunk has nothing to read, so it is ignored.
+ATTRIBUTE((nonnull))
+void read_chunk(int disk_fd, char *restrict buf,
+                const struct chunk *restrict cp);
+
+// Writes a chunk's data, which begin skip bytes into buf, to out_fd. If
+// positioned is true, they are written at the chunk's logical offset with
+// pwrite(). Otherwise they are written at out_fd's current position. A zero
+// chunk is written with write_zeros() instead, or, if positioned is true, not
+// at all, since the output starts out empty.
+ATTRIBUTE((nonnull))
+void write_chunk(int out_fd, const char *restrict buf,
+                 const struct chunk *restrict cp, bool positioned);
+
+// Writes length zeros at out_fd's current position. If out_fd is a regular
+// file, seeks past them instead, extending the file if they reach past its
+// end, so they are a hole rather than taking up space.
+void write_zeros(int out_fd, __u64 length);
+
+// Copies the plan's segments, in order, from disk_fd to out_fd, using the
+// engine the options specify. An incomplete plan is extended as the copy
+// proceeds, so reading can start before the whole listing has arrived. Holes
+// and unwritten extents aren't read: the output gets holes there if it is a
+// regular file, and zeros otherwise.
+ATTRIBUTE((nonnull))
+void copy_segments(struct plan *restrict pp, int disk_fd, int out_fd,
+                   const struct copy_options *restrict cop);
+
+// Copies with pread(), one chunk at a time, through a single reused buffer.
+ATTRIBUTE((nonnull))
+void copy_segments_pread(struct plan *restrict pp, int disk_fd,
+                         int out_fd, const struct copy_options *restrict cop);
+
+// Copies with io_uring, keeping up to queue_depth chunk reads in flight. Reads
+// may complete in any order, but data are written in logical order. Returns
+// false, with errno set and nothing copied, if io_uring is unavailable.
+ATTRIBUTE((nonnull))
+bool copy_segments_uring(struct plan *restrict pp, int disk_fd,
+                         int out_fd, const struct copy_options *restrict cop);
+
+// Copies without reading data into userspace, with copy_file_range() if the
+// kernel supports it between disk_fd and out_fd, or otherwise with splice()
+// through a pipe. Ignores the alignment option, so O_DIRECT is not supported.
+ATTRIBUTE((nonnull))
+void copy_segments_splice(struct plan *restrict pp, int disk_fd,
+                          int out_fd, const struct copy_options *restrict cop);
+
+// Copies with thread_count threads. Each repeatedly takes the next chunk,
+// reads it with pread(), and writes it with pwrite() at its logical offset, so
+// chunks may be written in any order, whether or not positioned is set. out_fd
+// must be a regular file. It is preallocated first if the plan is complete
+// and not sparse, and truncated to the file's size afterwards.
+ATTRIBUTE((nonnull))
+void copy_segments_threads(struct plan *restrict pp, int disk_fd,
+                           int out_fd,
+                           const struct copy_options *restrict cop);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_COPY_H_
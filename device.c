@@ -0,0 +1,295 @@
+// device.c - information about block devices, from sysfs (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "device.h"
+
+#include "constants.h"
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/dm-ioctl.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+enum { k_sysfs_path_bufsz = 1024 };
+
+// Writes the path of an attribute in a block device's sysfs directory, or of
+// the directory itself if attribute is empty.
+ATTRIBUTE((nonnull))
+static void format_sysfs_path(char *restrict const path, const dev_t dev,
+                              const char *restrict const attribute)
+{
+    assert(path);
+    assert(attribute);
+
+    if (snprintf(path, k_sysfs_path_bufsz, "/sys/dev/block/%u:%u%s%s",
+                 major(dev), minor(dev), (attribute[0] ? "/" : ""),
+                 attribute) >= k_sysfs_path_bufsz)
+        die(BUG("sysfs path exceeds buffer"));
+}
+
+__u64 read_sysfs_number(const dev_t dev, const char *const attribute)
+{
+    assert(attribute);
+
+    char path[k_sysfs_path_bufsz] = {0};
+    format_sysfs_path(path, dev, attribute);
+
+    FILE *const sysfp = fopen(path, "r");
+    if (!sysfp) die("%s: %s", path, strerror(errno));
+
+    __u64 number = 0uLL;
+    char extra = '\0';
+    if (fscanf(sysfp, "%llu %c", &number, &extra) != 1)
+        die("can't interpret %s as %s", path, attribute);
+
+    fclose(sysfp);
+    return number;
+}
+
+// Checks if a block device's sysfs directory has an attribute.
+ATTRIBUTE((nonnull))
+static bool has_sysfs_attribute(const dev_t dev, const char *const attribute)
+{
+    assert(attribute);
+
+    char path[k_sysfs_path_bufsz] = {0};
+    format_sysfs_path(path, dev, attribute);
+    return access(path, F_OK) == 0;
+}
+
+bool is_known_device(const dev_t dev)
+{
+    return has_sysfs_attribute(dev, "");
+}
+
+// Finds the disk a partition is on. Partitions' sysfs directories are
+// subdirectories of their disks'. Returns false if that can't be determined.
+ATTRIBUTE((nonnull))
+static bool find_partition_disk(const dev_t dev, dev_t *const diskp)
+{
+    assert(diskp);
+
+    char link[k_sysfs_path_bufsz] = {0};
+    format_sysfs_path(link, dev, "");
+
+    char *const dir = realpath(link, NULL);
+    if (!dir) return false;
+
+    // The disk's directory is the partition's, with its last component off.
+    const char *const slash = strrchr(dir, '/');
+    char path[k_sysfs_path_bufsz] = {0};
+    int len = -1;
+    if (slash && slash - dir <= INT_MAX)
+        len = snprintf(path, sizeof path, "%.*s/dev", (int)(slash - dir), dir);
+    free(dir);
+    if (len < 0 || (size_t)len >= sizeof path) return false;
+
+    FILE *const fp = fopen(path, "r");
+    if (!fp) return false;
+
+    unsigned maj = 0u, min = 0u;
+    char extra = '\0';
+    const bool ok = fscanf(fp, "%u:%u %c", &maj, &min, &extra) == 2;
+    fclose(fp);
+
+    if (ok) *diskp = makedev(maj, min);
+    return ok;
+}
+
+// Encodes a device number the way the kernel's device-mapper ioctls take it.
+static __u64 encode_dm_dev(const dev_t dev)
+{
+    const __u64 maj = major(dev), min = minor(dev);
+    return (min & 0xffu) | (maj << 8u) | ((min & ~0xffuLL) << 12u);
+}
+
+// Finds what a device-mapper device maps to, if its table is a single linear
+// target starting at its beginning. Reading the table needs privileges.
+// Returns false if it can't be read or isn't of that form.
+ATTRIBUTE((nonnull))
+static bool find_linear_target(const dev_t dev,
+                               struct device_level *const lp)
+{
+    assert(lp);
+
+    const int fd = open("/dev/mapper/control", O_RDWR | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    enum { bufsz = 16384 };
+    static_assert(sizeof(struct dm_ioctl) + sizeof(struct dm_target_spec)
+                    < bufsz, "a table should fit in the ioctl buffer");
+
+    union {
+        struct dm_ioctl header;
+        char bytes[bufsz];
+    } buf;
+    memset(&buf, 0, sizeof buf);
+
+    buf.header.version[0] = DM_VERSION_MAJOR;
+    buf.header.data_size = sizeof buf;
+    buf.header.data_start = sizeof buf.header;
+    buf.header.flags = DM_STATUS_TABLE_FLAG;
+    buf.header.dev = encode_dm_dev(dev);
+
+    const bool got = ioctl(fd, DM_TABLE_STATUS, &buf) == 0;
+    count_stat(k_stat_ioctls, 1u);
+    close(fd);
+
+    if (!got || (buf.header.flags & DM_BUFFER_FULL_FLAG)
+            || buf.header.target_count != 1u
+            || buf.header.data_start > bufsz - sizeof(struct dm_target_spec))
+        return false;
+
+    buf.bytes[bufsz - 1] = '\0';
+
+    struct dm_target_spec spec;
+    memcpy(&spec, buf.bytes + buf.header.data_start, sizeof spec);
+    spec.target_type[DM_MAX_TYPE_NAME - 1] = '\0';
+    if (spec.sector_start != 0u || strcmp(spec.target_type, "linear") != 0)
+        return false;
+
+    const char *const params = buf.bytes + buf.header.data_start + sizeof spec;
+    unsigned maj = 0u, min = 0u;
+    unsigned long long start = 0uLL;
+    char extra = '\0';
+    if (sscanf(params, "%u:%u %llu %c", &maj, &min, &start, &extra) != 3)
+        return false;
+
+    *lp = (struct device_level){ .dev = makedev(maj, min),
+                                 .offset = start * k_sector_size };
+    return true;
+}
+
+// Finds the device one level down from dev, and where dev starts in it.
+// Returns false if dev isn't known to lie on anything.
+ATTRIBUTE((nonnull))
+static bool find_lower_level(const dev_t dev, struct device_level *const lp)
+{
+    assert(lp);
+
+    if (has_sysfs_attribute(dev, "partition")) {
+        if (!find_partition_disk(dev, &lp->dev)) return false;
+        lp->offset = read_sysfs_number(dev, "start") * k_sector_size;
+        return true;
+    }
+
+    if (has_sysfs_attribute(dev, "dm")) return find_linear_target(dev, lp);
+
+    return false;
+}
+
+// Finds what a device lies on, without consulting the cache.
+ATTRIBUTE((nonnull))
+static void resolve_uncached(const dev_t dev, struct device_stack *const sp)
+{
+    assert(sp);
+
+    sp->size = read_sysfs_number(dev, "size") * k_sector_size;
+    sp->levels[0] = (struct device_level){ .dev = dev, .offset = 0u };
+    sp->depth = 1u;
+
+    while (sp->depth < k_max_device_depth) {
+        const struct device_level *const above = &sp->levels[sp->depth - 1u];
+
+        struct device_level below = { 0 };
+        if (!find_lower_level(above->dev, &below)) break;
+
+        below.offset += above->offset;
+        sp->levels[sp->depth++] = below;
+    }
+}
+
+// A device, resolved. Entries are never changed or freed once added.
+struct resolution {
+    dev_t dev;
+    struct device_stack stack;
+    struct resolution *next;
+};
+
+static struct resolution *g_cache;
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const struct device_stack *resolve_device(const dev_t dev)
+{
+    const __u64 start = start_timing();
+
+    if (pthread_mutex_lock(&g_cache_lock) != 0)
+        die(BUG("can't lock device cache"));
+
+    struct resolution *entry = g_cache;
+    while (entry && entry->dev != dev) entry = entry->next;
+
+    if (!entry) {
+        entry = xcalloc(1u, sizeof *entry);
+        entry->dev = dev;
+        resolve_uncached(dev, &entry->stack);
+        entry->next = g_cache;
+        g_cache = entry;
+    }
+
+    if (pthread_mutex_unlock(&g_cache_lock) != 0)
+        die(BUG("can't unlock device cache"));
+
+    stop_timing(k_phase_device, start);
+    return &entry->stack;
+}
+
+char *find_device_node(const dev_t dev)
+{
+    char path[k_sysfs_path_bufsz] = {0};
+    format_sysfs_path(path, dev, "uevent");
+
+    FILE *const fp = fopen(path, "r");
+    if (!fp) return NULL;
+
+    static const char prefix[] = "DEVNAME=";
+    char *line = NULL, *node = NULL;
+    size_t capacity = 0u;
+    ssize_t len = 0;
+
+    while (!node && (len = getline(&line, &capacity, fp)) > 0) {
+        if (line[len - 1] == '\n') line[len - 1] = '\0';
+        if (strncmp(line, prefix, sizeof prefix - 1u) != 0) continue;
+
+        const char *const name = line + sizeof prefix - 1u;
+        node = xcalloc(strlen("/dev/") + strlen(name) + 1u, 1u);
+        strcat(strcpy(node, "/dev/"), name);
+    }
+
+    free(line);
+    fclose(fp);
+    return node;
+}
+
+__u64 get_offset(const dev_t dev)
+{
+    const struct device_stack *const sp = resolve_device(dev);
+    return sp->levels[sp->depth - 1u].offset;
+}
+
+__u64 get_device_size(const dev_t dev)
+{
+    return resolve_device(dev)->size;
+}
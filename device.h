@@ -0,0 +1,77 @@
+// device.h - information about block devices, from sysfs
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A volume may sit on other block devices: a partition on its disk, or a
+// device-mapper linear volume (as LVM makes) on whatever it maps to. This
+// follows such a volume down as far as sysfs and device-mapper say, through
+// partitions and single-target dm-linear tables, and caches what it finds for
+// each device. Mapping through device-mapper needs privileges to read the
+// table; without them, resolution stops at the dm device. Other stacking,
+// such as md RAID, also stops resolution there. Everything here is safe to
+// call from several threads.
+
+#ifndef HAVE_EXTENTS_FIEMAP_DEVICE_H_
+#define HAVE_EXTENTS_FIEMAP_DEVICE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/types.h>
+#include <sys/types.h>
+
+enum device_constants { k_max_device_depth = 8 };
+
+// A device a volume lies on, and where in that device the volume starts.
+struct device_level {
+    dev_t dev;
+    __u64 offset; // in bytes
+};
+
+// A volume and what it lies on, outermost first. levels[0] is the volume
+// itself, at offset 0. The last level is the disk, as far as can be told.
+struct device_stack {
+    struct device_level levels[k_max_device_depth];
+    size_t depth;
+    __u64 size; // the volume's size in bytes
+};
+
+// Reads a nonnegative integer from an attribute file in the sysfs directory
+// of a block device. Quits on failure.
+ATTRIBUTE((nonnull))
+__u64 read_sysfs_number(dev_t dev, const char *attribute);
+
+// Checks if sysfs knows of a block device with this number. Files on some
+// filesystems, such as btrfs, report device numbers that aren't real devices.
+bool is_known_device(dev_t dev);
+
+// Finds what the block device lies on. The result is cached and stays valid
+// until the program exits. Quits if the device isn't in sysfs.
+ATTRIBUTE((returns_nonnull))
+const struct device_stack *resolve_device(dev_t dev);
+
+// Finds the node for a block device from the name the kernel gives it in
+// sysfs. Returns the path of the node, or a null pointer if there is none.
+ATTRIBUTE((malloc))
+char *find_device_node(dev_t dev);
+
+// Gets where the device starts on the disk it lies on, in bytes.
+__u64 get_offset(dev_t dev);
+
+// Gets the size of a block device in bytes.
+__u64 get_device_size(dev_t dev);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_DEVICE_H_
@@ -0,0 +1,276 @@
+// diff.c - comparing extent snapshots of a file (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "diff.h"
+
+#include "constants.h"
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Flags that don't bear on where an extent's data are.
+static const __u32 k_incidental_flags = FIEMAP_EXTENT_LAST
+                                        | FIEMAP_EXTENT_MERGED
+                                        | FIEMAP_EXTENT_SHARED;
+
+// Reads len bytes of a snapshot, quitting if they aren't all there.
+ATTRIBUTE((nonnull))
+static void read_snapshot_bytes(FILE *restrict const fp,
+                                const char *restrict const path,
+                                unsigned char *restrict const bytes,
+                                const size_t len,
+                                const char *restrict const what)
+{
+    assert(fp);
+    assert(path);
+    assert(bytes);
+    assert(what);
+
+    if (fread(bytes, 1u, len, fp) == len) return;
+
+    if (ferror(fp)) die("%s: %s", path, strerror(errno));
+    die("%s: snapshot ends abruptly, %s expected", path, what);
+}
+
+// Gets the logical offset past which a file's extents hold none of its data.
+ATTRIBUTE((const))
+static __u64 get_data_limit(const __u64 file_size)
+{
+    if (file_size > ULLONG_MAX - (k_sector_size - 1u)) return ULLONG_MAX;
+    return (file_size + (k_sector_size - 1u)) / k_sector_size * k_sector_size;
+}
+
+// Adds a record, cut off at limit, to a snapshot, if any of it is before
+// limit. Quits if it overlaps the record before it or is malformed.
+ATTRIBUTE((nonnull))
+static void add_snapshot_record(struct snapshot *restrict const sp,
+                                size_t *restrict const capacityp,
+                                struct extent_record record,
+                                const __u64 limit,
+                                const char *restrict const path)
+{
+    assert(sp);
+    assert(capacityp);
+    assert(path);
+    assert(record.length != 0u);
+
+    if (record.logical > ULLONG_MAX - record.length
+            || record.physical > ULLONG_MAX - record.length)
+        die("%s: extent at logical byte %llu is too long", path,
+                record.logical);
+
+    if (sp->count != 0u) {
+        const struct extent_record *const prev = &sp->records[sp->count - 1u];
+        if (record.logical < prev->logical + prev->length)
+            die("%s: extents overlap or are out of order", path);
+    }
+
+    if (record.logical >= limit) return;
+    if (record.length > limit - record.logical)
+        record.length = limit - record.logical;
+
+    if (sp->count == *capacityp) {
+        *capacityp = (*capacityp == 0u ? 64u : *capacityp * 2u);
+        sp->records = xreallocarray(sp->records, *capacityp,
+                                    sizeof sp->records[0]);
+    }
+
+    sp->records[sp->count++] = record;
+}
+
+void load_snapshot(struct snapshot *restrict const sp,
+                   const char *restrict const path)
+{
+    assert(sp);
+    assert(path);
+
+    const __u64 start = start_timing();
+
+    const bool is_stdin = strcmp(path, "-") == 0;
+    FILE *const fp = (is_stdin ? stdin : fopen(path, "rb"));
+    if (!fp) die("%s: %s", path, strerror(errno));
+
+    unsigned char bytes[k_record_header_size];
+    read_snapshot_bytes(fp, path, bytes, k_record_header_size, "header");
+    if (memcmp(bytes, k_record_magic, k_record_magic_size) != 0)
+        die("%s: not a binary listing", path);
+
+    *sp = (struct snapshot){ .records = NULL, .count = 0u };
+    decode_record_header(&sp->header, bytes);
+
+    const __u64 limit = get_data_limit(sp->header.file_size);
+    size_t capacity = 0u;
+    __u64 record_count = 0u;
+
+    for (;;) {
+        read_snapshot_bytes(fp, path, bytes, k_record_size,
+                            "record or trailer");
+
+        struct extent_record record = { 0 };
+        decode_extent_record(&record, bytes);
+        if (record.length == 0u) {
+            if (record.logical != record_count) {
+                die("%s: trailer says %llu records, but there were %llu",
+                        path, record.logical, record_count);
+            }
+            break;
+        }
+
+        add_snapshot_record(sp, &capacity, record, limit, path);
+        ++record_count;
+    }
+
+    if (getc(fp) != EOF) die("%s: unexpected data after trailer", path);
+    if (ferror(fp)) die("%s: %s", path, strerror(errno));
+    if (!is_stdin) fclose(fp);
+
+    stop_timing(k_phase_parse, start);
+}
+
+bool is_same_volume(const struct snapshot *const older,
+                    const struct snapshot *const newer)
+{
+    assert(older);
+    assert(newer);
+
+    return older->header.major == newer->header.major
+            && older->header.minor == newer->header.minor
+            && older->header.device_start == newer->header.device_start;
+}
+
+// Lowers *boundp to limit, if limit is lower.
+ATTRIBUTE((nonnull))
+static void lower_bound(__u64 *const boundp, const __u64 limit)
+{
+    assert(boundp);
+    if (limit < *boundp) *boundp = limit;
+}
+
+// Finds the extent holding data at logical offset pos, if any, first skipping
+// extents that end at or before pos. Nothing past limit counts as data. Lowers
+// *boundp to where that could next change. Offsets must never decrease from
+// one call to the next.
+ATTRIBUTE((nonnull))
+static const struct extent_record *
+locate(const struct extent_record **restrict const nextp,
+       const struct extent_record *restrict const end, const __u64 pos,
+       const __u64 limit, __u64 *restrict const boundp)
+{
+    assert(nextp);
+    assert(*nextp);
+    assert(end);
+    assert(boundp);
+
+    while (*nextp != end && (*nextp)->logical + (*nextp)->length <= pos)
+        ++*nextp;
+
+    if (*nextp == end || pos >= limit) return NULL;
+    lower_bound(boundp, limit);
+
+    const struct extent_record *const rp = *nextp;
+
+    if (rp->logical > pos) {
+        lower_bound(boundp, rp->logical);
+        return NULL;
+    }
+
+    lower_bound(boundp, rp->logical + rp->length);
+    return (rp->flags & FIEMAP_EXTENT_UNWRITTEN) ? NULL : rp;
+}
+
+// Checks if two extents put the data at logical offset pos in the same place.
+ATTRIBUTE((nonnull, pure))
+static bool is_same_place(const struct extent_record *const older,
+                          const struct extent_record *const newer,
+                          const __u64 pos)
+{
+    assert(older);
+    assert(newer);
+
+    return older->physical + (pos - older->logical)
+                == newer->physical + (pos - newer->logical)
+            && (older->flags & ~k_incidental_flags)
+                == (newer->flags & ~k_incidental_flags);
+}
+
+void diff_snapshots(const struct snapshot *const older,
+                    const struct snapshot *const newer,
+                    change_handler *const handler, void *const context)
+{
+    assert(older);
+    assert(newer);
+    assert(handler);
+
+    static const struct extent_record none = { 0 };
+    const struct extent_record *old_next = (older->count ? older->records
+                                                          : &none);
+    const struct extent_record *new_next = (newer->count ? newer->records
+                                                          : &none);
+    const struct extent_record *const old_end = old_next + older->count;
+    const struct extent_record *const new_end = new_next + newer->count;
+
+    const bool same_volume = is_same_volume(older, newer);
+
+    // If the file grew, its old partial last sector didn't hold all the data
+    // that's there now.
+    const __u64 old_size = older->header.file_size;
+    const __u64 old_limit = (newer->header.file_size > old_size
+                                ? old_size / k_sector_size * k_sector_size
+                                : ULLONG_MAX);
+
+    for (__u64 pos = 0u; ; ) {
+        __u64 bound = ULLONG_MAX;
+        const struct extent_record *const was =
+                locate(&old_next, old_end, pos, old_limit, &bound);
+        const struct extent_record *const now =
+                locate(&new_next, new_end, pos, ULLONG_MAX, &bound);
+
+        if (old_next == old_end && new_next == new_end) break;
+
+        struct extent_change change = {
+            .logical = pos,
+            .length = bound - pos,
+            .now = now
+        };
+
+        if (was && now) {
+            change.kind = k_change_moved;
+            if (!same_volume || !is_same_place(was, now, pos))
+                handler(&change, context);
+        } else if (now) {
+            change.kind = k_change_appeared;
+            handler(&change, context);
+        } else if (was) {
+            change.kind = k_change_disappeared;
+            handler(&change, context);
+        }
+
+        pos = bound;
+    }
+}
+
+void destroy_snapshot(struct snapshot *const sp)
+{
+    assert(sp);
+
+    free(sp->records);
+    sp->records = NULL;
+    sp->count = 0u;
+}
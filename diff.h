@@ -0,0 +1,90 @@
+// diff.h - comparing extent snapshots of a file
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A snapshot is a binary listing (see record.h), as fiemap -b writes: every
+// extent of a file, with the volume it's on. Comparing two snapshots of the
+// same file, taken at different times, finds the logical ranges whose data
+// may have changed, as far as the extents tell. Data rewritten in place, as
+// many filesystems do for overwrites, leave no trace in the extents, so this
+// is only useful on filesystems that write new data elsewhere (such as btrfs)
+// or for files that are only appended to or replaced.
+//
+// Only what lies within a file counts, so a snapshot's extents are cut off at
+// its file size, rounded up to a whole number of sectors. If the file grew,
+// the older snapshot's partial last sector counts as changed too. Holes and
+// unwritten extents hold no data.
+
+#ifndef HAVE_EXTENTS_FIEMAP_DIFF_H_
+#define HAVE_EXTENTS_FIEMAP_DIFF_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "record.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+// A snapshot, loaded into memory.
+struct snapshot {
+    struct record_header header;
+    struct extent_record *records; // in logical order, never overlapping
+    size_t count;
+};
+
+// How a logical range's mapping differs between two snapshots.
+enum change_kind {
+    k_change_moved,       // data in both, but not in the same place
+    k_change_appeared,    // data only in the newer snapshot
+    k_change_disappeared  // data only in the older snapshot
+};
+
+// A logical range whose mapping changed, wholly within one extent of each
+// snapshot that has data there.
+struct extent_change {
+    enum change_kind kind;
+    __u64 logical;
+    __u64 length;
+    const struct extent_record *now; // the newer extent, if there is data
+};
+
+// Called for each change, in logical order.
+typedef void change_handler(const struct extent_change *changep,
+                            void *context);
+
+// Reads a snapshot from path, or from standard input if path is "-". Quits
+// on failure, or if the listing is malformed.
+ATTRIBUTE((nonnull))
+void load_snapshot(struct snapshot *restrict sp, const char *restrict path);
+
+// Checks if two snapshots are of files on the same volume, at the same place
+// on its disk, so their physical offsets mean the same thing.
+ATTRIBUTE((nonnull, pure))
+bool is_same_volume(const struct snapshot *older,
+                    const struct snapshot *newer);
+
+// Finds every range whose mapping differs between an older and a newer
+// snapshot, in one pass over both. If they aren't of the same volume, all
+// data in both count as moved.
+ATTRIBUTE((nonnull(1, 2, 3)))
+void diff_snapshots(const struct snapshot *older,
+                    const struct snapshot *newer,
+                    change_handler *handler, void *context);
+
+// Frees a snapshot's extents.
+ATTRIBUTE((nonnull))
+void destroy_snapshot(struct snapshot *sp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_DIFF_H_
@@ -0,0 +1,774 @@
+// ext4.c - reading extents straight from an ext4 filesystem (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// For the on-disk format, see:
+//
+//  - https://www.kernel.org/doc/html/latest/filesystems/ext4/
+//  - https://github.com/torvalds/linux/blob/master/fs/ext4/ext4.h
+//  - https://github.com/torvalds/linux/blob/master/fs/ext4/ext4_extents.h
+
+#include "ext4.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+enum ext4_format {
+    k_superblock_offset = 1024,
+    k_superblock_size = 1024,
+    k_magic = 0xEF53,
+    k_good_old_inode_size = 128, // the inode size in revision 0
+    k_good_old_first_ino = 11,
+    k_max_log_block_size = 6,    // blocks are at most 64 KiB
+
+    // Incompatible features. Any others make the filesystem unreadable here.
+    k_incompat_filetype = 0x2,
+    k_incompat_recover = 0x4,
+    k_incompat_extents = 0x40,
+    k_incompat_64bit = 0x80,
+    k_incompat_supported = 0x2 | 0x4 | 0x40 | 0x80 | 0x100 | 0x200 | 0x400
+                           | 0x2000 | 0x4000 | 0x8000 | 0x10000 | 0x20000,
+
+    // Read-only compatible features that make the unused-inode counts valid.
+    k_ro_compat_gdt_csum = 0x10,
+    k_ro_compat_metadata_csum = 0x400,
+
+    k_group_desc_size = 32,       // without the 64bit feature
+    k_group_desc_size_64bit = 64, // the least with it
+    k_bg_inode_uninit = 0x1,
+
+    k_inode_extents_fl = 0x80000,
+    k_inode_inline_data_fl = 0x10000000,
+
+    k_extent_magic = 0xF30A,
+    k_extent_node_header_size = 12,
+    k_extent_entry_size = 12,
+    k_extent_max_depth = 5,
+    k_extent_init_max_len = 32768, // longer means unwritten
+
+    k_dirent_header_size = 8,
+    k_dirent_name_max = 255,
+    k_ftype_regular = 1,
+    k_ftype_directory = 2,
+
+    k_scan_chunk_size = 4 * 1024 * 1024
+};
+
+// Reads len bytes at offset, quitting unless they are all there.
+ATTRIBUTE((nonnull))
+static void read_fully(const struct ext4_fs *restrict const fsp,
+                       void *restrict const buf, const size_t len,
+                       const __u64 offset)
+{
+    assert(fsp);
+    assert(buf);
+
+    for (size_t done = 0u; done < len; ) {
+        if (offset + done > (__u64)LLONG_MAX)
+            die("%s: offset %llu is too big", fsp->path, offset + done);
+
+        const ssize_t ret = pread(fsp->fd, (char *)buf + done, len - done,
+                                  (off_t)(offset + done));
+
+        if (ret < 0 && errno == EINTR) continue;
+
+        if (ret <= 0) {
+            die("%s: can't read %zu bytes at byte %llu: %s", fsp->path,
+                    len - done, offset + done,
+                    (ret < 0 ? strerror(errno) : "unexpected end of file"));
+        }
+
+        count_stat(k_stat_reads, 1u);
+        count_stat(k_stat_read_bytes, (__u64)ret);
+        done += (size_t)ret;
+    }
+}
+
+// Reads block number block into buf, which must hold a block.
+ATTRIBUTE((nonnull))
+static void read_block(const struct ext4_fs *restrict const fsp,
+                       unsigned char *restrict const buf, const __u64 block)
+{
+    assert(fsp);
+    assert(buf);
+
+    if (block >= fsp->block_count)
+        die("%s: block %llu is past the end of the filesystem",
+                fsp->path, block);
+
+    read_fully(fsp, buf, fsp->block_size, block * fsp->block_size);
+}
+
+// Decodes the fields of a group descriptor that matter here.
+ATTRIBUTE((nonnull))
+static void decode_group(struct ext4_group *restrict const gp,
+                         const unsigned char *restrict const bytes,
+                         const __u32 desc_size, const __u32 inodes_per_group,
+                         const bool trust_unused)
+{
+    assert(gp);
+    assert(bytes);
+
+    const bool wide = desc_size >= k_group_desc_size_64bit;
+
+    gp->inode_table = get_le32(bytes + 0x8);
+    if (wide) gp->inode_table |= (__u64)get_le32(bytes + 0x28) << 32;
+
+    __u32 unused = get_le16(bytes + 0x1C);
+    if (wide) unused |= (__u32)get_le16(bytes + 0x32) << 16;
+
+    if (!trust_unused)
+        gp->used = inodes_per_group;
+    else if (get_le16(bytes + 0x12) & k_bg_inode_uninit)
+        gp->used = 0u;
+    else
+        gp->used = inodes_per_group - (unused < inodes_per_group
+                                            ? unused : inodes_per_group);
+}
+
+// Reads the group descriptors, which start in the block after the superblock.
+ATTRIBUTE((nonnull))
+static void read_groups(struct ext4_fs *const fsp, const __u32 desc_size,
+                        const __u64 first_data_block, const bool trust_unused)
+{
+    assert(fsp);
+
+    const size_t size = (size_t)fsp->group_count * desc_size;
+    unsigned char *const bytes = xcalloc(size, 1u);
+    read_fully(fsp, bytes, size, (first_data_block + 1u) * fsp->block_size);
+
+    fsp->groups = xcalloc(fsp->group_count, sizeof fsp->groups[0]);
+
+    for (__u32 i = 0u; i < fsp->group_count; ++i) {
+        decode_group(&fsp->groups[i], bytes + (size_t)i * desc_size,
+                     desc_size, fsp->inodes_per_group, trust_unused);
+    }
+
+    free(bytes);
+}
+
+void open_ext4(struct ext4_fs *restrict const fsp,
+               const char *restrict const path)
+{
+    assert(fsp);
+    assert(path);
+
+    *fsp = (struct ext4_fs){ .path = path };
+
+    fsp->fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fsp->fd < 0) die("%s: %s", path, strerror(errno));
+
+    struct stat st = { 0 };
+    if (fstat(fsp->fd, &st) != 0) die("%s: %s", path, strerror(errno));
+    fsp->dev = (S_ISBLK(st.st_mode) ? st.st_rdev : makedev(0u, 0u));
+
+    unsigned char sb[k_superblock_size];
+    read_fully(fsp, sb, sizeof sb, k_superblock_offset);
+
+    if (get_le16(sb + 0x38) != k_magic)
+        die("%s: not an ext4 filesystem", path);
+
+    const __u32 log_block_size = get_le32(sb + 0x18);
+    if (log_block_size > k_max_log_block_size)
+        die("%s: block size is too big", path);
+    fsp->block_size = 1024u << log_block_size;
+
+    const __u32 incompat = get_le32(sb + 0x60);
+    const __u32 ro_compat = get_le32(sb + 0x64);
+    if (incompat & ~(__u32)k_incompat_supported)
+        die("%s: unsupported filesystem features (0x%x)",
+                path, incompat & ~(__u32)k_incompat_supported);
+    if (!(incompat & k_incompat_extents))
+        die("%s: filesystem doesn't use extents", path);
+    if (incompat & k_incompat_recover)
+        msg("%s: journal needs recovery; some data may be stale.", path);
+
+    const bool is_64bit = (incompat & k_incompat_64bit) != 0u;
+    fsp->has_filetype = (incompat & k_incompat_filetype) != 0u;
+
+    fsp->block_count = get_le32(sb + 0x4);
+    if (is_64bit) fsp->block_count |= (__u64)get_le32(sb + 0x150) << 32;
+
+    const __u32 first_data_block = get_le32(sb + 0x14);
+    const __u32 blocks_per_group = get_le32(sb + 0x20);
+    fsp->inode_count = get_le32(sb + 0x0);
+    fsp->inodes_per_group = get_le32(sb + 0x28);
+
+    const bool old = get_le32(sb + 0x4C) == 0u;
+    fsp->inode_size = (old ? k_good_old_inode_size : get_le16(sb + 0x58));
+    fsp->first_ino = (old ? k_good_old_first_ino : get_le32(sb + 0x54));
+
+    const __u32 desc_size = (is_64bit ? get_le16(sb + 0xFE)
+                                      : k_group_desc_size);
+
+    if (blocks_per_group == 0u || fsp->inodes_per_group == 0u
+            || first_data_block >= fsp->block_count
+            || fsp->inode_size < k_good_old_inode_size
+            || fsp->inode_size > fsp->block_size
+            || (fsp->inode_size & (fsp->inode_size - 1u)) != 0u
+            || desc_size < k_group_desc_size
+            || (is_64bit && desc_size < k_group_desc_size_64bit)
+            || desc_size > fsp->block_size)
+        die("%s: malformed superblock", path);
+
+    const __u64 group_count = (fsp->block_count - first_data_block
+                                + blocks_per_group - 1u) / blocks_per_group;
+    if (group_count > UINT_MAX / fsp->inodes_per_group
+            || group_count * fsp->inodes_per_group < fsp->inode_count)
+        die("%s: malformed superblock", path);
+    fsp->group_count = (__u32)group_count;
+
+    read_groups(fsp, desc_size, first_data_block,
+                (ro_compat & (k_ro_compat_gdt_csum
+                              | k_ro_compat_metadata_csum)) != 0u);
+}
+
+// Decodes the fields of an inode that matter here.
+ATTRIBUTE((nonnull))
+static void decode_inode(struct ext4_inode *restrict const ip,
+                         const unsigned char *restrict const bytes,
+                         const __u32 ino)
+{
+    assert(ip);
+    assert(bytes);
+
+    ip->ino = ino;
+    ip->mode = get_le16(bytes + 0x0);
+    ip->links = get_le16(bytes + 0x1A);
+    ip->flags = get_le32(bytes + 0x20);
+    ip->size = get_le32(bytes + 0x4) | (__u64)get_le32(bytes + 0x6C) << 32;
+    memcpy(ip->i_block, bytes + 0x28, sizeof ip->i_block);
+}
+
+void read_ext4_inode(const struct ext4_fs *restrict const fsp,
+                     const __u32 ino, struct ext4_inode *restrict const ip)
+{
+    assert(fsp);
+    assert(ip);
+
+    if (ino == 0u || ino > fsp->inode_count)
+        die("%s: no inode %u", fsp->path, ino);
+
+    const __u32 group = (ino - 1u) / fsp->inodes_per_group;
+    const __u32 index = (ino - 1u) % fsp->inodes_per_group;
+    const __u64 offset = fsp->groups[group].inode_table * fsp->block_size
+                            + (__u64)index * fsp->inode_size;
+
+    unsigned char bytes[k_good_old_inode_size];
+    read_fully(fsp, bytes, sizeof bytes, offset);
+    decode_inode(ip, bytes, ino);
+}
+
+bool can_map_ext4_inode(const struct ext4_inode *const ip)
+{
+    assert(ip);
+
+    if ((ip->flags & k_inode_inline_data_fl)
+            || !(ip->flags & k_inode_extents_fl)) {
+        errno = EOPNOTSUPP;
+        return false;
+    }
+
+    return true;
+}
+
+// Quits with a message about a corrupt extent tree.
+static noreturn void die_corrupt(const struct ext4_fs *const fsp,
+                                 const __u32 ino)
+{
+    die("%s: inode %u: corrupt extent tree", fsp->path, ino);
+}
+
+// Appends an extent, merging nothing, so the list is just like FIEMAP's.
+ATTRIBUTE((nonnull))
+static void append_extent(struct extent_list *restrict const elp,
+                          const struct fiemap_extent *restrict const fep)
+{
+    assert(elp);
+    assert(fep);
+
+    if (elp->count == elp->capacity) {
+        elp->capacity = (elp->capacity ? elp->capacity * 2u : 16u);
+        elp->extents = xreallocarray(elp->extents, elp->capacity,
+                                     sizeof elp->extents[0]);
+    }
+
+    elp->extents[elp->count++] = *fep;
+}
+
+// Adds the extents in a leaf node.
+ATTRIBUTE((nonnull))
+static void read_leaf(const struct ext4_fs *restrict const fsp,
+                      const struct ext4_inode *restrict const ip,
+                      const unsigned char *restrict entry,
+                      const __u16 count, struct extent_list *restrict elp)
+{
+    assert(fsp);
+    assert(ip);
+    assert(entry);
+    assert(elp);
+
+    const __u64 bs = fsp->block_size;
+
+    for (__u16 i = 0u; i < count; ++i, entry += k_extent_entry_size) {
+        const __u32 logical = get_le32(entry);
+        __u32 length = get_le16(entry + 4);
+        const __u64 physical = get_le32(entry + 8)
+                                | (__u64)get_le16(entry + 6) << 32;
+
+        const bool unwritten = length > k_extent_init_max_len;
+        if (unwritten) length -= k_extent_init_max_len;
+
+        if (length == 0u || physical >= fsp->block_count
+                || length > fsp->block_count - physical)
+            die_corrupt(fsp, ip->ino);
+
+        if (elp->count != 0u) {
+            const struct fiemap_extent *const lastp =
+                    &elp->extents[elp->count - 1u];
+            if (logical * bs < lastp->fe_logical + lastp->fe_length)
+                die_corrupt(fsp, ip->ino);
+        }
+
+        append_extent(elp, &(struct fiemap_extent){
+            .fe_logical = logical * bs,
+            .fe_physical = physical * bs,
+            .fe_length = length * bs,
+            .fe_flags = (unwritten ? FIEMAP_EXTENT_UNWRITTEN : 0u)
+        });
+    }
+}
+
+// Adds the extents in a node of size bytes, and the nodes under it. If depth
+// isn't negative, the node must be at that depth.
+ATTRIBUTE((nonnull))
+static void read_node(const struct ext4_fs *restrict const fsp,
+                      const struct ext4_inode *restrict const ip,
+                      const unsigned char *restrict const node,
+                      const size_t size, const int depth,
+                      struct extent_list *restrict const elp)
+{
+    assert(fsp);
+    assert(ip);
+    assert(node);
+    assert(elp);
+
+    const __u16 count = get_le16(node + 2);
+    const __u16 node_depth = get_le16(node + 6);
+
+    if (get_le16(node) != k_extent_magic || count > get_le16(node + 4)
+            || k_extent_node_header_size + (size_t)count * k_extent_entry_size
+                > size
+            || node_depth > k_extent_max_depth
+            || (depth >= 0 && node_depth != depth))
+        die_corrupt(fsp, ip->ino);
+
+    const unsigned char *entry = node + k_extent_node_header_size;
+
+    if (node_depth == 0u) {
+        read_leaf(fsp, ip, entry, count, elp);
+        return;
+    }
+
+    unsigned char *const child = xcalloc(fsp->block_size, 1u);
+
+    for (__u16 i = 0u; i < count; ++i, entry += k_extent_entry_size) {
+        const __u64 block = get_le32(entry + 4)
+                             | (__u64)get_le16(entry + 8) << 32;
+        if (block >= fsp->block_count) die_corrupt(fsp, ip->ino);
+
+        read_block(fsp, child, block);
+        read_node(fsp, ip, child, fsp->block_size, node_depth - 1, elp);
+    }
+
+    free(child);
+}
+
+void get_ext4_extents(const struct ext4_fs *restrict const fsp,
+                      const struct ext4_inode *restrict const ip,
+                      struct extent_list *restrict const elp)
+{
+    assert(fsp);
+    assert(ip);
+    assert(elp);
+    assert(can_map_ext4_inode(ip));
+
+    elp->count = 0u;
+    read_node(fsp, ip, ip->i_block, sizeof ip->i_block, -1, elp);
+
+    if (elp->count != 0u)
+        elp->extents[elp->count - 1u].fe_flags |= FIEMAP_EXTENT_LAST;
+}
+
+// Called with each entry of a directory: its name (not null-terminated), the
+// name's length, the inode number, the file type (0 if unknown), and a
+// context. Returns true to stop reading the directory.
+typedef bool dirent_visitor(const char *name, size_t len, __u32 ino,
+                            unsigned type, void *context);
+
+// Gets the length of a directory entry, as it is encoded in big blocks.
+static size_t decode_rec_len(const __u16 rec_len, const __u32 block_size)
+{
+    if (block_size < 65536u) return rec_len;
+    if (rec_len == 65535u || rec_len == 0u) return block_size;
+    return (rec_len & 65532u) | ((size_t)(rec_len & 3u) << 16);
+}
+
+// Calls visit for each entry in a block of a directory. Returns true if it
+// says to stop. Quits if the block is malformed.
+ATTRIBUTE((nonnull(1, 2, 4)))
+static bool read_dir_block(const struct ext4_fs *restrict const fsp,
+                           const unsigned char *restrict const block,
+                           const __u32 dir, dirent_visitor *const visit,
+                           void *const context)
+{
+    assert(fsp);
+    assert(block);
+    assert(visit);
+
+    for (size_t offset = 0u; offset + k_dirent_header_size
+                                <= fsp->block_size; ) {
+        const unsigned char *const entry = block + offset;
+        const __u32 ino = get_le32(entry);
+        const size_t rec_len = decode_rec_len(get_le16(entry + 4),
+                                              fsp->block_size);
+        const size_t name_len = entry[6];
+
+        if (rec_len < k_dirent_header_size
+                || rec_len > fsp->block_size - offset
+                || k_dirent_header_size + name_len > rec_len)
+            die("%s: directory %u is malformed", fsp->path, dir);
+
+        if (ino != 0u && name_len != 0u
+                && visit((const char *)entry + k_dirent_header_size,
+                         name_len, ino, (fsp->has_filetype ? entry[7] : 0u),
+                         context))
+            return true;
+
+        offset += rec_len;
+    }
+
+    return false;
+}
+
+// Calls visit for each entry in a directory, including "." and "..", until it
+// says to stop. Returns false, with errno set, if the directory can't be read.
+ATTRIBUTE((nonnull(1, 3)))
+static bool read_dir(const struct ext4_fs *const fsp, const __u32 dir,
+                     dirent_visitor *const visit, void *const context)
+{
+    assert(fsp);
+    assert(visit);
+
+    struct ext4_inode inode = { 0 };
+    read_ext4_inode(fsp, dir, &inode);
+
+    if (!S_ISDIR(inode.mode)) {
+        errno = ENOTDIR;
+        return false;
+    }
+    if (!can_map_ext4_inode(&inode)) return false;
+
+    struct extent_list list = { 0 };
+    get_ext4_extents(fsp, &inode, &list);
+    unsigned char *const block = xcalloc(fsp->block_size, 1u);
+    bool stop = false;
+
+    for (size_t i = 0u; i < list.count && !stop; ++i) {
+        const struct fiemap_extent *const fep = &list.extents[i];
+        if (fep->fe_flags & FIEMAP_EXTENT_UNWRITTEN) continue;
+
+        for (__u64 done = 0u; done < fep->fe_length && !stop;
+                done += fsp->block_size) {
+            read_block(fsp, block, (fep->fe_physical + done)
+                                    / fsp->block_size);
+            stop = read_dir_block(fsp, block, dir, visit, context);
+        }
+    }
+
+    free(block);
+    destroy_extent_list(&list);
+    return true;
+}
+
+// What find_ext4_path() is looking for in a directory, and what it found.
+struct lookup {
+    const char *name;
+    size_t len;
+    __u32 ino;
+};
+
+// Checks if a directory entry is the one being looked up.
+static bool match_name(const char *const name, const size_t len,
+                       const __u32 ino, const unsigned type,
+                       void *const context)
+{
+    (void)type;
+
+    struct lookup *const lp = context;
+    if (len != lp->len || memcmp(name, lp->name, len) != 0) return false;
+
+    lp->ino = ino;
+    return true;
+}
+
+// Parses a path of the form <N>. Returns 0 if path has another form.
+ATTRIBUTE((nonnull))
+static __u32 parse_inode_path(const char *const path)
+{
+    assert(path);
+
+    const size_t len = strlen(path);
+    if (len < 3u || path[0] != '<' || path[len - 1u] != '>') return 0u;
+
+    __u32 ino = 0u;
+
+    for (size_t i = 1u; i < len - 1u; ++i) {
+        if (path[i] < '0' || path[i] > '9') return 0u;
+
+        const unsigned digit = (unsigned)(path[i] - '0');
+        if (ino > (UINT_MAX - digit) / 10u) return 0u;
+        ino = ino * 10u + digit;
+    }
+
+    return ino;
+}
+
+__u32 find_ext4_path(const struct ext4_fs *restrict const fsp,
+                     const char *restrict const path)
+{
+    assert(fsp);
+    assert(path);
+
+    const __u32 ino = parse_inode_path(path);
+    if (ino != 0u) return ino;
+
+    __u32 current = k_ext4_root_ino;
+
+    for (const char *p = path; *p != '\0'; ) {
+        while (*p == '/') ++p;
+        if (*p == '\0') break;
+
+        struct lookup lookup = { .name = p, .len = strcspn(p, "/") };
+        p += lookup.len;
+
+        if (!read_dir(fsp, current, match_name, &lookup))
+            die("%s: %s: %s", fsp->path, path, strerror(errno));
+        if (lookup.ino == 0u)
+            die("%s: %s: %s", fsp->path, path, strerror(ENOENT));
+
+        current = lookup.ino;
+    }
+
+    return current;
+}
+
+// A directory waiting to be walked.
+struct pending_dir {
+    __u32 ino;
+    char *path;
+};
+
+// State for walking the directory tree, breadth first, so only one
+// directory's blocks need be held at a time.
+struct tree_walk {
+    const struct ext4_fs *fsp;
+    ext4_file_visitor *visit;
+    void *context;
+    const char *path; // of the directory being read, empty for the root
+    struct pending_dir *queue;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    unsigned char *seen; // a bit for each inode, so no directory is walked
+                         // twice even if the filesystem is corrupt
+};
+
+// Makes the path of a directory entry.
+ATTRIBUTE((nonnull, malloc, returns_nonnull))
+static char *join_path(const char *restrict const dir,
+                       const char *restrict const name, const size_t len)
+{
+    assert(dir);
+    assert(name);
+
+    const size_t dir_len = strlen(dir);
+    char *const path = xcalloc(dir_len + len + 2u, 1u);
+
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1u, name, len);
+    return path;
+}
+
+// Adds a directory to the queue, unless it has been seen already.
+ATTRIBUTE((nonnull))
+static void enqueue_dir(struct tree_walk *restrict const twp, const __u32 ino,
+                        char *restrict const path)
+{
+    assert(twp);
+    assert(path);
+
+    if (ino > twp->fsp->inode_count) {
+        msg("skipping %s: bad inode number %u", path, ino);
+        free(path);
+        return;
+    }
+
+    unsigned char *const bytep = &twp->seen[ino / CHAR_BIT];
+    const unsigned char bit = (unsigned char)(1u << (ino % CHAR_BIT));
+    if (*bytep & bit) {
+        free(path);
+        return;
+    }
+    *bytep |= bit;
+
+    if (twp->tail == twp->capacity) {
+        twp->capacity = (twp->capacity ? twp->capacity * 2u : 64u);
+        twp->queue = xreallocarray(twp->queue, twp->capacity,
+                                   sizeof twp->queue[0]);
+    }
+
+    twp->queue[twp->tail++] = (struct pending_dir){ .ino = ino, .path = path };
+}
+
+// Visits a regular file, or queues a directory, found while walking.
+static bool visit_entry(const char *const name, const size_t len,
+                        const __u32 ino, unsigned type, void *const context)
+{
+    struct tree_walk *const twp = context;
+
+    if ((len == 1u && name[0] == '.')
+            || (len == 2u && name[0] == '.' && name[1] == '.'))
+        return false;
+
+    if (type == 0u && ino <= twp->fsp->inode_count) {
+        struct ext4_inode inode = { 0 };
+        read_ext4_inode(twp->fsp, ino, &inode);
+        type = (S_ISREG(inode.mode) ? k_ftype_regular
+                : S_ISDIR(inode.mode) ? k_ftype_directory : 0u);
+    }
+
+    if (type == k_ftype_directory) {
+        enqueue_dir(twp, ino, join_path(twp->path, name, len));
+    } else if (type == k_ftype_regular) {
+        char *const path = join_path(twp->path, name, len);
+        twp->visit(path, ino, twp->context);
+        free(path);
+    }
+
+    return false;
+}
+
+void walk_ext4_tree(const struct ext4_fs *const fsp,
+                    ext4_file_visitor *const visit, void *const context)
+{
+    assert(fsp);
+    assert(visit);
+
+    struct tree_walk walk = {
+        .fsp = fsp,
+        .visit = visit,
+        .context = context,
+        .seen = xcalloc((size_t)fsp->inode_count / CHAR_BIT + 1u, 1u)
+    };
+
+    char *const root = xcalloc(1u, 1u);
+    enqueue_dir(&walk, k_ext4_root_ino, root);
+
+    while (walk.head != walk.tail) {
+        struct pending_dir dir = walk.queue[walk.head++];
+        walk.path = dir.path;
+
+        if (!read_dir(fsp, dir.ino, visit_entry, &walk)) {
+            msg("skipping %s: %s", (dir.path[0] == '\0' ? "/" : dir.path),
+                    strerror(errno));
+        }
+
+        free(dir.path);
+    }
+
+    free(walk.seen);
+    free(walk.queue);
+}
+
+void scan_ext4_inodes(const struct ext4_fs *const fsp,
+                      ext4_inode_visitor *const visit, void *const context)
+{
+    assert(fsp);
+    assert(visit);
+
+    const size_t per_chunk = k_scan_chunk_size / fsp->inode_size;
+    unsigned char *const chunk = xcalloc(per_chunk, fsp->inode_size);
+
+    for (__u32 group = 0u; group < fsp->group_count; ++group) {
+        const struct ext4_group *const gp = &fsp->groups[group];
+        const __u64 table = gp->inode_table * fsp->block_size;
+        const __u32 base = group * fsp->inodes_per_group;
+
+        for (__u32 index = 0u; index < gp->used; ) {
+            __u32 count = gp->used - index;
+            if (count > per_chunk) count = (__u32)per_chunk;
+            if (count > fsp->inode_count - base - index)
+                count = fsp->inode_count - base - index;
+            if (count == 0u) break;
+
+            read_fully(fsp, chunk, (size_t)count * fsp->inode_size,
+                       table + (__u64)index * fsp->inode_size);
+
+            for (__u32 i = 0u; i < count; ++i) {
+                const __u32 ino = base + index + i + 1u;
+                if (ino < fsp->first_ino && ino != k_ext4_root_ino) continue;
+
+                struct ext4_inode inode = { 0 };
+                decode_inode(&inode, chunk + (size_t)i * fsp->inode_size,
+                             ino);
+                if (inode.mode != 0u && inode.links != 0u)
+                    visit(&inode, context);
+            }
+
+            index += count;
+        }
+    }
+
+    free(chunk);
+}
+
+void destroy_extent_list(struct extent_list *const elp)
+{
+    assert(elp);
+
+    free(elp->extents);
+    *elp = (struct extent_list){ 0 };
+}
+
+void close_ext4(struct ext4_fs *const fsp)
+{
+    assert(fsp);
+
+    if (close(fsp->fd) != 0) die("%s: %s", fsp->path, strerror(errno));
+    free(fsp->groups);
+    fsp->groups = NULL;
+    fsp->fd = -1;
+}
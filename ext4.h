@@ -0,0 +1,144 @@
+// ext4.h - reading extents straight from an ext4 filesystem
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// This reads an ext4 filesystem's own structures, from a device or image file,
+// without mounting it: the superblock and group descriptors, the inode tables,
+// each inode's extent tree, and directories. Extents come out as the FIEMAP
+// ioctl would give them, with offsets in bytes from the start of the
+// filesystem, and the last flagged FIEMAP_EXTENT_LAST.
+//
+// The filesystem must not be mounted read-write while it is read, or what is
+// read may be inconsistent. Files that don't use extents (as on ext2 or ext3)
+// or that keep their data inside the inode can't be mapped. Filesystems with
+// the meta_bg feature, which scatters the group descriptors, aren't
+// supported.
+
+#ifndef HAVE_EXTENTS_FIEMAP_EXT4_H_
+#define HAVE_EXTENTS_FIEMAP_EXT4_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+#include <sys/types.h>
+
+enum ext4_constants {
+    k_ext4_root_ino = 2,
+    k_ext4_i_block_size = 60 // the inode's extent tree root (or block map)
+};
+
+// A block group's inode table.
+struct ext4_group {
+    __u64 inode_table; // block number
+    __u32 used;        // how many of its inodes might be in use
+};
+
+// An open filesystem.
+struct ext4_fs {
+    const char *path;
+    int fd;
+    dev_t dev; // the device, if path is a block device, or else 0:0
+    __u32 block_size;
+    __u64 block_count;
+    __u32 inode_count;
+    __u32 inodes_per_group;
+    __u32 inode_size;
+    __u32 first_ino;   // the first inode not reserved by the filesystem
+    __u32 group_count;
+    bool has_filetype; // directory entries say what type each file is
+    struct ext4_group *groups;
+};
+
+// An inode, decoded.
+struct ext4_inode {
+    __u32 ino;
+    __u16 mode;
+    __u16 links;
+    __u32 flags;
+    __u64 size;
+    unsigned char i_block[k_ext4_i_block_size];
+};
+
+// A growable list of extents.
+struct extent_list {
+    struct fiemap_extent *extents;
+    size_t count;
+    size_t capacity;
+};
+
+// Opens the filesystem on the device or image file at path, and reads its
+// superblock and group descriptors. Quits if it isn't a supported ext4
+// filesystem.
+ATTRIBUTE((nonnull))
+void open_ext4(struct ext4_fs *restrict fsp, const char *restrict path);
+
+// Reads inode number ino. Quits on failure.
+ATTRIBUTE((nonnull))
+void read_ext4_inode(const struct ext4_fs *restrict fsp, __u32 ino,
+                     struct ext4_inode *restrict ip);
+
+// Checks if an inode's data can be mapped: that it uses extents and doesn't
+// keep its data inline. If not, returns false and sets errno.
+ATTRIBUTE((nonnull))
+bool can_map_ext4_inode(const struct ext4_inode *ip);
+
+// Walks an inode's extent tree, replacing the list's contents with its
+// extents, in logical order. The inode must be mappable. Quits on failure,
+// including if the tree is corrupt.
+ATTRIBUTE((nonnull))
+void get_ext4_extents(const struct ext4_fs *restrict fsp,
+                      const struct ext4_inode *restrict ip,
+                      struct extent_list *restrict elp);
+
+// Finds the inode number of the file at path, which is relative to the root
+// of the filesystem whether or not it starts with a slash. A path of the form
+// <N>, as debugfs accepts, is inode number N. Symbolic links aren't followed.
+// Quits if there is no such file.
+ATTRIBUTE((nonnull))
+__u32 find_ext4_path(const struct ext4_fs *restrict fsp,
+                     const char *restrict path);
+
+// Called with each regular file's path, inode number, and the context.
+typedef void ext4_file_visitor(const char *path, __u32 ino, void *context);
+
+// Walks the directory tree from the root, calling visit for each regular file
+// found. A file with several hard links is visited once for each. Paths start
+// with a slash. Directories that can't be read are reported and skipped.
+ATTRIBUTE((nonnull(1, 2)))
+void walk_ext4_tree(const struct ext4_fs *fsp, ext4_file_visitor *visit,
+                    void *context);
+
+// Called with each inode in use, and the context.
+typedef void ext4_inode_visitor(const struct ext4_inode *ip, void *context);
+
+// Reads every inode table in order, a large chunk at a time, calling visit for
+// each inode that is in use. Parts of tables the group descriptors say are
+// unused are skipped.
+ATTRIBUTE((nonnull(1, 2)))
+void scan_ext4_inodes(const struct ext4_fs *fsp, ext4_inode_visitor *visit,
+                      void *context);
+
+// Frees the list's memory.
+ATTRIBUTE((nonnull))
+void destroy_extent_list(struct extent_list *elp);
+
+// Closes the filesystem and frees the memory it holds.
+ATTRIBUTE((nonnull))
+void close_ext4(struct ext4_fs *fsp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_EXT4_H_
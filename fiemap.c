@@ -21,13 +21,23 @@
 #include "feature-test.h"
 
 #include "attribute.h"
+#include "coalesce.h"
 #include "conf.h"
 #include "constants.h"
+#include "device.h"
+#include "diff.h"
+#include "record.h"
+#include "report.h"
+#include "scan.h"
+#include "serve.h"
+#include "source.h"
+#include "stats.h"
 #include "table.h"
 #include "util.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +49,7 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 ATTRIBUTE((nonnull, returns_nonnull))
 static FILE *open_file(const char *const path)
@@ -51,175 +62,590 @@ static FILE *open_file(const char *const path)
 }
 
 // Prints major and minor device numbers and where the device seeems to start.
-// Returns where the device seems to start.
-static __u64 get_offset(const dev_t dev)
+ATTRIBUTE((nonnull))
+static void show_intro(FILE *const out, const dev_t dev, const __u64 offset)
 {
-    const unsigned maj = major(dev), min = minor(dev);
+    fprintf(out, "On block device %u:%u, which starts at byte %llu"
+            " (sector %llu):\n\n", major(dev), minor(dev), offset,
+            offset / k_sector_size);
+}
 
-    enum { bufsz = 1024 };
-    char path[bufsz] = {0};
-    if (snprintf(path, bufsz, "/sys/dev/block/%u:%u/start", maj, min) >= bufsz)
-        die(BUG("sysfs path exceeds buffer"));
+// Adds, but gives ULLONG_MAX instead of wrapping around.
+ATTRIBUTE((const))
+static __u64 saturating_add(const __u64 first, const __u64 second)
+{
+    return second > ULLONG_MAX - first ? ULLONG_MAX : first + second;
+}
 
-    FILE *const sysfp = fopen(path, "r");
-    if (!sysfp) die("%s: %s", path, strerror(errno));
+// Figures out how big values in the table could possibly be. Physical offsets
+// must lie within the device. Logical offsets are less than the file's size,
+// except that space may be allocated past the end of the file, on the device.
+static struct table_bounds get_bounds(const __u64 device_size,
+                                      const __u64 size)
+{
+    return (struct table_bounds){
+        .logical = saturating_add(size, device_size),
+        .physical = (device_size ? device_size : 1uLL)
+    };
+}
 
-    __u64 offset_in_sectors = 0uLL;
-    char extra = '\0';
-    if (fscanf(sysfp, "%llu %c", &offset_in_sectors, &extra) != 1)
-        die("can't interpret %s as offset", path);
+// Running totals, kept while extents are shown, for the interpretation guide.
+// Extents that start at or past the end of the file, such as space that was
+// preallocated without changing its size, are counted separately.
+struct extent_totals {
+    __u64 count;
+    __u64 end; // logical offset just past the last extent within the file
+    __u64 last_length;
+    __u64 past_eof_count;
+    __u64 past_eof_bytes;
+};
 
-    const __u64 offset = offset_in_sectors * k_sector_size;
-    printf("On block device %u:%u, " // FIXME: The caller should print instead.
-            "which starts at byte %llu (sector %llu):\n\n",
-            maj, min, offset, offset_in_sectors);
+ATTRIBUTE((nonnull))
+static void add_to_totals(struct extent_totals *restrict const etp,
+                          const struct fiemap *restrict const fmp,
+                          const __u64 size)
+{
+    assert(etp);
+    assert(fmp);
+    assert(fmp->fm_mapped_extents);
+
+    for (__u32 i = 0u; i < fmp->fm_mapped_extents; ++i) {
+        const struct fiemap_extent *const fep = &fmp->fm_extents[i];
+
+        if (fep->fe_logical >= size) {
+            ++etp->past_eof_count;
+            etp->past_eof_bytes =
+                    saturating_add(etp->past_eof_bytes, fep->fe_length);
+        } else {
+            ++etp->count;
+            etp->end = saturating_add(fep->fe_logical, fep->fe_length);
+            etp->last_length = fep->fe_length;
+        }
+    }
+}
+
+// Shows the guide for a file that goes on past its last extent (if any). The
+// rest of it is a hole, which reads as zeros but has no blocks on disk.
+ATTRIBUTE((nonnull))
+static void show_tail_hole(FILE *const out, const __u64 real_size,
+                           const __u64 end)
+{
+    assert(out);
+    assert(end < real_size);
 
-    return offset;
+    fprintf(out, "%llu bytes, ending in a %llu-byte hole.\n",
+            real_size, real_size - end);
 }
 
-ATTRIBUTE((malloc, returns_nonnull))
-static struct fiemap *alloc_fiemap(const __u32 extent_count)
+// Shows how much of the space up to the end of the last extent the file uses,
+// and how much of the last extent it uses. Space before the last extent that
+// isn't in any extent is a hole; the file uses it even though it's not on
+// disk. So the only unused space is at the end of the last extent, which
+// starts within the file.
+ATTRIBUTE((nonnull))
+static void show_end(FILE *restrict const out,
+                     const struct extent_totals *restrict const etp,
+                     const __u64 real_size)
 {
-    return xcalloc(1u, sizeof(struct fiemap)
-                        + sizeof(struct fiemap_extent) * (size_t)extent_count);
+    assert(out);
+    assert(etp);
+    assert(etp->count);
+
+    const __u64 end = etp->end;
+
+    if (end < real_size) {
+        show_tail_hole(out, real_size, end);
+        return;
+    }
+
+    const __u64 unused = end - real_size;
+    const __u64 last_length = etp->last_length;
+    assert(unused < last_length);
+
+    fprintf(out, "%llu/%llu bytes used, %llu/%llu in the last extent.\n",
+            real_size, end, last_length - unused, last_length);
 }
 
-static __u32 count_extents(const int fd)
+ATTRIBUTE((nonnull))
+static void show_interpretation_guide(FILE *restrict const out,
+                                      const struct extent_totals *restrict etp,
+                                      const __u64 size)
 {
-    struct fiemap fm = { .fm_length = ULLONG_MAX, .fm_extent_count = 0 };
+    assert(out);
+    assert(etp);
 
-    if (ioctl(fd, FS_IOC_FIEMAP, &fm) != 0)
-        die("can't count extents: %s", strerror(errno));
+    putc('\n', out);
 
-    return fm.fm_mapped_extents;
+    if (etp->count)
+        show_end(out, etp, size);
+    else if (size)
+        show_tail_hole(out, size, 0u);
+    else if (etp->past_eof_count)
+        fputs("There are no extents within the file.\n", out);
+    else
+        fputs("There are no extents.\n", out);
+
+    if (etp->past_eof_count) {
+        fprintf(out, "Past the end of the file: %llu bytes in %llu extents.\n",
+                etp->past_eof_bytes, etp->past_eof_count);
+    }
 }
 
-ATTRIBUTE((nonnull, returns_nonnull))
-static const struct fiemap_extent *last_extent(const struct fiemap *const fmp)
+// Gets how big the listing says the file is. With a range, the file is
+// treated as ending where the range does, so the guide and the extents, which
+// are cut off there, agree.
+ATTRIBUTE((nonnull, pure))
+static __u64 listed_size(const struct extent_source *restrict const esp,
+                         const struct conf *restrict const cp)
 {
-    assert(fmp);
-    assert(fmp->fm_mapped_extents);
-    return &fmp->fm_extents[fmp->fm_mapped_extents - 1u];
+    if (!cp->ranged) return esp->file_size;
+
+    const __u64 end = saturating_add(cp->range_start, cp->range_length);
+    return (end < esp->file_size ? end : esp->file_size);
 }
 
-// The number of extents may change between when they are counted and when the
-// count is used. This is a TOCTOU (time of check/time of use) race condition.
-// This checks that they still fit, and quits with an error if they don't.
+// Reports how many rows coalescing removed, if it was done. This is skipped
+// when surveying many files, where it would be noise.
 ATTRIBUTE((nonnull))
-static void ensure_extents_retrieved(const struct fiemap *const fmp)
+static void report_coalescing(const struct extent_coalescer *restrict ecp,
+                              const struct conf *restrict const cp)
 {
-    assert(fmp);
-    assert(fmp->fm_mapped_extents <= fmp->fm_extent_count);
+    assert(ecp);
+    assert(cp);
 
-    if (fmp->fm_mapped_extents
-            && !(last_extent(fmp)->fe_flags & FIEMAP_EXTENT_LAST))
-        die("extent count just increased!");
+    if (ecp->enabled && !cp->recursive) {
+        msg("Merging removed %llu of %llu rows.",
+                ecp->removed, ecp->input_count);
+    }
 }
 
-ATTRIBUTE((returns_nonnull))
-static struct fiemap *get_fiemap(const int fd)
+// Shows the table, retrieving and showing one page of extents at a time, so
+// that memory use doesn't grow with the number of extents.
+ATTRIBUTE((nonnull))
+static void show_extent_info(struct extent_source *restrict const esp,
+                             const struct conf *restrict const cp,
+                             FILE *restrict const out)
 {
-    const __u32 extent_count = count_extents(fd);
-    struct fiemap *const fmp = alloc_fiemap(extent_count);
+    show_intro(out, esp->dev, esp->device_start);
+
+    const __u64 size = listed_size(esp, cp);
+    const struct table_bounds bounds =
+            get_bounds(esp->device_size, esp->file_size);
 
-    fmp->fm_start = 0uLL;
-    fmp->fm_length = ULLONG_MAX;
-    fmp->fm_extent_count = extent_count;
-    fmp->fm_flags = 0u;
+    struct tablespec *const tsp = start_extent_table(out, cp->columns,
+                                                     esp->device_start, size,
+                                                     &bounds);
+    struct extent_totals totals = { 0 };
 
-    if (ioctl(fd, FS_IOC_FIEMAP, fmp) != 0)
-        die("can't retrieve extents: %s", strerror(errno));
+    struct extent_coalescer coalescer = { 0 };
+    init_extent_coalescer(&coalescer, &esp->pager, cp->coalesce);
+
+    for (const struct fiemap *fmp = NULL;
+            (fmp = next_coalesced_page(&coalescer)); ) {
+        show_extent_rows(tsp, fmp->fm_extents, fmp->fm_mapped_extents);
+        add_to_totals(&totals, fmp, size);
+    }
 
-    assert(fmp->fm_extent_count == extent_count); // See <linux/fiemap.h>.
-    ensure_extents_retrieved(fmp);
-    return fmp;
+    destroy_extent_coalescer(&coalescer);
+    finish_extent_table(tsp);
+    show_interpretation_guide(out, &totals, size);
+    report_coalescing(&coalescer, cp);
 }
 
+// Writes the header, a record for each extent, and the trailer, retrieving a
+// page of extents at a time as show_extent_info() does.
 ATTRIBUTE((nonnull))
-static __u64 sum_extents(const struct fiemap *const fmp)
+static void write_binary_info(struct extent_source *restrict const esp,
+                              const struct conf *restrict const cp,
+                              FILE *restrict const out)
 {
-    assert(fmp);
+    write_record_header(out, &(struct record_header){
+        .version = k_record_version,
+        .record_size = k_record_size,
+        .sector_size = k_sector_size,
+        .major = major(esp->dev),
+        .minor = minor(esp->dev),
+        .device_start = esp->device_start,
+        .file_size = listed_size(esp, cp)
+    });
+
+    __u64 count = 0u;
+    struct extent_coalescer coalescer = { 0 };
+    init_extent_coalescer(&coalescer, &esp->pager, cp->coalesce);
+
+    for (const struct fiemap *fmp = NULL;
+            (fmp = next_coalesced_page(&coalescer)); ) {
+        write_extent_records(out, fmp->fm_extents, fmp->fm_mapped_extents,
+                             esp->device_start);
+        count += fmp->fm_mapped_extents;
+    }
+
+    destroy_extent_coalescer(&coalescer);
+    write_record_trailer(out, count);
+    report_coalescing(&coalescer, cp);
+}
+
+// Summarizes the file's fragmentation in one pass over its extents, retrieving
+// a page of extents at a time as show_extent_info() does.
+ATTRIBUTE((nonnull))
+static void show_report_info(struct extent_source *restrict const esp,
+                             const struct conf *restrict const cp,
+                             FILE *restrict const out)
+{
+    struct frag_report report = { 0 };
+    struct extent_coalescer coalescer = { 0 };
+    init_extent_coalescer(&coalescer, &esp->pager, cp->coalesce);
 
-    __u64 sum = 0uLL;
-    for (__u32 i = 0u; i < fmp->fm_mapped_extents; ++i)
-        sum += fmp->fm_extents[i].fe_length;
+    for (const struct fiemap *fmp = NULL;
+            (fmp = next_coalesced_page(&coalescer)); )
+        add_to_report(&report, fmp);
 
-    return sum;
+    destroy_extent_coalescer(&coalescer);
+
+    fprintf(out, "File size: %llu\n", esp->file_size);
+    if (cp->ranged) {
+        const __u64 end = listed_size(esp, cp);
+        fprintf(out, "Range: bytes %llu to %llu\n",
+                (cp->range_start < end ? cp->range_start : end), end);
+    }
+    show_report(&report, out);
+    report_coalescing(&coalescer, cp);
 }
 
+// Shows the file's extents, or writes them, or reports on them, as configured.
+// Time spent other than retrieving extents and writing counts as formatting.
 ATTRIBUTE((nonnull))
-static void show_end(const struct fiemap *const fmp, const __u64 real_size)
+static void show_info(struct extent_source *restrict const esp,
+                      const struct conf *restrict const cp,
+                      FILE *restrict const out)
 {
-    assert(fmp);
-    assert(fmp->fm_mapped_extents);
+    const __u64 start = start_timing();
+    const __u64 other_time = get_thread_phase_time(k_phase_retrieve)
+                                + get_thread_phase_time(k_phase_io);
+
+    switch (cp->output) {
+    case k_output_table:
+        show_extent_info(esp, cp, out);
+        break;
+    case k_output_binary:
+        write_binary_info(esp, cp, out);
+        break;
+    case k_output_report:
+        show_report_info(esp, cp, out);
+        break;
+    default:
+        die(BUG("unrecognized output mode"));
+    }
+
+    if (!stats_enabled()) return;
 
-    const __u64 sum = sum_extents(fmp);
+    const __u64 elapsed = read_clock() - start;
+    const __u64 other_elapsed = get_thread_phase_time(k_phase_retrieve)
+                                    + get_thread_phase_time(k_phase_io)
+                                    - other_time;
+    if (elapsed > other_elapsed)
+        add_phase_time(k_phase_format, elapsed - other_elapsed);
+}
 
-    if (sum < real_size) {
-        die("file is %llu bytes; extents only use %llu bytes",
-                real_size, sum);
+// Shows one file found while surveying a tree, headed by its path. Files that
+// can't be opened, or that FIEMAP doesn't work on, are reported and skipped.
+static void survey_file(const char *const path, FILE *const out,
+                        void *const context)
+{
+    const struct conf *const cp = context;
+
+    const int fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        msg("skipping %s: %s", path, strerror(errno));
+        return;
+    }
+
+    if (!can_map_extents(fd)) {
+        msg("skipping %s: %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    // Finding where the volume starts would fail, and quit, on filesystems
+    // such as btrfs, whose device numbers aren't real devices.
+    struct stat st = { 0 };
+    if (fstat(fd, &st) != 0) {
+        msg("skipping %s: %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    if (!is_known_device(st.st_dev)) {
+        msg("skipping %s: device %u:%u is not a block device sysfs knows of",
+                path, major(st.st_dev), minor(st.st_dev));
+        close(fd);
+        return;
     }
 
-    printf("%llu/%llu bytes used", real_size, sum);
+    struct extent_source source = { 0 };
+    open_file_source(&source, fd);
+    if (cp->ranged)
+        set_extent_range(&source.pager, cp->range_start, cp->range_length);
 
-    const __u64 unused = sum - real_size;
-    const __u64 last_length = last_extent(fmp)->fe_length;
+    fprintf(out, "==> %s <==\n", path);
+    show_info(&source, cp, out);
+    putc('\n', out);
 
-    if (last_length < unused) {
-        puts("."); // Finish the last message before quitting with an error.
+    close_extent_source(&source);
+    if (close(fd) != 0) die("%s: %s", path, strerror(errno));
+}
+
+// Surveys every regular file under the paths given and any listed.
+ATTRIBUTE((nonnull))
+static void survey(char *const *restrict const paths, const size_t count,
+                   const struct conf *restrict const cp)
+{
+    FILE *list_fp = NULL;
 
-        die("unused space (%llu bytes) exceeds last extent (%llu bytes)",
-                unused, last_length);
+    if (cp->list_path) {
+        list_fp = (strcmp(cp->list_path, "-") == 0 ? stdin
+                                                   : open_file(cp->list_path));
+    } else if (count == 0u) {
+        die("too few arguments");
     }
 
-    printf(", %llu/%llu in the last extent.\n",
-            last_length - unused, last_length);
+    scan_files(paths, count, list_fp, cp->jobs, survey_file, (void *)cp);
+
+    if (list_fp && list_fp != stdin) fclose(list_fp);
+}
+
+// Writes a buffer for a stream made by open_counted_output().
+static ssize_t write_counted(void *const cookie, const char *const buf,
+                             const size_t size)
+{
+    write_fully(*(const int *)cookie, buf, size);
+    return (ssize_t)size;
+}
+
+// Opens a stream that writes to standard output through write_fully(), so
+// the writes are timed and counted. Quits on failure.
+ATTRIBUTE((returns_nonnull))
+static FILE *open_counted_output(void)
+{
+    static int fd = STDOUT_FILENO;
+
+    FILE *const out = fopencookie(&fd, "w", (cookie_io_functions_t){
+        .write = write_counted
+    });
+    if (!out) die("can't open output: %s", strerror(errno));
+    return out;
+}
+
+// Opens the stream to write a listing or other output to. Quits if the output
+// is binary and standard output is a terminal.
+ATTRIBUTE((nonnull, returns_nonnull))
+static FILE *open_output(const struct conf *const cp)
+{
+    assert(cp);
+
+    if (cp->output == k_output_binary && isatty(STDOUT_FILENO))
+        die("not writing binary data to a terminal");
+
+    return stats_enabled() ? open_counted_output() : stdout;
 }
 
+// Flushes and closes the stream open_output() returned. Quits on failure.
 ATTRIBUTE((nonnull))
-static void show_interpretation_guide(const struct fiemap *const fmp,
-                                      const off_t size)
+static void close_output(FILE *const out)
 {
-    assert(fmp);
+    if (out != stdout && fclose(out) != 0)
+        die("can't write output: %s", strerror(errno));
+}
 
-    putchar('\n');
+// Names of kinds of changes, as shown when diffing snapshots.
+static const char *const k_change_names[] = {
+    [k_change_moved] = "moved",
+    [k_change_appeared] = "appeared",
+    [k_change_disappeared] = "disappeared"
+};
+
+// State for writing the changes between two snapshots. Each change is held
+// back until the next, so adjacent changes can be joined into one range, and
+// so the last record of a binary listing can be marked last.
+struct diff_writer {
+    FILE *out;
+    bool binary;
+    __u64 device_start;
+    struct extent_change pending;
+    bool have_pending;
+    __u64 record_count;
+    __u64 bytes[sizeof k_change_names / sizeof k_change_names[0]];
+};
+
+// Writes the held-back change as a line or, if binary, as a record.
+ATTRIBUTE((nonnull))
+static void flush_change(struct diff_writer *const dwp, const bool last)
+{
+    assert(dwp);
 
-    if (size < 0)
-        die("file has negative size %lld", (long long)size);
-    else if (fmp->fm_mapped_extents)
-        show_end(fmp, (__u64)size);
-    else if (size)
-        die("size is %llu bytes but there are no extents", (long long)size);
-    else
-        puts("There are no extents.");
+    if (!dwp->have_pending) return;
+    dwp->have_pending = false;
+
+    const struct extent_change *const chp = &dwp->pending;
+
+    if (!dwp->binary) {
+        fprintf(dwp->out, "%s %llu %llu\n", k_change_names[chp->kind],
+                chp->logical, chp->length);
+        return;
+    }
+
+    assert(chp->now);
+
+    const struct fiemap_extent extent = {
+        .fe_logical = chp->logical,
+        .fe_physical = chp->now->physical + (chp->logical - chp->now->logical)
+                        - dwp->device_start,
+        .fe_length = chp->length,
+        .fe_flags = (chp->now->flags & ~(__u32)FIEMAP_EXTENT_LAST)
+                        | (last ? FIEMAP_EXTENT_LAST : 0u)
+    };
+
+    write_extent_records(dwp->out, &extent, 1u, dwp->device_start);
+    ++dwp->record_count;
+}
+
+// Tallies a change and holds it back, first writing the change before it, if
+// it can't be joined with it.
+static void add_change(const struct extent_change *const chp,
+                       void *const context)
+{
+    struct diff_writer *const dwp = context;
+    dwp->bytes[chp->kind] += chp->length;
+
+    if (dwp->binary) {
+        // Only data to read go in a listing.
+        if (chp->kind == k_change_disappeared) return;
+    } else if (dwp->have_pending && dwp->pending.kind == chp->kind
+                && dwp->pending.logical + dwp->pending.length
+                    == chp->logical) {
+        dwp->pending.length += chp->length;
+        return;
+    }
+
+    flush_change(dwp, false);
+    dwp->pending = *chp;
+    dwp->have_pending = true;
 }
 
+// Compares an older and a newer snapshot of a file, writing each range whose
+// data moved, appeared, or disappeared or, if the output is binary, a listing
+// of the newer snapshot's extents in ranges whose data moved or appeared.
 ATTRIBUTE((nonnull))
-static void show_extent_info(const int fd, const char *const columns)
+static void show_diff(const char *restrict const old_path,
+                      const char *restrict const new_path,
+                      const struct conf *restrict const cp,
+                      FILE *restrict const out)
 {
-    struct stat st = { 0 };
-    if (fstat(fd, &st) != 0) die("can't stat: %s", strerror(errno));
+    if (strcmp(old_path, "-") == 0 && strcmp(new_path, "-") == 0)
+        die("only one snapshot can be read from standard input");
 
-    const __u64 offset = get_offset(st.st_dev);
-    struct fiemap *const fmp = get_fiemap(fd);
+    struct snapshot older = { 0 }, newer = { 0 };
+    load_snapshot(&older, old_path);
+    load_snapshot(&newer, new_path);
 
-    show_extent_table(fmp, offset, columns);
-    show_interpretation_guide(fmp, st.st_size);
+    if (!is_same_volume(&older, &newer)) {
+        msg("The snapshots are of different volumes, so all data count as"
+                " moved.");
+    }
 
-    free(fmp);
+    struct diff_writer writer = {
+        .out = out,
+        .binary = (cp->output == k_output_binary),
+        .device_start = newer.header.device_start
+    };
+
+    if (writer.binary) {
+        write_record_header(out, &(struct record_header){
+            .version = k_record_version,
+            .record_size = k_record_size,
+            .sector_size = k_sector_size,
+            .major = newer.header.major,
+            .minor = newer.header.minor,
+            .device_start = newer.header.device_start,
+            .file_size = newer.header.file_size
+        });
+    }
+
+    diff_snapshots(&older, &newer, add_change, &writer);
+    flush_change(&writer, true);
+
+    if (writer.binary) write_record_trailer(out, writer.record_count);
+
+    msg("%llu bytes moved, %llu appeared, %llu disappeared.",
+            writer.bytes[k_change_moved], writer.bytes[k_change_appeared],
+            writer.bytes[k_change_disappeared]);
+
+    destroy_snapshot(&newer);
+    destroy_snapshot(&older);
 }
 
 int main(int argc, char **argv)
 {
+    const __u64 start = read_clock();
+
     struct conf conf = { 0 };
     const int arg_delta = get_table_configuration(argc, argv, &conf);
     argc -= arg_delta;
     argv += arg_delta;
 
-    if (argc < 2) die("too few arguments");
-    if (argc > 2) die("too many arguments");
+    if (conf.stats_path) {
+        enable_stats("fiemap", conf.stats_path, start);
+        stop_timing(k_phase_options, start);
+    }
+
+    if (conf.serve_path) {
+        if (argc > 1) die("too many arguments");
+        serve(conf.serve_path);
+        return EXIT_SUCCESS;
+    }
+
+    if (conf.recursive) {
+        survey(argv + 1, (size_t)argc - 1u, &conf);
+        return EXIT_SUCCESS;
+    }
+
+    if (conf.diff_path) {
+        if (argc < 2) die("too few arguments");
+        if (argc > 2) die("too many arguments");
+
+        FILE *const out = open_output(&conf);
+        show_diff(conf.diff_path, argv[1], &conf, out);
+        close_output(out);
+        return EXIT_SUCCESS;
+    }
+
+    FILE *fp = NULL;
+    struct extent_source source = { 0 };
+
+    if (conf.synthetic) {
+        if (argc > 1) die("too many arguments");
+        open_synthetic_source(&source, &conf.synthetic_spec);
+    } else if (conf.ext4_image) {
+        if (argc < 2) die("too few arguments");
+        if (argc > 2) die("too many arguments");
+
+        open_ext4_source(&source, conf.ext4_image, argv[1]);
+    } else {
+        if (argc < 2) die("too few arguments");
+        if (argc > 2) die("too many arguments");
+
+        fp = (strcmp(argv[1], "-") == 0 ? stdin : open_file(argv[1]));
+        open_file_source(&source, fileno(fp));
+    }
+
+    if (conf.ranged) {
+        set_extent_range(&source.pager, conf.range_start,
+                         conf.range_length);
+    }
+
+    FILE *const out = open_output(&conf);
+    show_info(&source, &conf, out);
+    close_output(out);
 
-    FILE *const fp = (strcmp(argv[1], "-") == 0 ? stdin : open_file(argv[1]));
-    show_extent_info(fileno(fp), conf.columns);
-    if (fp != stdin) fclose(fp);
+    close_extent_source(&source);
+    if (fp && fp != stdin) fclose(fp);
 }
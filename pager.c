@@ -0,0 +1,353 @@
+// pager.c - retrieving a file's extents a page at a time (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "pager.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+ATTRIBUTE((malloc, returns_nonnull))
+static struct fiemap *alloc_fiemap(const __u32 extent_count)
+{
+    return xcalloc(1u, sizeof(struct fiemap)
+                        + sizeof(struct fiemap_extent) * (size_t)extent_count);
+}
+
+// Gets the logical offset just past an extent, quitting if it is not
+// representable (which would mean FIEMAP gave us nonsense).
+ATTRIBUTE((nonnull))
+static __u64 logical_end(const struct fiemap_extent *const fep)
+{
+    assert(fep);
+
+    if (fep->fe_length > ULLONG_MAX - fep->fe_logical)
+        die("extent at logical byte %llu has impossible length %llu",
+                fep->fe_logical, fep->fe_length);
+
+    return fep->fe_logical + fep->fe_length;
+}
+
+bool can_map_extents(const int fd)
+{
+    struct fiemap probe = {
+        .fm_start = 0uLL,
+        .fm_length = ULLONG_MAX,
+        .fm_extent_count = 0u
+    };
+
+    const __u64 start = start_timing();
+    const bool ok = ioctl(fd, FS_IOC_FIEMAP, &probe) == 0;
+    stop_timing(k_phase_count, start);
+    count_stat(k_stat_ioctls, 1u);
+
+    return ok;
+}
+
+void init_extent_pager(struct extent_pager *const pgp, const int fd)
+{
+    assert(pgp);
+    assert(fd >= 0);
+
+    pgp->fd = fd;
+    pgp->synthp = NULL;
+    pgp->listed = NULL;
+    pgp->next_start = 0uLL;
+    pgp->range_start = 0uLL;
+    pgp->range_end = ULLONG_MAX;
+    pgp->done = false;
+    pgp->holding = false;
+    pgp->fmp = alloc_fiemap(k_extents_per_page);
+}
+
+void init_synthetic_pager(struct extent_pager *restrict const pgp,
+                          struct synthesizer *restrict const syp)
+{
+    assert(pgp);
+    assert(syp);
+
+    pgp->fd = -1;
+    pgp->synthp = syp;
+    pgp->listed = NULL;
+    pgp->next_start = 0uLL;
+    pgp->range_start = 0uLL;
+    pgp->range_end = ULLONG_MAX;
+    pgp->done = false;
+    pgp->holding = false;
+    pgp->fmp = alloc_fiemap(k_extents_per_page);
+}
+
+void init_listed_pager(struct extent_pager *restrict const pgp,
+                       const struct fiemap_extent *restrict const extents,
+                       const size_t count)
+{
+    assert(pgp);
+    assert(extents || count == 0u);
+
+    pgp->fd = -1;
+    pgp->synthp = NULL;
+    pgp->listed = extents;
+    pgp->listed_count = count;
+    pgp->listed_next = 0u;
+    pgp->next_start = 0uLL;
+    pgp->range_start = 0uLL;
+    pgp->range_end = ULLONG_MAX;
+    pgp->done = (count == 0u);
+    pgp->holding = false;
+    pgp->fmp = alloc_fiemap(k_extents_per_page);
+}
+
+void set_extent_range(struct extent_pager *const pgp, const __u64 start,
+                      const __u64 length)
+{
+    assert(pgp);
+    assert(pgp->next_start == 0u);
+
+    pgp->range_start = start;
+    pgp->range_end = (length > ULLONG_MAX - start ? ULLONG_MAX
+                                                   : start + length);
+    pgp->next_start = start;
+    if (length == 0u) pgp->done = true;
+}
+
+// Gets how many extents a page may be retrieved with, leaving room for the
+// held extent to go in front of them.
+ATTRIBUTE((nonnull, pure))
+static __u32 page_capacity(const struct extent_pager *const pgp)
+{
+    assert(pgp);
+    return k_extents_per_page - (pgp->holding ? 1u : 0u);
+}
+
+// Copies the next page of listed extents into the buffer.
+ATTRIBUTE((nonnull))
+static void copy_listed_page(struct extent_pager *const pgp)
+{
+    assert(pgp);
+    assert(pgp->listed);
+
+    size_t count = pgp->listed_count - pgp->listed_next;
+    if (count > page_capacity(pgp)) count = page_capacity(pgp);
+
+    memcpy(pgp->fmp->fm_extents, pgp->listed + pgp->listed_next,
+           sizeof pgp->listed[0] * count);
+
+    pgp->fmp->fm_mapped_extents = (__u32)count;
+    pgp->listed_next += count;
+}
+
+// Calls FIEMAP to fill the buffer with extents from next_start onward. Or, if
+// the extents are synthetic or listed, gets the next page of them.
+ATTRIBUTE((nonnull))
+static void request_page(struct extent_pager *const pgp)
+{
+    assert(pgp);
+    assert(pgp->fmp);
+
+    struct fiemap *const fmp = pgp->fmp;
+    fmp->fm_start = pgp->next_start;
+    fmp->fm_length = pgp->range_end - pgp->next_start;
+    fmp->fm_flags = 0u;
+    fmp->fm_mapped_extents = 0u;
+    fmp->fm_extent_count = page_capacity(pgp);
+
+    if (pgp->synthp) {
+        fmp->fm_mapped_extents = synthesize_extents(pgp->synthp,
+                                                    fmp->fm_extents,
+                                                    fmp->fm_extent_count);
+        return;
+    }
+
+    if (pgp->listed) {
+        copy_listed_page(pgp);
+        return;
+    }
+
+    count_stat(k_stat_ioctls, 1u);
+    if (ioctl(pgp->fd, FS_IOC_FIEMAP, fmp) != 0)
+        die("can't retrieve extents: %s", strerror(errno));
+
+    assert(fmp->fm_extent_count == page_capacity(pgp));
+    assert(fmp->fm_mapped_extents <= fmp->fm_extent_count);
+}
+
+// FIEMAP reports every extent that overlaps the requested range, so if the
+// file's layout changes between calls, an extent already seen in an earlier
+// page may be reported again. This removes any extents that end at or before
+// start, where the current page was requested to begin.
+ATTRIBUTE((nonnull))
+static void drop_repeated_extents(struct fiemap *const fmp, const __u64 start)
+{
+    assert(fmp);
+
+    __u32 skip = 0u;
+    while (skip < fmp->fm_mapped_extents
+            && logical_end(&fmp->fm_extents[skip]) <= start)
+        ++skip;
+
+    if (skip == 0u) return;
+
+    fmp->fm_mapped_extents -= skip;
+    memmove(fmp->fm_extents, fmp->fm_extents + skip,
+            sizeof fmp->fm_extents[0] * (size_t)fmp->fm_mapped_extents);
+}
+
+// Decides where the next page starts, or that there is no next page.
+ATTRIBUTE((nonnull))
+static void advance(struct extent_pager *const pgp)
+{
+    assert(pgp);
+
+    const struct fiemap *const fmp = pgp->fmp;
+
+    if (fmp->fm_mapped_extents == 0u) {
+        pgp->done = true;
+        return;
+    }
+
+    const struct fiemap_extent *const lastp =
+            &fmp->fm_extents[fmp->fm_mapped_extents - 1u];
+
+    if (lastp->fe_flags & FIEMAP_EXTENT_LAST) {
+        pgp->done = true;
+        return;
+    }
+
+    // Synthetic and listed extents always come from the beginning, so their
+    // pages may end before a range starts.
+    const __u64 end = logical_end(lastp);
+    if (end <= pgp->next_start) {
+        if (pgp->fd >= 0)
+            die("retrieving extents made no progress at byte %llu", end);
+        return;
+    }
+
+    pgp->next_start = end;
+    if (end >= pgp->range_end) pgp->done = true;
+}
+
+// Cuts an extent down to the part of it in the range [start, end).
+ATTRIBUTE((nonnull))
+static void clip_extent(struct fiemap_extent *const fep, const __u64 start,
+                        const __u64 end)
+{
+    assert(fep);
+
+    if (fep->fe_flags & FIEMAP_EXTENT_ENCODED) return;
+
+    if (fep->fe_logical < start) {
+        const __u64 cut = start - fep->fe_logical;
+        fep->fe_logical += cut;
+        fep->fe_physical += cut;
+        fep->fe_length -= cut;
+    }
+
+    if (logical_end(fep) > end) fep->fe_length = end - fep->fe_logical;
+}
+
+// Drops the extents of a page that begin at or after the end of the range,
+// and cuts the rest to fit in it. Extents that end before its start were
+// already dropped, as repeated.
+ATTRIBUTE((nonnull))
+static void clip_to_range(struct extent_pager *const pgp)
+{
+    assert(pgp);
+
+    struct fiemap *const fmp = pgp->fmp;
+    if (pgp->range_start == 0u && pgp->range_end == ULLONG_MAX) return;
+
+    __u32 count = 0u;
+    while (count < fmp->fm_mapped_extents
+            && fmp->fm_extents[count].fe_logical < pgp->range_end)
+        clip_extent(&fmp->fm_extents[count++], pgp->range_start,
+                    pgp->range_end);
+
+    if (count != fmp->fm_mapped_extents) pgp->done = true;
+    fmp->fm_mapped_extents = count;
+}
+
+// Whether an extent is the last in a range isn't known until the page after
+// it is retrieved, since the range may end in a hole. So, in a range, the last
+// extent of each page is held back and put in front of the next page, and
+// only once the range is exhausted is the last one flagged FIEMAP_EXTENT_LAST.
+ATTRIBUTE((nonnull))
+static void hold_back_last(struct extent_pager *const pgp)
+{
+    assert(pgp);
+
+    struct fiemap *const fmp = pgp->fmp;
+    if (pgp->range_start == 0u && pgp->range_end == ULLONG_MAX) return;
+
+    if (pgp->holding) {
+        assert(fmp->fm_mapped_extents < k_extents_per_page);
+
+        memmove(fmp->fm_extents + 1, fmp->fm_extents,
+                sizeof fmp->fm_extents[0] * (size_t)fmp->fm_mapped_extents);
+        fmp->fm_extents[0] = pgp->held;
+        ++fmp->fm_mapped_extents;
+        pgp->holding = false;
+    }
+
+    if (fmp->fm_mapped_extents == 0u) return;
+    struct fiemap_extent *const lastp =
+            &fmp->fm_extents[fmp->fm_mapped_extents - 1u];
+
+    if (pgp->done) {
+        lastp->fe_flags |= FIEMAP_EXTENT_LAST;
+    } else {
+        pgp->held = *lastp;
+        pgp->holding = true;
+        --fmp->fm_mapped_extents;
+    }
+}
+
+const struct fiemap *next_extent_page(struct extent_pager *const pgp)
+{
+    assert(pgp);
+
+    const __u64 timing_start = start_timing();
+    const struct fiemap *page = NULL;
+
+    while (!page && !pgp->done) {
+        const __u64 start = pgp->next_start;
+
+        request_page(pgp);
+        advance(pgp);
+        drop_repeated_extents(pgp->fmp, start);
+        clip_to_range(pgp);
+        hold_back_last(pgp);
+
+        if (pgp->fmp->fm_mapped_extents) page = pgp->fmp;
+    }
+
+    stop_timing(k_phase_retrieve, timing_start);
+    if (page) count_stat(k_stat_extents, page->fm_mapped_extents);
+    return page;
+}
+
+void destroy_extent_pager(struct extent_pager *const pgp)
+{
+    assert(pgp);
+
+    free(pgp->fmp);
+    pgp->fmp = NULL;
+    pgp->done = true;
+}
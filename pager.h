@@ -0,0 +1,93 @@
+// pager.h - retrieving a file's extents a page at a time
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_PAGER_H_
+#define HAVE_EXTENTS_FIEMAP_PAGER_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "synthetic.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+// The most extents retrieved by one FIEMAP call. This bounds the memory used,
+// no matter how many extents a file has.
+enum pager_constants { k_extents_per_page = 512 };
+
+// State for walking a file's extents. Each page is retrieved into the same
+// fixed-size buffer, starting just past the last extent of the previous page.
+// The extents come from FIEMAP, or, if synthp isn't null, from a synthesizer,
+// or, if listed isn't null, from an array of extents already retrieved.
+struct extent_pager {
+    int fd;
+    struct synthesizer *synthp;
+    const struct fiemap_extent *listed;
+    size_t listed_count;
+    size_t listed_next; // index of the first listed extent not yet paged
+    __u64 next_start; // logical offset at which the next page should begin
+    __u64 range_start; // the part of the file being mapped, from here...
+    __u64 range_end;   // ...up to here, or ULLONG_MAX for the whole rest
+    bool done;
+    bool holding; // whether held is set
+    struct fiemap_extent held; // in a range, the last extent retrieved so far
+    struct fiemap *fmp;
+};
+
+// Checks if FIEMAP works on the open file fd, by asking only how many extents
+// it has. Returns false, with errno set, if it doesn't, so that a caller
+// walking many files can skip the file instead of quitting.
+bool can_map_extents(int fd);
+
+// Prepares to retrieve the extents of the open file fd, from its beginning.
+ATTRIBUTE((nonnull))
+void init_extent_pager(struct extent_pager *pgp, int fd);
+
+// Prepares to retrieve the extents a synthesizer makes up, instead of a real
+// file's. The synthesizer must outlive the pager.
+ATTRIBUTE((nonnull))
+void init_synthetic_pager(struct extent_pager *restrict pgp,
+                          struct synthesizer *restrict syp);
+
+// Prepares to page through count extents already in an array, which must be
+// in logical order and must outlive the pager. If count is 0, extents may be
+// null.
+ATTRIBUTE((nonnull(1)))
+void init_listed_pager(struct extent_pager *restrict pgp,
+                       const struct fiemap_extent *restrict extents,
+                       size_t count);
+
+// Limits a freshly initialized pager to the length bytes of the file starting
+// at logical offset start. Only extents overlapping that range are retrieved,
+// and those crossing its ends are cut off there, except encoded extents, whose
+// physical offsets can't be cut. The last extent in the range gets
+// FIEMAP_EXTENT_LAST. For FIEMAP, the range is passed to the kernel, so the
+// work done depends on the range, not on the file.
+ATTRIBUTE((nonnull))
+void set_extent_range(struct extent_pager *pgp, __u64 start, __u64 length);
+
+// Retrieves the next page of extents. Returns a pointer to the pager's buffer,
+// which is valid until the next call, or a null pointer if no extents remain.
+// Pages returned are never empty.
+ATTRIBUTE((nonnull))
+const struct fiemap *next_extent_page(struct extent_pager *pgp);
+
+// Frees the pager's buffer.
+ATTRIBUTE((nonnull))
+void destroy_extent_pager(struct extent_pager *pgp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_PAGER_H_
@@ -0,0 +1,739 @@
+// parse.c - parsing and checking fiemap's output (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "parse.h"
+
+#include "constants.h"
+#include "record.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/fiemap.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdnoreturn.h>
+#include <sys/types.h>
+
+// The column labels fiemap shows by default, which are the ones we accept.
+static const char *const k_labels[] = {
+    "LOGICAL", "INITIAL", "FINAL", "COUNT"
+};
+
+// The outro ("interpretation guide") fiemap shows for a file with no extents.
+static const char *const k_trivial_outro = "There are no extents.";
+
+// The outro for an empty file whose only extents are past its end.
+static const char *const k_past_eof_trivial_outro =
+        "There are no extents within the file.";
+
+// What fiemap shows after the last cell of a row for an unwritten extent.
+static const char *const k_unwritten_note = "unwritten";
+
+// What fiemap shows after that (if present) for an extent not yet allocated.
+static const char *const k_unallocated_note = "unallocated";
+
+// What fiemap shows after those (if present) for an extent past the end.
+static const char *const k_past_eof_note = "past EOF";
+
+// Flags of extents not yet allocated, whose physical offsets mean nothing.
+static const __u32 k_unallocated_flags = FIEMAP_EXTENT_UNKNOWN
+                                         | FIEMAP_EXTENT_DELALLOC;
+
+void init_parser(struct parser *restrict const pp, FILE *restrict const fp)
+{
+    assert(pp);
+    assert(fp);
+
+    *pp = (struct parser){ .fp = fp };
+}
+
+// Reads the next line into the buffer, without its newline. Returns false if
+// there are no more lines.
+ATTRIBUTE((nonnull))
+static bool read_line(struct parser *const pp)
+{
+    assert(pp);
+    assert(pp->fp);
+
+    errno = 0;
+    const ssize_t len = getline(&pp->line, &pp->capacity, pp->fp);
+
+    if (len < 0) {
+        if (ferror(pp->fp)) die("can't read input: %s", strerror(errno));
+        return false;
+    }
+
+    ++pp->line_number;
+
+    size_t ulen = (size_t)len;
+    if (ulen != 0u && pp->line[ulen - 1u] == '\n') pp->line[--ulen] = '\0';
+
+    if (strlen(pp->line) != ulen)
+        die("line %llu contains a null character", pp->line_number);
+
+    return true;
+}
+
+// Checks if the line most recently read is blank.
+ATTRIBUTE((nonnull))
+static bool line_is_empty(const struct parser *const pp)
+{
+    assert(pp);
+    assert(pp->line);
+    return pp->line[0] == '\0';
+}
+
+// Skips past literal if the text at *cpp begins with it.
+ATTRIBUTE((nonnull))
+static bool scan_literal(const char **restrict const cpp,
+                         const char *restrict const literal)
+{
+    assert(cpp && *cpp);
+    assert(literal);
+
+    const size_t len = strlen(literal);
+    if (strncmp(*cpp, literal, len) != 0) return false;
+
+    *cpp += len;
+    return true;
+}
+
+// Skips past a gap of two or more spaces, as fiemap puts between columns.
+ATTRIBUTE((nonnull))
+static bool scan_gap(const char **const cpp)
+{
+    assert(cpp && *cpp);
+
+    const char *p = *cpp;
+    while (*p == ' ') ++p;
+    if (p - *cpp < 2) return false;
+
+    *cpp = p;
+    return true;
+}
+
+// Skips past a gap and then note, if the text at *cpp has them.
+ATTRIBUTE((nonnull))
+static bool scan_note(const char **restrict const cpp,
+                      const char *restrict const note)
+{
+    assert(cpp && *cpp);
+    assert(note);
+
+    const char *p = *cpp;
+    if (!(scan_gap(&p) && scan_literal(&p, note))) return false;
+
+    *cpp = p;
+    return true;
+}
+
+// Parses a nonnegative decimal integer at *cpp and skips past it.
+ATTRIBUTE((nonnull))
+static bool scan_number(const struct parser *restrict const pp,
+                        const char **restrict const cpp, __u64 *const np)
+{
+    assert(pp);
+    assert(cpp && *cpp);
+    assert(np);
+
+    const char *p = *cpp;
+    if (*p < '0' || *p > '9') return false;
+
+    __u64 number = 0uLL;
+
+    for (; '0' <= *p && *p <= '9'; ++p) {
+        const unsigned digit = (unsigned)(*p - '0');
+        if (number > (ULLONG_MAX - digit) / 10u)
+            die("line %llu: number too big", pp->line_number);
+        number = number * 10u + digit;
+    }
+
+    *cpp = p;
+    *np = number;
+    return true;
+}
+
+// Checks that the scan has reached the end of the line.
+ATTRIBUTE((nonnull))
+static bool at_end(const char *const p)
+{
+    assert(p);
+    return *p == '\0';
+}
+
+// Converts a count of sectors to bytes. Returns false if it would overflow.
+ATTRIBUTE((nonnull))
+static bool sectors_to_bytes(const __u64 sectors, __u64 *const bytesp)
+{
+    assert(bytesp);
+
+    if (sectors > ULLONG_MAX / k_sector_size) return false;
+
+    *bytesp = sectors * k_sector_size;
+    return true;
+}
+
+// Prints an error message about the row being parsed and quits.
+ATTRIBUTE((nonnull))
+static noreturn void die_at_row(const struct parser *restrict const pp,
+                                const char *restrict const message)
+{
+    assert(pp);
+    assert(message);
+
+    if (pp->binary)
+        die("row %llu: %s", pp->row_count + 1u, message);
+
+    die("row %llu (line %llu): %s",
+            pp->row_count + 1u, pp->line_number, message);
+}
+
+// Parses the intro line, which gives device information.
+ATTRIBUTE((nonnull))
+static void parse_intro_line(struct parser *restrict const pp,
+                             struct device_info *restrict const dip)
+{
+    assert(pp);
+    assert(dip);
+
+    if (!read_line(pp)) die("no input");
+
+    const char *p = pp->line;
+    __u64 major = 0uLL, minor = 0uLL;
+
+    if (!(scan_literal(&p, "On block device ")
+            && scan_number(pp, &p, &major)
+            && scan_literal(&p, ":")
+            && scan_number(pp, &p, &minor)
+            && scan_literal(&p, ", which starts at byte ")
+            && scan_number(pp, &p, &dip->start_byte)
+            && scan_literal(&p, " (sector ")
+            && scan_number(pp, &p, &dip->start_sector)
+            && scan_literal(&p, "):")
+            && at_end(p)))
+        die("malformed intro line");
+
+    if (major > UINT_MAX || minor > UINT_MAX)
+        die("device number %llu:%llu is too big", major, minor);
+
+    dip->major = (unsigned)major;
+    dip->minor = (unsigned)minor;
+
+    __u64 start_byte = 0uLL;
+    if (!sectors_to_bytes(dip->start_sector, &start_byte)
+            || start_byte != dip->start_byte)
+        die("device start in bytes and sectors seem to disagree");
+}
+
+// Parses the column labels, which appear even if there are no rows.
+ATTRIBUTE((nonnull))
+static void parse_labels(struct parser *const pp)
+{
+    assert(pp);
+
+    if (!read_line(pp)) die("no table (not even the row of column labels)");
+
+    const char *p = pp->line;
+
+    for (size_t i = 0u; i < sizeof k_labels / sizeof k_labels[0]; ++i) {
+        if (!(scan_gap(&p) && scan_literal(&p, k_labels[i])
+                           && scan_literal(&p, " (sec)")))
+            die("malformed column labels line");
+    }
+
+    if (!at_end(p)) die("malformed column labels line");
+}
+
+// Reads len bytes of a binary listing, quitting if they aren't all there.
+ATTRIBUTE((nonnull))
+static void read_bytes(const struct parser *restrict const pp,
+                       unsigned char *restrict const bytes, const size_t len,
+                       const char *restrict const what)
+{
+    assert(pp);
+    assert(bytes);
+    assert(what);
+
+    if (fread(bytes, 1u, len, pp->fp) == len) return;
+
+    if (ferror(pp->fp)) die("can't read input: %s", strerror(errno));
+    die("binary listing ends abruptly, %s expected", what);
+}
+
+// Parses the header of a binary listing.
+ATTRIBUTE((nonnull))
+static void parse_header(struct parser *restrict const pp,
+                         struct device_info *restrict const dip)
+{
+    assert(pp);
+    assert(dip);
+
+    unsigned char bytes[k_record_header_size];
+    read_bytes(pp, bytes, sizeof bytes, "header");
+
+    if (memcmp(bytes, k_record_magic, k_record_magic_size) != 0)
+        die("malformed binary header");
+
+    struct record_header header = { 0 };
+    decode_record_header(&header, bytes);
+
+    if (header.device_start % k_sector_size != 0u)
+        die("device start is not a whole number of sectors");
+
+    *dip = (struct device_info){
+        .major = header.major,
+        .minor = header.minor,
+        .start_byte = header.device_start,
+        .start_sector = header.device_start / k_sector_size
+    };
+
+    pp->binary = true;
+    pp->file_size = header.file_size;
+}
+
+// Checks if the listing is binary, by peeking at its first byte.
+ATTRIBUTE((nonnull))
+static bool is_binary(const struct parser *const pp)
+{
+    assert(pp);
+
+    const int c = getc(pp->fp);
+    if (c == EOF) {
+        if (ferror(pp->fp)) die("can't read input: %s", strerror(errno));
+        die("no input");
+    }
+
+    if (ungetc(c, pp->fp) == EOF) die(BUG("can't push back input"));
+    return c == k_record_magic[0];
+}
+
+void parse_intro(struct parser *restrict const pp,
+                 struct device_info *restrict const dip)
+{
+    assert(pp);
+    assert(dip);
+
+    if (is_binary(pp)) {
+        parse_header(pp, dip);
+        return;
+    }
+
+    parse_intro_line(pp, dip);
+
+    if (!read_line(pp)) die("input ends abruptly after intro");
+    if (!line_is_empty(pp)) die("no empty line divides intro from table");
+
+    parse_labels(pp);
+}
+
+// Reads a table row, and whether it is marked past the end of the file.
+// Returns false if the table is over.
+ATTRIBUTE((nonnull))
+static bool read_table_row(struct parser *restrict const pp,
+                           struct extent_row *restrict const rowp,
+                           bool *restrict const past_eofp)
+{
+    assert(pp);
+    assert(rowp);
+    assert(past_eofp);
+
+    if (!read_line(pp)) die("input ends abruptly after table");
+
+    const char *p = pp->line;
+
+    if (!(scan_gap(&p) && scan_number(pp, &p, &rowp->logical)
+            && scan_gap(&p) && scan_number(pp, &p, &rowp->initial)
+            && scan_gap(&p) && scan_number(pp, &p, &rowp->final)
+            && scan_gap(&p) && scan_number(pp, &p, &rowp->count))) {
+        if (!line_is_empty(pp))
+            die("malformed table line or missing blank-line divider");
+        return false;
+    }
+
+    rowp->flags = (scan_note(&p, k_unwritten_note) ? FIEMAP_EXTENT_UNWRITTEN
+                                                   : 0u);
+    if (scan_note(&p, k_unallocated_note))
+        rowp->flags |= FIEMAP_EXTENT_UNKNOWN;
+    *past_eofp = scan_note(&p, k_past_eof_note);
+
+    if (!at_end(p)) die("malformed table line");
+    return true;
+}
+
+// Reads a binary record, converting it to a row in sectors, and checks if it
+// starts past the end of the file. Returns false if it is the trailer.
+ATTRIBUTE((nonnull))
+static bool read_binary_row(struct parser *restrict const pp,
+                            struct extent_row *restrict const rowp,
+                            bool *restrict const past_eofp)
+{
+    assert(pp);
+    assert(rowp);
+    assert(past_eofp);
+
+    unsigned char bytes[k_record_size];
+    read_bytes(pp, bytes, sizeof bytes, "record or trailer");
+
+    struct extent_record record = { 0 };
+    decode_extent_record(&record, bytes);
+
+    if (record.length == 0u) {
+        pp->record_count = record.logical;
+        return false;
+    }
+
+    if (record.logical % k_sector_size != 0u
+            || record.physical % k_sector_size != 0u
+            || record.length % k_sector_size != 0u)
+        die_at_row(pp, "extent is not a whole number of sectors");
+
+    if (record.physical > ULLONG_MAX - record.length)
+        die_at_row(pp, "physical offset past this extent is too big");
+
+    *rowp = (struct extent_row){
+        .logical = record.logical / k_sector_size,
+        .initial = record.physical / k_sector_size,
+        .final = (record.physical + record.length) / k_sector_size - 1u,
+        .count = record.length / k_sector_size,
+        .flags = record.flags
+    };
+
+    *past_eofp = record.logical >= pp->file_size;
+    return true;
+}
+
+// Reads and checks the next row, whether or not it's past the end of the file.
+// Returns false if the table is over.
+ATTRIBUTE((nonnull))
+static bool parse_any_row(struct parser *restrict const pp,
+                          struct extent_row *restrict const rowp,
+                          bool *restrict const past_eofp)
+{
+    assert(pp);
+    assert(rowp);
+    assert(past_eofp);
+
+    if (!(pp->binary ? read_binary_row(pp, rowp, past_eofp)
+                     : read_table_row(pp, rowp, past_eofp)))
+        return false;
+
+    // Rows may skip over holes, but never go back.
+    if (rowp->logical < pp->next_logical)
+        die_at_row(pp, "inconsistent logical offset");
+
+    if (rowp->count == 0u || rowp->final < rowp->initial
+            || rowp->final - rowp->initial != rowp->count - 1u)
+        die_at_row(pp, "wrong initial-to-final count");
+
+    if (rowp->count > ULLONG_MAX - rowp->logical)
+        die_at_row(pp, "logical offset past this extent is too big");
+
+    if (!*past_eofp && pp->past_count != 0u)
+        die_at_row(pp, "extent within the file follows one past its end");
+
+    // Where such an extent's data will go isn't known, so copying from its
+    // physical offset would copy something else.
+    if (!*past_eofp && (rowp->flags & k_unallocated_flags))
+        die_at_row(pp, "extent is not allocated yet (sync the file, then"
+                       " list its extents again)");
+
+    pp->next_logical = rowp->logical + rowp->count;
+    ++pp->row_count;
+    return true;
+}
+
+bool parse_row(struct parser *restrict const pp,
+               struct extent_row *restrict const rowp)
+{
+    assert(pp);
+    assert(rowp);
+
+    for (bool past_eof = false; parse_any_row(pp, rowp, &past_eof); ) {
+        if (!past_eof) {
+            pp->file_end = pp->next_logical;
+            pp->last_count = rowp->count;
+            return true;
+        }
+
+        if (pp->past_count == 0u) pp->past_logical = rowp->logical;
+        ++pp->past_count;
+        pp->past_sectors += rowp->count;
+    }
+
+    return false;
+}
+
+// Gets how many rows are for extents within the file.
+ATTRIBUTE((nonnull, pure))
+static __u64 count_file_rows(const struct parser *const pp)
+{
+    assert(pp);
+    assert(pp->past_count <= pp->row_count);
+    return pp->row_count - pp->past_count;
+}
+
+// Parses the interpretation guide when there are no extents.
+ATTRIBUTE((nonnull))
+static void parse_trivial_outro(const struct parser *restrict const pp,
+                                struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+    assert(count_file_rows(pp) == 0u);
+
+    const char *const outro = (pp->past_count == 0u
+                                    ? k_trivial_outro
+                                    : k_past_eof_trivial_outro);
+    if (strcmp(pp->line, outro) != 0)
+        die("wrong interpretation guide for no extents");
+
+    *gp = (struct guide){ 0 };
+}
+
+// Gets the size, in bytes, of the last extent and of the logical space up to
+// its end. Quits if they are too big.
+ATTRIBUTE((nonnull))
+static void get_extent_bytes(const struct parser *restrict const pp,
+                             __u64 *restrict const totalp,
+                             __u64 *restrict const last_totalp)
+{
+    assert(pp);
+    assert(totalp);
+    assert(last_totalp);
+
+    if (!sectors_to_bytes(pp->file_end, totalp)
+            || !sectors_to_bytes(pp->last_count, last_totalp))
+        die("extents are too big to measure in bytes");
+}
+
+// Fills in and checks the guide for a file that goes on past the end of its
+// last extent (if any), which is a hole of hole_bytes bytes.
+ATTRIBUTE((nonnull))
+static void make_hole_outro(const struct parser *restrict const pp,
+                            struct guide *restrict const gp,
+                            const __u64 size, const __u64 hole_bytes)
+{
+    assert(pp);
+    assert(gp);
+
+    __u64 total = 0uLL, last_total = 0uLL;
+    get_extent_bytes(pp, &total, &last_total);
+
+    if (hole_bytes == 0u) die("the hole at the end is empty");
+    if (hole_bytes > size || size - hole_bytes != total)
+        die("file size and hole don't add up with the extents");
+
+    *gp = (struct guide){
+        .used_bytes = size,
+        .total_bytes = total,
+        .last_used_bytes = last_total,
+        .last_total_bytes = last_total,
+        .hole_bytes = hole_bytes
+    };
+}
+
+// Parses the interpretation guide for a file that ends in a hole. Returns
+// false if the guide doesn't have that form.
+ATTRIBUTE((nonnull))
+static bool parse_hole_outro(const struct parser *restrict const pp,
+                             struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+
+    const char *p = pp->line;
+    __u64 size = 0uLL, hole_bytes = 0uLL;
+
+    if (!(scan_number(pp, &p, &size)
+            && scan_literal(&p, " bytes, ending in a ")
+            && scan_number(pp, &p, &hole_bytes)
+            && scan_literal(&p, "-byte hole.")
+            && at_end(p)))
+        return false;
+
+    make_hole_outro(pp, gp, size, hole_bytes);
+    return true;
+}
+
+// Checks that the nontrivial guide is consistent with the table and itself.
+ATTRIBUTE((nonnull))
+static void check_outro(const struct parser *restrict const pp,
+                        const struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+    assert(count_file_rows(pp) != 0u);
+
+    // Check that the nontrivial outro doesn't directly contradict the table.
+    __u64 logical_bytes = 0uLL, last_bytes = 0uLL;
+    get_extent_bytes(pp, &logical_bytes, &last_bytes);
+    if (gp->total_bytes != logical_bytes)
+        die("total bytes taken up by file not equal to end of extents");
+    if (gp->last_total_bytes != last_bytes)
+        die("inconsistent last-extent size");
+
+    // Check that the values otherwise make sense.
+    if (gp->used_bytes == 0u) die("no used bytes, but file isn't empty?");
+    if (gp->used_bytes > gp->total_bytes)
+        die("more bytes used than in all extents!");
+    if (gp->last_used_bytes == 0u) die("last extent is unused, that's weird");
+    if (gp->last_used_bytes > gp->last_total_bytes)
+        die("last extent has more bytes used than present!");
+    if (gp->total_bytes - gp->used_bytes
+            != gp->last_total_bytes - gp->last_used_bytes)
+        die("unused bytes are not all in the last extent");
+}
+
+// Parses the interpretation guide when there are extents.
+ATTRIBUTE((nonnull))
+static void parse_nontrivial_outro(const struct parser *restrict const pp,
+                                   struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+
+    if (parse_hole_outro(pp, gp)) return;
+
+    const char *p = pp->line;
+
+    if (!(scan_number(pp, &p, &gp->used_bytes)
+            && scan_literal(&p, "/")
+            && scan_number(pp, &p, &gp->total_bytes)
+            && scan_literal(&p, " bytes used, ")
+            && scan_number(pp, &p, &gp->last_used_bytes)
+            && scan_literal(&p, "/")
+            && scan_number(pp, &p, &gp->last_total_bytes)
+            && scan_literal(&p, " in the last extent.")
+            && at_end(p)))
+        die("malformed interpretation guide");
+
+    check_outro(pp, gp);
+}
+
+// Parses the line of the interpretation guide about extents past the end of
+// the file, and checks it against the rows marked as past the end.
+ATTRIBUTE((nonnull))
+static void parse_past_eof_outro(struct parser *restrict const pp,
+                                 const struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+    assert(pp->past_count != 0u);
+
+    if (!read_line(pp))
+        die("input ends abruptly, line about extents past EOF expected");
+
+    const char *p = pp->line;
+    __u64 bytes = 0uLL, count = 0uLL;
+
+    if (!(scan_literal(&p, "Past the end of the file: ")
+            && scan_number(pp, &p, &bytes)
+            && scan_literal(&p, " bytes in ")
+            && scan_number(pp, &p, &count)
+            && scan_literal(&p, " extents.")
+            && at_end(p)))
+        die("malformed line about extents past EOF");
+
+    __u64 table_bytes = 0uLL, start = 0uLL;
+    if (!sectors_to_bytes(pp->past_sectors, &table_bytes)
+            || !sectors_to_bytes(pp->past_logical, &start))
+        die("extents past EOF are too big to measure in bytes");
+
+    if (count != pp->past_count || bytes != table_bytes)
+        die("extents past EOF don't add up with the table");
+    if (start < gp->used_bytes)
+        die("extent marked past EOF starts within the file");
+}
+
+// Works out what the interpretation guide would say for a binary listing,
+// from the file size in its header, and checks it. Then checks that the
+// trailer is the end.
+ATTRIBUTE((nonnull))
+static void derive_outro(const struct parser *restrict const pp,
+                         struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+    assert(pp->binary);
+
+    if (pp->record_count != pp->row_count)
+        die("binary trailer says %llu records, but there were %llu",
+                pp->record_count, pp->row_count);
+
+    if (getc(pp->fp) != EOF) die("unexpected data after binary trailer");
+    if (ferror(pp->fp)) die("can't read input: %s", strerror(errno));
+
+    __u64 total = 0uLL, last_total = 0uLL;
+    get_extent_bytes(pp, &total, &last_total);
+
+    if (pp->file_size > total) {
+        make_hole_outro(pp, gp, pp->file_size, pp->file_size - total);
+        return;
+    }
+
+    if (count_file_rows(pp) == 0u) {
+        *gp = (struct guide){ 0 };
+        return;
+    }
+
+    // The last row within the file starts before its end.
+    const __u64 unused = total - pp->file_size;
+    assert(unused < last_total);
+
+    *gp = (struct guide){
+        .used_bytes = pp->file_size,
+        .total_bytes = total,
+        .last_used_bytes = last_total - unused,
+        .last_total_bytes = last_total
+    };
+
+    check_outro(pp, gp);
+}
+
+void parse_outro(struct parser *restrict const pp,
+                 struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+
+    if (pp->binary) {
+        derive_outro(pp, gp);
+        return;
+    }
+
+    if (!read_line(pp))
+        die("input ends abruptly, interpretation guide expected");
+
+    if (count_file_rows(pp) != 0u)
+        parse_nontrivial_outro(pp, gp);
+    else if (!parse_hole_outro(pp, gp))
+        parse_trivial_outro(pp, gp);
+
+    if (pp->past_count != 0u) parse_past_eof_outro(pp, gp);
+
+    // The input looks good and complete. Make sure there's no more of it.
+    while (read_line(pp))
+        if (!line_is_empty(pp)) die("unexpected non-empty trailing lines");
+}
+
+void destroy_parser(struct parser *const pp)
+{
+    assert(pp);
+
+    free(pp->line);
+    pp->line = NULL;
+    pp->capacity = 0u;
+}
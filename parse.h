@@ -0,0 +1,109 @@
+// parse.h - parsing and checking fiemap's output
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_PARSE_H_
+#define HAVE_EXTENTS_FIEMAP_PARSE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+// Information from the intro, the first line of fiemap's output.
+struct device_info {
+    unsigned major;
+    unsigned minor;
+    __u64 start_byte;
+    __u64 start_sector;
+};
+
+// A row of the table, or a binary record. All values are in sectors.
+struct extent_row {
+    __u64 logical;
+    __u64 initial;
+    __u64 final;
+    __u64 count;
+    __u32 flags; // fe_flags (from a table, only UNWRITTEN and UNKNOWN)
+};
+
+// Information from the outro ("interpretation guide"). used_bytes is the file
+// size, and total_bytes is where the last extent ends in the file. If the file
+// goes on past that, the rest is a hole of hole_bytes bytes, and the whole
+// last extent is used. For an empty file with no extents, all are zero.
+struct guide {
+    __u64 used_bytes;
+    __u64 total_bytes;
+    __u64 last_used_bytes;
+    __u64 last_total_bytes;
+    __u64 hole_bytes;
+};
+
+// State for parsing a listing one line (or binary record) at a time, so the
+// whole listing need not be held in memory, and rows can be used as soon as
+// they are parsed. Listings may be tables or binary records (see record.h).
+struct parser {
+    FILE *fp;
+    char *line;
+    size_t capacity;
+    __u64 line_number;   // number of the line most recently read (from 1)
+    __u64 row_count;     // number of table rows parsed so far
+    __u64 next_logical;  // logical sector the next row may not start before
+    __u64 file_end;      // logical sector past the last row within the file
+    __u64 last_count;    // sector count of the last row within the file
+    __u64 past_count;    // number of rows past the end of the file
+    __u64 past_sectors;  // sectors in them
+    __u64 past_logical;  // logical sector where the first of them starts
+    bool binary;         // whether the listing is binary records
+    __u64 file_size;     // from the header, if binary
+    __u64 record_count;  // from the trailer, if binary
+};
+
+// Prepares to parse a listing read from fp.
+ATTRIBUTE((nonnull))
+void init_parser(struct parser *restrict pp, FILE *restrict fp);
+
+// Parses the intro, the blank line after it, and the column labels. Or, if the
+// listing is binary, parses its header.
+ATTRIBUTE((nonnull))
+void parse_intro(struct parser *restrict pp, struct device_info *restrict dip);
+
+// Parses and checks a table row or binary record. Rows are in logical order
+// and don't overlap, but there may be holes between them. Rows for extents
+// past the end of the file, such as space preallocated without changing its
+// size, are checked and counted but skipped. They are marked "past EOF" in a
+// table, and start at or after the file size in a binary listing's header.
+// Quits if an extent within the file isn't allocated yet, as marked
+// "unallocated" in a table, or flagged FIEMAP_EXTENT_UNKNOWN or
+// FIEMAP_EXTENT_DELALLOC in a binary listing. Returns false, instead, if the
+// table is over (or the binary trailer was read).
+ATTRIBUTE((nonnull))
+bool parse_row(struct parser *restrict pp, struct extent_row *restrict rowp);
+
+// Parses the interpretation guide and checks it against the table, including
+// the line about extents past the end of the file, if there are any. Then
+// checks that the only lines remaining, if any, are blank. For a binary
+// listing, instead works out the guide from the file size in the header, and
+// checks that nothing follows the trailer.
+ATTRIBUTE((nonnull))
+void parse_outro(struct parser *restrict pp, struct guide *restrict gp);
+
+// Frees the parser's line buffer.
+ATTRIBUTE((nonnull))
+void destroy_parser(struct parser *pp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_PARSE_H_
@@ -0,0 +1,353 @@
+// plan.c - byte ranges to read from disk to reassemble a file (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "plan.h"
+
+#include "constants.h"
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <linux/fiemap.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Adds a segment for a table row. The row has been checked by the parser, but
+// its values, in sectors, might still be too big to express in bytes.
+ATTRIBUTE((nonnull))
+static void add_segment(struct plan *restrict const pp,
+                        const struct extent_row *restrict const rowp)
+{
+    assert(pp);
+    assert(rowp);
+    assert(pp->count <= pp->capacity);
+
+    if (rowp->final >= ULLONG_MAX / k_sector_size
+            || rowp->logical + rowp->count > ULLONG_MAX / k_sector_size)
+        die("row %zu: sector numbers too big to convert to bytes",
+                pp->count + 1u);
+
+    const __u64 logical = rowp->logical * k_sector_size;
+    const __u64 previous_end = (pp->count == 0u ? 0u
+            : pp->segments[pp->count - 1u].logical
+              + pp->segments[pp->count - 1u].length);
+    const bool unwritten = (rowp->flags & FIEMAP_EXTENT_UNWRITTEN) != 0u;
+
+    if (logical != previous_end || unwritten) pp->sparse = true;
+
+    if (pp->count == pp->capacity) {
+        pp->capacity = (pp->capacity ? pp->capacity * 2u : 64u);
+        pp->segments = xreallocarray(pp->segments, pp->capacity,
+                                     sizeof pp->segments[0]);
+    }
+
+    pp->segments[pp->count] = (struct segment){
+        .logical = logical,
+        .physical = rowp->initial * k_sector_size,
+        .length = rowp->count * k_sector_size,
+        .row = pp->count + 1u,
+        .unwritten = unwritten
+    };
+
+    ++pp->count;
+}
+
+// Shortens the last segment to the bytes actually used in the last extent. If
+// the file ends in a hole, they all are, so it isn't shortened.
+ATTRIBUTE((nonnull))
+static void trim_plan(struct plan *restrict const pp,
+                      const struct guide *restrict const gp)
+{
+    assert(pp);
+    assert(gp);
+
+    pp->size = gp->used_bytes;
+    if (gp->hole_bytes != 0u) pp->sparse = true;
+    if (pp->count == 0u) return;
+
+    struct segment *const lastp = &pp->segments[pp->count - 1u];
+    assert(lastp->length == gp->last_total_bytes);
+    assert(gp->last_used_bytes <= lastp->length);
+
+    lastp->length = gp->last_used_bytes;
+    assert(lastp->logical + lastp->length == pp->size - gp->hole_bytes);
+}
+
+void open_plan(struct plan *restrict const pp, FILE *restrict const fp)
+{
+    assert(pp);
+    assert(fp);
+
+    *pp = (struct plan){ .segments = NULL, .complete = false };
+
+    const __u64 start = start_timing();
+    init_parser(&pp->parser, fp);
+    parse_intro(&pp->parser, &pp->dev);
+    stop_timing(k_phase_parse, start);
+}
+
+bool extend_plan(struct plan *const pp)
+{
+    assert(pp);
+
+    if (pp->complete) return false;
+
+    const __u64 start = start_timing();
+
+    struct extent_row row = { 0 };
+    if (parse_row(&pp->parser, &row)) {
+        add_segment(pp, &row);
+        stop_timing(k_phase_parse, start);
+        return true;
+    }
+
+    struct guide guide = { 0 };
+    parse_outro(&pp->parser, &guide);
+    destroy_parser(&pp->parser);
+
+    trim_plan(pp, &guide);
+    pp->complete = true;
+    stop_timing(k_phase_parse, start);
+    return false;
+}
+
+void finish_plan(struct plan *const pp)
+{
+    assert(pp);
+    while (extend_plan(pp)) continue;
+}
+
+void read_plan(struct plan *restrict const pp, FILE *restrict const fp)
+{
+    assert(pp);
+    assert(fp);
+
+    open_plan(pp, fp);
+    finish_plan(pp);
+}
+
+// Gets how many segments won't change. If the plan is incomplete, the last
+// segment so far might be the last in the file, and be shortened later.
+ATTRIBUTE((nonnull, pure))
+static size_t final_count(const struct plan *const pp)
+{
+    assert(pp);
+    return (pp->complete || pp->count == 0u ? pp->count : pp->count - 1u);
+}
+
+__u64 seek_distance(const struct plan *const pp)
+{
+    assert(pp);
+    assert(pp->complete);
+
+    __u64 distance = 0u;
+    const struct segment *previous = NULL;
+
+    for (size_t i = 0u; i < pp->count; ++i) {
+        const struct segment *const sp = &pp->segments[i];
+        if (sp->unwritten) continue;
+
+        if (previous) {
+            const __u64 from = previous->physical + previous->length;
+            const __u64 to = sp->physical;
+
+            const __u64 seek = (from < to ? to - from : from - to);
+            distance = (seek > ULLONG_MAX - distance ? ULLONG_MAX
+                                                     : distance + seek);
+        }
+
+        previous = sp;
+    }
+
+    return distance;
+}
+
+// Orders segments by physical offset, for qsort().
+static int compare_physical(const void *const left, const void *const right)
+{
+    const struct segment *const lp = left, *const rp = right;
+    return (lp->physical > rp->physical) - (lp->physical < rp->physical);
+}
+
+void sort_physically(struct plan *const pp)
+{
+    assert(pp);
+    assert(pp->complete);
+
+    if (pp->count > 1u) {
+        qsort(pp->segments, pp->count, sizeof pp->segments[0],
+              compare_physical);
+    }
+}
+
+void init_chunker(struct chunker *restrict const ckp,
+                  struct plan *restrict const pp,
+                  const size_t max_length, const size_t alignment,
+                  const bool fill_holes)
+{
+    assert(ckp);
+    assert(pp);
+    assert(max_length != 0u);
+    assert(alignment != 0u && (alignment & (alignment - 1u)) == 0u);
+
+    const size_t rounded = (max_length + alignment - 1u) & ~(alignment - 1u);
+    if (rounded < max_length) die("chunk size too big to align");
+
+    *ckp = (struct chunker){
+        .pp = pp,
+        .max_length = rounded,
+        .alignment = alignment,
+        .fill_holes = fill_holes
+    };
+}
+
+size_t chunk_buffer_size(const struct chunker *const ckp)
+{
+    assert(ckp);
+
+    if (ckp->max_length > SIZE_MAX - ckp->alignment * 2u)
+        die("chunk size too big to align");
+
+    return ckp->max_length + (ckp->alignment == 1u ? 0u
+                                                   : ckp->alignment * 2u);
+}
+
+// Widens the range a chunk reads to start and end at multiples of alignment.
+ATTRIBUTE((nonnull))
+static void align_chunk(struct chunk *const cp, const size_t alignment)
+{
+    assert(cp);
+
+    const __u64 mask = alignment - 1u;
+    const __u64 start = cp->physical & ~mask;
+    const __u64 end = (cp->physical + cp->length + mask) & ~mask;
+
+    cp->read_offset = start;
+    cp->read_length = (size_t)(end - start);
+    cp->skip = (size_t)(cp->physical - start);
+}
+
+// Makes a zero chunk from where the last chunk ended up to end. Returns false
+// if there is nothing in between.
+ATTRIBUTE((nonnull))
+static bool make_zero_chunk(struct chunker *restrict const ckp,
+                            struct chunk *restrict const cp, const __u64 end,
+                            const size_t row)
+{
+    assert(ckp);
+    assert(cp);
+
+    if (end <= ckp->position) return false;
+
+    const __u64 remaining = end - ckp->position;
+
+    *cp = (struct chunk){
+        .logical = ckp->position,
+        .length = (remaining < SIZE_MAX ? (size_t)remaining : SIZE_MAX),
+        .row = row,
+        .zero = true
+    };
+
+    ckp->position += cp->length;
+    return true;
+}
+
+// Gets the next segment with data to read, unless there is a hole or an
+// unwritten segment to fill first, in which case makes a zero chunk for it.
+// Returns the segment, a null pointer if the zero chunk was made instead, or,
+// through *overp, whether there are no more chunks at all.
+ATTRIBUTE((nonnull))
+static const struct segment *
+next_data_segment(struct chunker *restrict const ckp,
+                  struct chunk *restrict const cp, bool *restrict const overp)
+{
+    assert(ckp);
+    assert(cp);
+    assert(overp);
+
+    struct plan *const pp = ckp->pp;
+    *overp = false;
+
+    for (;;) {
+        while (ckp->index == final_count(pp)) {
+            if (extend_plan(pp) || ckp->index != pp->count) continue;
+
+            // The file may end in a hole.
+            *overp = !(ckp->fill_holes
+                        && make_zero_chunk(ckp, cp, pp->size, 0u));
+            return NULL;
+        }
+
+        const struct segment *const sp = &pp->segments[ckp->index];
+        const __u64 end = sp->logical + sp->length;
+
+        if (ckp->fill_holes && make_zero_chunk(ckp, cp, sp->logical, 0u))
+            return NULL;
+
+        if (!sp->unwritten) return sp;
+
+        if (ckp->fill_holes && make_zero_chunk(ckp, cp, end, sp->row)) {
+            if (ckp->position == end) ++ckp->index;
+            return NULL;
+        }
+
+        ++ckp->index;
+        ckp->position = end;
+    }
+}
+
+bool next_chunk(struct chunker *restrict const ckp,
+                struct chunk *restrict const cp)
+{
+    assert(ckp);
+    assert(cp);
+
+    bool over = false;
+    const struct segment *const sp = next_data_segment(ckp, cp, &over);
+    if (!sp) return !over;
+
+    assert(ckp->done < sp->length);
+
+    const __u64 remaining = sp->length - ckp->done;
+
+    *cp = (struct chunk){
+        .logical = sp->logical + ckp->done,
+        .physical = sp->physical + ckp->done,
+        .length = (remaining < ckp->max_length ? (size_t)remaining
+                                               : ckp->max_length),
+        .row = sp->row
+    };
+
+    align_chunk(cp, ckp->alignment);
+    ckp->done += cp->length;
+    ckp->position = cp->logical + cp->length;
+
+    if (ckp->done == sp->length) {
+        ++ckp->index;
+        ckp->done = 0u;
+    }
+
+    return true;
+}
+
+void destroy_plan(struct plan *const pp)
+{
+    assert(pp);
+
+    destroy_parser(&pp->parser);
+    free(pp->segments);
+    pp->segments = NULL;
+    pp->count = pp->capacity = 0u;
+}
@@ -0,0 +1,136 @@
+// plan.h - byte ranges to read from disk to reassemble a file
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_PLAN_H_
+#define HAVE_EXTENTS_FIEMAP_PLAN_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "parse.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+// A run of bytes to read from the disk. All values are in bytes.
+struct segment {
+    __u64 logical;  // where the bytes go in the file
+    __u64 physical; // where the bytes are on the disk
+    __u64 length;
+    size_t row;     // which table row this is from, counting from 1
+    bool unwritten; // allocated but not written, so it reads as zeros
+};
+
+// Everything needed to reassemble a file. The segments are in logical order,
+// unless they have been sorted into physical order. Where one segment ends and
+// the next begins later, the file has a hole, which reads as zeros, and so
+// does whatever part of the file is past the last segment. A plan may be read
+// all at once, or extended a row at a time while its segments are being read.
+struct plan {
+    struct device_info dev;
+    struct segment *segments;
+    size_t count;
+    size_t capacity;
+    __u64 size;           // the file's size, once complete
+    bool complete;        // whether the whole listing has been read
+    bool sparse;          // whether any of the file needn't be read (so far)
+    struct parser parser; // for reading the rest of the listing
+};
+
+// A piece of a segment, small enough to read at once. To satisfy alignment
+// requirements, more may be read than is needed: read_length bytes are read
+// from read_offset, and the chunk's data begin skip bytes into what is read.
+// A zero chunk stands for a hole or unwritten extent instead. Nothing is read
+// for it, and it may be any length.
+struct chunk {
+    __u64 logical;
+    __u64 physical;
+    size_t length;
+    __u64 read_offset;
+    size_t read_length;
+    size_t skip;
+    size_t row; // which segment (table row) this is from, counting from 1,
+                // or 0 for a hole
+    bool zero;  // whether this is a zero chunk
+};
+
+// State for splitting a plan's segments into chunks, in logical order.
+struct chunker {
+    struct plan *pp;
+    size_t max_length;
+    size_t alignment; // reads start and end at multiples of this
+    bool fill_holes;  // whether to return zero chunks (or skip the zeros)
+    size_t index;     // the segment being split
+    __u64 done;       // how much of that segment is in chunks already returned
+    __u64 position;   // logical offset where the last chunk returned ended
+};
+
+// Reads and checks a listing in the format fiemap outputs, and makes a plan.
+ATTRIBUTE((nonnull))
+void read_plan(struct plan *restrict pp, FILE *restrict fp);
+
+// Starts a plan from a listing read from fp, reading only the intro.
+ATTRIBUTE((nonnull))
+void open_plan(struct plan *restrict pp, FILE *restrict fp);
+
+// Reads and checks the next row, adding a segment for it. At the end of the
+// table, instead reads and checks the interpretation guide, shortens the last
+// segment to the bytes used, and marks the plan complete. Returns true if a
+// segment was added, or false if the plan is complete.
+ATTRIBUTE((nonnull))
+bool extend_plan(struct plan *pp);
+
+// Reads the rest of the listing into the plan.
+ATTRIBUTE((nonnull))
+void finish_plan(struct plan *pp);
+
+// Gets the total distance, in bytes, the disk would seek between reading each
+// segment and the next, if they were read in their current order. Unwritten
+// segments are never read, so they don't count. The plan must be complete.
+ATTRIBUTE((nonnull, pure))
+__u64 seek_distance(const struct plan *pp);
+
+// Sorts the segments by where they start on the disk, so reading them in order
+// is a single ascending sweep. Their data then have to be written at their
+// logical offsets, rather than one after another. The plan must be complete.
+ATTRIBUTE((nonnull))
+void sort_physically(struct plan *pp);
+
+// Prepares to split a plan into chunks no longer than max_length, whose reads
+// are aligned to alignment, which must be a power of two. If alignment is more
+// than 1, max_length is rounded up to a multiple of it. If fill_holes is true,
+// holes and unwritten segments, including any hole at the end of the file,
+// become zero chunks, so the chunks cover the whole file. Otherwise they are
+// skipped. Zero chunks need the plan to be in logical order.
+ATTRIBUTE((nonnull))
+void init_chunker(struct chunker *restrict ckp, struct plan *restrict pp,
+                  size_t max_length, size_t alignment, bool fill_holes);
+
+// Gets the size of a buffer big enough to read any chunk into.
+ATTRIBUTE((nonnull, pure))
+size_t chunk_buffer_size(const struct chunker *ckp);
+
+// Gets the next chunk. If the plan isn't complete, extends it as needed, never
+// returning a chunk of the last segment read so far, since that one might yet
+// be shortened. Returns false, instead, if there are no more chunks.
+ATTRIBUTE((nonnull))
+bool next_chunk(struct chunker *restrict ckp, struct chunk *restrict cp);
+
+// Frees the plan's segments and the parser's buffer.
+ATTRIBUTE((nonnull))
+void destroy_plan(struct plan *pp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_PLAN_H_
@@ -0,0 +1,162 @@
+// record.c - the binary extent record format (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "record.h"
+
+#include "constants.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+const unsigned char k_record_magic[k_record_magic_size] = {
+    0x89, 'E', 'X', 'T', 'E', 'N', 'T', 'S'
+};
+
+// How many records are encoded before they are written together.
+enum { k_records_per_batch = 128 };
+
+ATTRIBUTE((nonnull))
+static void write_bytes(FILE *restrict const fp,
+                        const unsigned char *restrict const bytes,
+                        const size_t len)
+{
+    assert(fp);
+    assert(bytes);
+
+    if (fwrite(bytes, 1u, len, fp) != len)
+        die("can't write output: %s", strerror(errno));
+}
+
+void encode_record_header(unsigned char *restrict const bytes,
+                          const struct record_header *restrict const hp)
+{
+    assert(bytes);
+    assert(hp);
+
+    memset(bytes, 0, k_record_header_size);
+    memcpy(bytes, k_record_magic, k_record_magic_size);
+    put_le32(bytes + 8, hp->version);
+    put_le32(bytes + 12, hp->record_size);
+    put_le32(bytes + 16, hp->sector_size);
+    put_le32(bytes + 20, hp->major);
+    put_le32(bytes + 24, hp->minor);
+    put_le64(bytes + 32, hp->device_start);
+    put_le64(bytes + 40, hp->file_size);
+}
+
+void write_record_header(FILE *restrict const fp,
+                         const struct record_header *restrict const hp)
+{
+    assert(fp);
+    assert(hp);
+
+    unsigned char bytes[k_record_header_size];
+    encode_record_header(bytes, hp);
+    write_bytes(fp, bytes, sizeof bytes);
+}
+
+void encode_extent_record(unsigned char *restrict const bytes,
+                          const struct extent_record *restrict const rp)
+{
+    assert(bytes);
+    assert(rp);
+
+    memset(bytes, 0, k_record_size);
+    put_le64(bytes, rp->logical);
+    put_le64(bytes + 8, rp->physical);
+    put_le64(bytes + 16, rp->length);
+    put_le32(bytes + 24, rp->flags);
+}
+
+void write_extent_records(FILE *restrict const fp,
+                          const struct fiemap_extent *restrict const extents,
+                          const __u32 count, const __u64 device_start)
+{
+    assert(fp);
+    assert(extents);
+
+    unsigned char batch[k_records_per_batch * k_record_size];
+
+    for (__u32 i = 0u; i < count; ) {
+        size_t len = 0u;
+
+        for (; i < count && len != sizeof batch; ++i, len += k_record_size) {
+            const struct fiemap_extent *const fep = &extents[i];
+            if (fep->fe_length == 0u) die("extent %u has zero length", i);
+
+            encode_extent_record(batch + len, &(struct extent_record){
+                .logical = fep->fe_logical,
+                .physical = fep->fe_physical + device_start,
+                .length = fep->fe_length,
+                .flags = fep->fe_flags
+            });
+        }
+
+        write_bytes(fp, batch, len);
+    }
+}
+
+void write_record_trailer(FILE *const fp, const __u64 record_count)
+{
+    assert(fp);
+
+    unsigned char bytes[k_record_size];
+    encode_extent_record(bytes, &(struct extent_record){
+        .logical = record_count
+    });
+
+    write_bytes(fp, bytes, sizeof bytes);
+    if (fflush(fp) != 0) die("can't write output: %s", strerror(errno));
+}
+
+void decode_record_header(struct record_header *restrict const hp,
+                          const unsigned char *restrict const bytes)
+{
+    assert(hp);
+    assert(bytes);
+    assert(memcmp(bytes, k_record_magic, k_record_magic_size) == 0);
+
+    *hp = (struct record_header){
+        .version = get_le32(bytes + 8),
+        .record_size = get_le32(bytes + 12),
+        .sector_size = get_le32(bytes + 16),
+        .major = get_le32(bytes + 20),
+        .minor = get_le32(bytes + 24),
+        .device_start = get_le64(bytes + 32),
+        .file_size = get_le64(bytes + 40)
+    };
+
+    if (hp->version != k_record_version)
+        die("binary listing has unsupported version %u", hp->version);
+    if (hp->record_size != k_record_size)
+        die("binary listing has wrong record size %u", hp->record_size);
+    if (hp->sector_size != k_sector_size)
+        die("binary listing has unsupported sector size %u", hp->sector_size);
+}
+
+void decode_extent_record(struct extent_record *restrict const rp,
+                          const unsigned char *restrict const bytes)
+{
+    assert(rp);
+    assert(bytes);
+
+    *rp = (struct extent_record){
+        .logical = get_le64(bytes),
+        .physical = get_le64(bytes + 8),
+        .length = get_le64(bytes + 16),
+        .flags = get_le32(bytes + 24)
+    };
+}
@@ -0,0 +1,130 @@
+// record.h - the binary extent record format fiemap writes with --binary
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// The format is a header, then one record per extent, then a trailer, which
+// has the same size as a record. All integers are little-endian, and all
+// offsets and lengths are in bytes. Since the header and records have fixed
+// sizes, record n (counting from 0) starts at byte
+// k_record_header_size + n * k_record_size, so a listing can be mapped into
+// memory and its extents accessed in any order.
+//
+// Header (k_record_header_size bytes):
+//
+//    0  magic          k_record_magic (8 bytes, beginning with a non-ASCII
+//                      byte, so a listing can't be mistaken for the table)
+//    8  version        u32, k_record_version
+//   12  record size    u32, k_record_size
+//   16  sector size    u32, k_sector_size
+//   20  major          u32, major device number of the volume
+//   24  minor          u32, minor device number of the volume
+//   28  (reserved)     u32, zero
+//   32  device start   u64, where the volume starts on its disk
+//   40  file size      u64, the file's size, which its extents may exceed
+//
+// Record (k_record_size bytes), one per extent, in logical order:
+//
+//    0  logical        u64, fe_logical
+//    8  physical       u64, fe_physical plus the device start
+//   16  length         u64, fe_length, never zero
+//   24  flags          u32, fe_flags
+//   28  (reserved)     u32, zero
+//
+// Trailer (k_record_size bytes), marking the end, so truncation is detected:
+//
+//    0  record count   u64, how many records precede the trailer
+//    8  (reserved)     u64, zero
+//   16  length         u64, zero, which is how it's told from a record
+//   24  (reserved)     u64, zero
+
+#ifndef HAVE_EXTENTS_FIEMAP_RECORD_H_
+#define HAVE_EXTENTS_FIEMAP_RECORD_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+enum record_constants {
+    k_record_version = 1,
+    k_record_header_size = 48,
+    k_record_size = 32,
+    k_record_magic_size = 8
+};
+
+// The first bytes of every binary listing.
+extern const unsigned char k_record_magic[k_record_magic_size];
+
+// The information in the header, decoded.
+struct record_header {
+    __u32 version;
+    __u32 record_size;
+    __u32 sector_size;
+    __u32 major;
+    __u32 minor;
+    __u64 device_start;
+    __u64 file_size;
+};
+
+// A record, decoded. A record whose length is zero is the trailer, and its
+// logical field holds the record count.
+struct extent_record {
+    __u64 logical;
+    __u64 physical;
+    __u64 length;
+    __u32 flags;
+};
+
+// Encodes the header into k_record_header_size bytes.
+ATTRIBUTE((nonnull))
+void encode_record_header(unsigned char *restrict bytes,
+                          const struct record_header *restrict hp);
+
+// Encodes a record, or, if its length is zero, the trailer, into k_record_size
+// bytes.
+ATTRIBUTE((nonnull))
+void encode_extent_record(unsigned char *restrict bytes,
+                          const struct extent_record *restrict rp);
+
+// Writes the header to fp. Quits on failure.
+ATTRIBUTE((nonnull))
+void write_record_header(FILE *restrict fp,
+                         const struct record_header *restrict hp);
+
+// Writes a record for each of count extents to fp, adding device_start to
+// their physical offsets. Quits on failure.
+ATTRIBUTE((nonnull))
+void write_extent_records(FILE *restrict fp,
+                          const struct fiemap_extent *restrict extents,
+                          __u32 count, __u64 device_start);
+
+// Writes the trailer to fp, then flushes it. Quits on failure.
+ATTRIBUTE((nonnull))
+void write_record_trailer(FILE *fp, __u64 record_count);
+
+// Decodes and checks a header, whose magic number must already have been
+// checked. Quits if the header is for a different version or is malformed.
+ATTRIBUTE((nonnull))
+void decode_record_header(struct record_header *restrict hp,
+                          const unsigned char *restrict bytes);
+
+// Decodes a record or trailer.
+ATTRIBUTE((nonnull))
+void decode_extent_record(struct extent_record *restrict rp,
+                          const unsigned char *restrict bytes);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_RECORD_H_
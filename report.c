@@ -0,0 +1,147 @@
+// report.c - summarizing how fragmented a file is (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "report.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+
+// Adds, but gives ULLONG_MAX instead of wrapping around.
+ATTRIBUTE((const))
+static __u64 saturating_add(const __u64 first, const __u64 second)
+{
+    return second > ULLONG_MAX - first ? ULLONG_MAX : first + second;
+}
+
+// Finds which histogram bucket an extent of the given length goes in.
+ATTRIBUTE((const))
+static unsigned bucket_of(__u64 length)
+{
+    unsigned bucket = 0u;
+
+    for (length >>= k_histogram_min_shift + 1; length != 0u; length >>= 1)
+        if (++bucket == k_histogram_buckets - 1u) break;
+
+    return bucket;
+}
+
+// Adds one extent to the statistics.
+ATTRIBUTE((nonnull))
+static void add_extent(struct frag_report *restrict const rp,
+                       const struct fiemap_extent *restrict const fep)
+{
+    assert(rp);
+    assert(fep);
+
+    ++rp->count;
+    rp->bytes = saturating_add(rp->bytes, fep->fe_length);
+    ++rp->histogram[bucket_of(fep->fe_length)];
+
+    if (fep->fe_logical > rp->logical_end) {
+        ++rp->holes;
+        rp->hole_bytes = saturating_add(rp->hole_bytes,
+                                        fep->fe_logical - rp->logical_end);
+    }
+    rp->logical_end = saturating_add(fep->fe_logical, fep->fe_length);
+
+    if (fep->fe_flags & FIEMAP_EXTENT_UNWRITTEN)
+        rp->unwritten_bytes = saturating_add(rp->unwritten_bytes,
+                                             fep->fe_length);
+
+    if (rp->have_previous) {
+        const __u64 from = rp->previous_end, to = fep->fe_physical;
+        const __u64 seek = (from < to ? to - from : from - to);
+
+        if (seek != 0u) ++rp->discontinuities;
+        rp->total_seek = saturating_add(rp->total_seek, seek);
+        if (rp->max_seek < seek) rp->max_seek = seek;
+    }
+
+    rp->have_previous = true;
+    rp->previous_end = saturating_add(fep->fe_physical, fep->fe_length);
+}
+
+void add_to_report(struct frag_report *restrict const rp,
+                   const struct fiemap *restrict const fmp)
+{
+    assert(rp);
+    assert(fmp);
+
+    for (__u32 i = 0u; i < fmp->fm_mapped_extents; ++i)
+        add_extent(rp, &fmp->fm_extents[i]);
+}
+
+// Shows a power of two, at least 1 KiB, in the biggest unit it's a whole
+// number of.
+ATTRIBUTE((nonnull))
+static void show_size(FILE *const out, const unsigned shift)
+{
+    static const char *const units[] = { "KiB", "MiB", "GiB" };
+
+    assert(out);
+    assert(shift >= 10u && shift < 40u);
+    fprintf(out, "%4u %s", 1u << (shift % 10u), units[shift / 10u - 1u]);
+}
+
+// Shows the range of extent sizes a histogram bucket is for. Each bucket but
+// the last is labeled by its exclusive upper bound.
+ATTRIBUTE((nonnull))
+static void show_bucket_label(FILE *const out, const unsigned bucket)
+{
+    assert(out);
+    assert(bucket < k_histogram_buckets);
+
+    if (bucket == k_histogram_buckets - 1u) {
+        fputs("  >= ", out);
+        show_size(out, k_histogram_min_shift + bucket);
+    } else {
+        fputs("   < ", out);
+        show_size(out, k_histogram_min_shift + bucket + 1u);
+    }
+}
+
+void show_report(const struct frag_report *restrict const rp,
+                 FILE *restrict const out)
+{
+    assert(rp);
+    assert(out);
+
+    fprintf(out, "Extents: %llu\n", rp->count);
+    fprintf(out, "Bytes in extents: %llu\n", rp->bytes);
+    if (rp->count == 0u) return;
+
+    fputs("\nExtent sizes:\n", out);
+    for (unsigned i = 0u; i < k_histogram_buckets; ++i) {
+        if (rp->histogram[i] == 0u) continue;
+
+        show_bucket_label(out, i);
+        fprintf(out, "  %12llu  (%.1f%%)\n", rp->histogram[i],
+                100.0 * (double)rp->histogram[i] / (double)rp->count);
+    }
+
+    __u64 ideal = (rp->bytes / k_ideal_extent_size
+                    + (rp->bytes % k_ideal_extent_size != 0u));
+    if (ideal == 0u) ideal = 1u;
+
+    fprintf(out, "\nHoles before the last extent: %llu (%llu bytes)\n",
+            rp->holes, rp->hole_bytes);
+    fprintf(out, "Unwritten bytes: %llu\n", rp->unwritten_bytes);
+
+    fprintf(out, "\nPhysical discontinuities: %llu\n", rp->discontinuities);
+    fprintf(out, "Total seek distance: %llu bytes\n", rp->total_seek);
+    fprintf(out, "Maximum seek distance: %llu bytes\n", rp->max_seek);
+    fprintf(out, "Ideal extent count: %llu (%.1f%% of actual)\n",
+            ideal, 100.0 * (double)ideal / (double)rp->count);
+}
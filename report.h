@@ -0,0 +1,63 @@
+// report.h - summarizing how fragmented a file is
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_REPORT_H_
+#define HAVE_EXTENTS_FIEMAP_REPORT_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+enum report_constants {
+    k_histogram_min_shift = 12, // the first bucket is for extents < 8 KiB
+    k_histogram_buckets = 19,   // the last bucket is for extents >= 1 GiB
+
+    // The most an ext4 extent can hold. No file can have fewer extents than
+    // its size divided by this, rounded up, so that is taken as ideal. Some
+    // filesystems allow longer extents, so this is conservative.
+    k_ideal_extent_size = 128 * 1024 * 1024
+};
+
+// Statistics about extents, accumulated a page at a time so that memory use
+// doesn't grow with the number of extents.
+struct frag_report {
+    __u64 count;
+    __u64 bytes;
+    __u64 histogram[k_histogram_buckets]; // extent counts, by size
+    __u64 discontinuities; // extents not starting where the one before ended
+    __u64 total_seek;      // sum of distances from each extent to the next
+    __u64 max_seek;        // greatest such distance
+    bool have_previous;
+    __u64 previous_end;    // where on disk the previous extent ended
+    __u64 holes;           // gaps in the file before the extents after them
+    __u64 hole_bytes;
+    __u64 unwritten_bytes; // bytes in extents allocated but never written
+    __u64 logical_end;     // where in the file the previous extent ended
+};
+
+// Adds a page of extents to the statistics.
+ATTRIBUTE((nonnull))
+void add_to_report(struct frag_report *restrict rp,
+                   const struct fiemap *restrict fmp);
+
+// Shows the statistics on out.
+ATTRIBUTE((nonnull))
+void show_report(const struct frag_report *restrict rp, FILE *restrict out);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_REPORT_H_
@@ -0,0 +1,456 @@
+// revindex.c - reverse mapping index files (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "revindex.h"
+
+#include "constants.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const unsigned char k_index_magic[k_index_magic_size] = {
+    0x89, 'R', 'E', 'V', 'M', 'A', 'P', '\n'
+};
+
+// How many entries are encoded before they are written together.
+enum { k_entries_per_batch = 128 };
+
+void init_index_builder(struct index_builder *const ibp, const __u32 major,
+                        const __u32 minor, const __u32 flags,
+                        const __u64 device_start)
+{
+    assert(ibp);
+    assert((flags & ~(__u32)k_index_known_flags) == 0u);
+
+    *ibp = (struct index_builder){
+        .header = {
+            .major = major,
+            .minor = minor,
+            .flags = flags,
+            .device_start = device_start
+        }
+    };
+}
+
+__u32 add_index_path(struct index_builder *restrict const ibp,
+                     const char *restrict const path)
+{
+    assert(ibp);
+    assert(path);
+
+    const __u64 count = ibp->header.path_count;
+    if (count == UINT32_MAX) die("too many files to index");
+
+    if (count == ibp->path_capacity) {
+        ibp->path_capacity = (ibp->path_capacity ? ibp->path_capacity * 2u
+                                                 : 64u);
+        ibp->path_offsets = xreallocarray(ibp->path_offsets,
+                                          ibp->path_capacity,
+                                          sizeof ibp->path_offsets[0]);
+    }
+
+    const size_t len = strlen(path) + 1u;
+    if (len > SIZE_MAX / 2u - ibp->paths_size) die("out of memory");
+
+    if (ibp->paths_size + len > ibp->paths_capacity) {
+        size_t capacity = (ibp->paths_capacity ? ibp->paths_capacity : 4096u);
+        while (capacity < ibp->paths_size + len) capacity *= 2u;
+
+        ibp->paths = xreallocarray(ibp->paths, capacity, 1u);
+        ibp->paths_capacity = capacity;
+    }
+
+    memcpy(ibp->paths + ibp->paths_size, path, len);
+    ibp->path_offsets[count] = ibp->paths_size;
+    ibp->paths_size += len;
+
+    ++ibp->header.path_count;
+    return (__u32)count;
+}
+
+// Adds, but gives ULLONG_MAX instead of wrapping around.
+ATTRIBUTE((const))
+static __u64 saturating_add(const __u64 first, const __u64 second)
+{
+    return second > ULLONG_MAX - first ? ULLONG_MAX : first + second;
+}
+
+void add_index_extents(struct index_builder *restrict const ibp,
+                       const __u32 path,
+                       const struct fiemap_extent *restrict const extents,
+                       const __u32 count)
+{
+    assert(ibp);
+    assert(extents);
+    assert(path < ibp->header.path_count);
+
+    for (__u32 i = 0u; i < count; ++i) {
+        const struct fiemap_extent *const fep = &extents[i];
+        if ((fep->fe_flags & FIEMAP_EXTENT_UNKNOWN) || fep->fe_length == 0u)
+            continue;
+
+        const size_t next = (size_t)ibp->header.entry_count;
+        if (next == ibp->capacity) {
+            ibp->capacity = (ibp->capacity ? ibp->capacity * 2u : 1024u);
+            ibp->entries = xreallocarray(ibp->entries, ibp->capacity,
+                                         sizeof ibp->entries[0]);
+        }
+
+        ibp->entries[next] = (struct index_entry){
+            .physical = saturating_add(fep->fe_physical,
+                                       ibp->header.device_start),
+            .length = fep->fe_length,
+            .logical = fep->fe_logical,
+            .path = path,
+            .flags = fep->fe_flags
+        };
+
+        ++ibp->header.entry_count;
+    }
+}
+
+// Compares entries by physical offset, then by path and logical offset, so
+// the index doesn't depend on the order files were found in.
+ATTRIBUTE((nonnull, pure))
+static int compare_entries(const void *const first, const void *const second)
+{
+    const struct index_entry *const lhs = first, *const rhs = second;
+
+    if (lhs->physical != rhs->physical)
+        return lhs->physical < rhs->physical ? -1 : 1;
+    if (lhs->path != rhs->path)
+        return lhs->path < rhs->path ? -1 : 1;
+    if (lhs->logical != rhs->logical)
+        return lhs->logical < rhs->logical ? -1 : 1;
+    return 0;
+}
+
+ATTRIBUTE((nonnull))
+static void write_bytes(FILE *restrict const fp,
+                        const void *restrict const bytes, const size_t len)
+{
+    assert(fp);
+    assert(bytes);
+
+    if (fwrite(bytes, 1u, len, fp) != len)
+        die("can't write index: %s", strerror(errno));
+}
+
+ATTRIBUTE((nonnull))
+static void write_index_header(FILE *restrict const fp,
+                               const struct index_header *restrict const hp)
+{
+    assert(fp);
+    assert(hp);
+
+    unsigned char bytes[k_index_header_size] = { 0 };
+
+    memcpy(bytes, k_index_magic, k_index_magic_size);
+    put_le32(bytes + 8, k_index_version);
+    put_le32(bytes + 12, k_index_entry_size);
+    put_le32(bytes + 16, hp->major);
+    put_le32(bytes + 20, hp->minor);
+    put_le32(bytes + 24, k_sector_size);
+    put_le32(bytes + 28, hp->flags);
+    put_le64(bytes + 32, hp->device_start);
+    put_le64(bytes + 40, hp->entry_count);
+    put_le64(bytes + 48, hp->path_count);
+    put_le64(bytes + 56, hp->paths_offset);
+
+    write_bytes(fp, bytes, sizeof bytes);
+}
+
+ATTRIBUTE((nonnull))
+static void encode_index_entry(unsigned char *restrict const bytes,
+                               const struct index_entry *restrict const iep)
+{
+    assert(bytes);
+    assert(iep);
+
+    put_le64(bytes, iep->physical);
+    put_le64(bytes + 8, iep->length);
+    put_le64(bytes + 16, iep->logical);
+    put_le64(bytes + 24, iep->reach);
+    put_le32(bytes + 32, iep->path);
+    put_le32(bytes + 36, iep->flags);
+}
+
+// Writes the entries, filling in their reach fields first.
+ATTRIBUTE((nonnull))
+static void write_index_entries(FILE *restrict const fp,
+                                struct index_entry *restrict const entries,
+                                const size_t count)
+{
+    assert(fp);
+    assert(entries || count == 0u);
+
+    unsigned char batch[k_entries_per_batch * k_index_entry_size];
+    __u64 reach = 0u;
+
+    for (size_t i = 0u; i < count; ) {
+        size_t len = 0u;
+
+        for (; i < count && len != sizeof batch;
+                ++i, len += k_index_entry_size) {
+            const __u64 end = saturating_add(entries[i].physical,
+                                             entries[i].length);
+            if (reach < end) reach = end;
+
+            entries[i].reach = reach;
+            encode_index_entry(batch + len, &entries[i]);
+        }
+
+        write_bytes(fp, batch, len);
+    }
+}
+
+void write_index(struct index_builder *restrict const ibp,
+                 FILE *restrict const fp)
+{
+    assert(ibp);
+    assert(fp);
+
+    struct index_header *const hp = &ibp->header;
+    const size_t count = (size_t)hp->entry_count;
+
+    if (count != 0u)
+        qsort(ibp->entries, count, sizeof ibp->entries[0], compare_entries);
+
+    hp->paths_offset = k_index_header_size + hp->entry_count
+                                             * k_index_entry_size;
+    const __u64 strings_offset = hp->paths_offset + hp->path_count * 8u;
+
+    write_index_header(fp, hp);
+    if (count != 0u) write_index_entries(fp, ibp->entries, count);
+
+    for (__u64 i = 0u; i < hp->path_count; ++i) {
+        unsigned char bytes[8];
+        put_le64(bytes, strings_offset + ibp->path_offsets[i]);
+        write_bytes(fp, bytes, sizeof bytes);
+    }
+
+    if (ibp->paths_size != 0u) write_bytes(fp, ibp->paths, ibp->paths_size);
+    if (fflush(fp) != 0) die("can't write index: %s", strerror(errno));
+}
+
+void destroy_index_builder(struct index_builder *const ibp)
+{
+    assert(ibp);
+
+    free(ibp->paths);
+    free(ibp->path_offsets);
+    free(ibp->entries);
+    *ibp = (struct index_builder){ 0 };
+}
+
+// Decodes and checks the header, and checks that the entries and path table
+// it describes lie within the index.
+ATTRIBUTE((nonnull))
+static void check_index(struct index_map *restrict const imp,
+                        const char *restrict const path)
+{
+    assert(imp);
+    assert(path);
+
+    const unsigned char *const bytes = imp->base;
+
+    if (memcmp(bytes, k_index_magic, k_index_magic_size) != 0)
+        die("%s: not an index", path);
+    if (get_le32(bytes + 8) != k_index_version)
+        die("%s: index has unsupported version %u", path,
+                get_le32(bytes + 8));
+    if (get_le32(bytes + 12) != k_index_entry_size)
+        die("%s: index has wrong entry size %u", path, get_le32(bytes + 12));
+    if (get_le32(bytes + 24) != k_sector_size)
+        die("%s: index has unsupported sector size %u", path,
+                get_le32(bytes + 24));
+    if ((get_le32(bytes + 28) & ~(__u32)k_index_known_flags) != 0u)
+        die("%s: index has unsupported flags 0x%x", path,
+                get_le32(bytes + 28));
+
+    imp->header = (struct index_header){
+        .major = get_le32(bytes + 16),
+        .minor = get_le32(bytes + 20),
+        .flags = get_le32(bytes + 28),
+        .device_start = get_le64(bytes + 32),
+        .entry_count = get_le64(bytes + 40),
+        .path_count = get_le64(bytes + 48),
+        .paths_offset = get_le64(bytes + 56)
+    };
+
+    const struct index_header *const hp = &imp->header;
+    const __u64 size = imp->size;
+
+    if (hp->entry_count > (size - k_index_header_size) / k_index_entry_size
+            || hp->paths_offset != k_index_header_size
+                                   + hp->entry_count * k_index_entry_size
+            || hp->path_count > (size - hp->paths_offset) / 8u
+            || hp->path_count > UINT32_MAX)
+        die("%s: index is truncated or malformed", path);
+}
+
+void open_index(struct index_map *restrict const imp,
+                const char *restrict const path)
+{
+    assert(imp);
+    assert(path);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) die("%s: %s", path, strerror(errno));
+
+    struct stat st = { 0 };
+    if (fstat(fd, &st) != 0) die("%s: %s", path, strerror(errno));
+    if (st.st_size < k_index_header_size || (__u64)st.st_size > SIZE_MAX)
+        die("%s: not an index", path);
+
+    void *const base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                            fd, 0);
+    if (base == MAP_FAILED) die("%s: %s", path, strerror(errno));
+    if (close(fd) != 0) die("%s: %s", path, strerror(errno));
+
+    *imp = (struct index_map){ .base = base, .size = (size_t)st.st_size };
+    check_index(imp, path);
+}
+
+void get_index_entry(const struct index_map *restrict const imp,
+                     const __u64 i, struct index_entry *restrict const iep)
+{
+    assert(imp);
+    assert(iep);
+    assert(i < imp->header.entry_count);
+
+    const unsigned char *const bytes =
+            imp->base + k_index_header_size + (size_t)i * k_index_entry_size;
+
+    *iep = (struct index_entry){
+        .physical = get_le64(bytes),
+        .length = get_le64(bytes + 8),
+        .logical = get_le64(bytes + 16),
+        .reach = get_le64(bytes + 24),
+        .path = get_le32(bytes + 32),
+        .flags = get_le32(bytes + 36)
+    };
+}
+
+const char *get_index_path(const struct index_map *const imp, const __u32 i)
+{
+    assert(imp);
+
+    const struct index_header *const hp = &imp->header;
+    if (i >= hp->path_count) die("index refers to nonexistent path %u", i);
+
+    const __u64 start = get_le64(imp->base + hp->paths_offset + i * 8uLL);
+    if (start < hp->paths_offset + hp->path_count * 8u || start >= imp->size
+            || !memchr(imp->base + start, '\0', imp->size - (size_t)start))
+        die("index has malformed path %u", i);
+
+    return (const char *)imp->base + start;
+}
+
+__u64 find_index_entry(const struct index_map *const imp, const __u64 offset)
+{
+    assert(imp);
+
+    __u64 low = 0u, high = imp->header.entry_count;
+
+    while (low != high) {
+        const __u64 mid = low + (high - low) / 2u;
+        const unsigned char *const bytes = imp->base + k_index_header_size
+                                           + (size_t)mid * k_index_entry_size;
+
+        if (get_le64(bytes + 24) > offset)
+            high = mid;
+        else
+            low = mid + 1u;
+    }
+
+    return low;
+}
+
+// Gets where an entry's extent ends on the disk.
+ATTRIBUTE((nonnull, pure))
+static __u64 get_entry_end(const struct index_entry *const iep)
+{
+    assert(iep);
+    return saturating_add(iep->physical, iep->length);
+}
+
+void sweep_index(const struct index_map *const imp,
+                 overlap_visitor *const visitor, void *const context)
+{
+    assert(imp);
+    assert(visitor);
+
+    const __u64 total = imp->header.entry_count;
+    struct index_entry *active = NULL; // extents covering pos
+    size_t count = 0u, capacity = 0u;
+
+    __u64 i = 0u, pos = 0u;
+    struct index_entry next = { 0 };
+    if (total != 0u) get_index_entry(imp, 0u, &next);
+
+    while (i < total || count != 0u) {
+        if (count == 0u) pos = next.physical;
+
+        // Take in the extents that start here.
+        for (; i < total && next.physical <= pos; ) {
+            if (next.physical < pos) die("index entries are out of order");
+
+            if (count == capacity) {
+                capacity = (capacity ? capacity * 2u : 16u);
+                active = xreallocarray(active, capacity, sizeof active[0]);
+            }
+            active[count++] = next;
+
+            if (++i < total) get_index_entry(imp, i, &next);
+        }
+
+        __u64 end = (i < total ? next.physical : ULLONG_MAX);
+        for (size_t j = 0u; j < count; ++j) {
+            const __u64 entry_end = get_entry_end(&active[j]);
+            if (entry_end < end) end = entry_end;
+        }
+
+        if (end > pos) visitor(pos, end - pos, active, count, context);
+
+        // Let go of the extents that end here, keeping the rest in order.
+        size_t kept = 0u;
+        for (size_t j = 0u; j < count; ++j)
+            if (get_entry_end(&active[j]) > end) active[kept++] = active[j];
+        count = kept;
+
+        pos = end;
+    }
+
+    free(active);
+}
+
+void close_index(struct index_map *const imp)
+{
+    assert(imp);
+
+    if (munmap((void *)imp->base, imp->size) != 0)
+        die("can't unmap index: %s", strerror(errno));
+
+    *imp = (struct index_map){ 0 };
+}
@@ -0,0 +1,189 @@
+// revindex.h - reverse mapping index files
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// An index maps places on a disk back to the files whose extents are there.
+// It is a header, then one entry per extent, sorted by where the extent
+// starts on the disk, then a table of paths. All integers are little-endian,
+// and all offsets and lengths are in bytes. Entries have a fixed size, so the
+// index can be mapped into memory and binary searched without being parsed.
+//
+// Header (k_index_header_size bytes):
+//
+//    0  magic          k_index_magic (8 bytes)
+//    8  version        u32, k_index_version
+//   12  entry size     u32, k_index_entry_size
+//   16  major          u32, major device number of the volume
+//   20  minor          u32, minor device number of the volume
+//   24  sector size    u32, k_sector_size
+//   28  flags          u32, k_index_flag_* bits
+//   32  device start   u64, where the volume starts on its disk, or zero if
+//                      k_index_flag_unknown_device is set
+//   40  entry count    u64
+//   48  path count     u64
+//   56  paths offset   u64, where the path table starts in the index
+//
+// Entry (k_index_entry_size bytes), one per extent, starting right after the
+// header, in ascending order of physical offset:
+//
+//    0  physical       u64, where the extent starts on the disk (that is,
+//                      fe_physical plus the device start)
+//    8  length         u64, never zero
+//   16  logical        u64, where the extent starts in its file
+//   24  reach          u64, the greatest physical end of this or any earlier
+//                      entry, so entries overlapping a range can be found by
+//                      binary search even if extents are shared
+//   32  path           u32, which path in the path table
+//   36  flags          u32, fe_flags
+//
+// Path table, at the paths offset: a u64 for each path, giving the offset in
+// the index at which it starts, then the paths, each ending in a null byte.
+
+#ifndef HAVE_EXTENTS_FIEMAP_REVINDEX_H_
+#define HAVE_EXTENTS_FIEMAP_REVINDEX_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+enum revindex_constants {
+    k_index_version = 1,
+    k_index_header_size = 64,
+    k_index_entry_size = 40,
+    k_index_magic_size = 8
+};
+
+// The first bytes of every index.
+extern const unsigned char k_index_magic[k_index_magic_size];
+
+// Flags in the header.
+enum index_flags {
+    // The volume's device number isn't a block device sysfs knows of, as on
+    // btrfs, so where it starts on a disk is unknown. Physical offsets are
+    // the filesystem's own, with nothing added to them.
+    k_index_flag_unknown_device = 1u << 0,
+
+    k_index_known_flags = k_index_flag_unknown_device
+};
+
+// The information in the header, decoded.
+struct index_header {
+    __u32 major;
+    __u32 minor;
+    __u32 flags;
+    __u64 device_start;
+    __u64 entry_count;
+    __u64 path_count;
+    __u64 paths_offset;
+};
+
+// An entry, decoded.
+struct index_entry {
+    __u64 physical;
+    __u64 length;
+    __u64 logical;
+    __u64 reach;
+    __u32 path;
+    __u32 flags;
+};
+
+// An index being built, held in memory until it is written.
+struct index_builder {
+    struct index_header header;
+    struct index_entry *entries;
+    size_t capacity;
+    __u64 *path_offsets; // where each path starts in paths
+    size_t path_capacity;
+    char *paths;
+    size_t paths_size;
+    size_t paths_capacity;
+};
+
+// An index that has been mapped into memory and checked.
+struct index_map {
+    const unsigned char *base;
+    size_t size;
+    struct index_header header;
+};
+
+// Prepares to build an index for the volume with the given device number,
+// which starts device_start bytes into its disk, with the given header flags.
+ATTRIBUTE((nonnull))
+void init_index_builder(struct index_builder *ibp, __u32 major, __u32 minor,
+                        __u32 flags, __u64 device_start);
+
+// Adds a path, returning the number that entries for it should refer to.
+ATTRIBUTE((nonnull))
+__u32 add_index_path(struct index_builder *restrict ibp,
+                     const char *restrict path);
+
+// Adds an entry for each of count extents of a file. Extents whose physical
+// location is unknown are left out.
+ATTRIBUTE((nonnull))
+void add_index_extents(struct index_builder *restrict ibp, __u32 path,
+                       const struct fiemap_extent *restrict extents,
+                       __u32 count);
+
+// Sorts the entries and writes the index to fp, then flushes it. Quits on
+// failure.
+ATTRIBUTE((nonnull))
+void write_index(struct index_builder *restrict ibp, FILE *restrict fp);
+
+// Frees the memory the builder holds.
+ATTRIBUTE((nonnull))
+void destroy_index_builder(struct index_builder *ibp);
+
+// Maps the index at path into memory and checks its header and layout. Quits
+// if it can't be opened or isn't a well-formed index.
+ATTRIBUTE((nonnull))
+void open_index(struct index_map *restrict imp, const char *restrict path);
+
+// Decodes entry number i, which must be less than the entry count.
+ATTRIBUTE((nonnull))
+void get_index_entry(const struct index_map *restrict imp, __u64 i,
+                     struct index_entry *restrict iep);
+
+// Gets path number i. Quits if it is out of range or malformed.
+ATTRIBUTE((nonnull, returns_nonnull))
+const char *get_index_path(const struct index_map *imp, __u32 i);
+
+// Finds the first entry that could overlap bytes at or after offset on the
+// disk, by binary search. Every entry before it ends at or before offset.
+// Returns the entry count if there is none.
+ATTRIBUTE((nonnull))
+__u64 find_index_entry(const struct index_map *imp, __u64 offset);
+
+// Called for each stretch of the disk over which the same indexed extents
+// overlap, with those extents, in the order of the index.
+typedef void overlap_visitor(__u64 physical, __u64 length,
+                             const struct index_entry *entries, size_t count,
+                             void *context);
+
+// Visits every stretch of the disk that indexed extents cover, in ascending
+// order, in one pass over the index. A stretch ends wherever an extent starts
+// or ends, so extents shared by several files, in whole or in part, are found
+// together. Stretches no extent covers are skipped.
+ATTRIBUTE((nonnull(1, 2)))
+void sweep_index(const struct index_map *imp, overlap_visitor *visitor,
+                 void *context);
+
+// Unmaps the index.
+ATTRIBUTE((nonnull))
+void close_index(struct index_map *imp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_REVINDEX_H_
@@ -0,0 +1,225 @@
+// revmap-conf.c - command-line parsing for revmap (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "revmap-conf.h"
+
+#include "cache.h"
+#include "util.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef NO_LONGOPTS
+#include <getopt.h>
+#endif
+
+enum compile_time_longopts_configuration {
+#ifdef NO_LONGOPTS
+    k_accept_longopts = 0
+#else
+    k_accept_longopts = 1
+#endif
+};
+
+// Prints brief version information and exits indicating success.
+static noreturn void show_version_and_quit(void)
+{
+    puts("revmap, v0.1 (alpha)");
+    exit(EXIT_SUCCESS);
+}
+
+// Prints a help message and exits indicating success.
+static noreturn void show_help_and_quit(void)
+{
+    puts("Usage:\n");
+
+    printf("  %s [-c CACHE [-C LIMIT]] -b INDEX PATH\n", progname());
+    printf("  %s -b INDEX -e IMAGE\n", progname());
+    printf("  %s INDEX SECTOR\n", progname());
+    printf("  %s INDEX FIRST END\n", progname());
+    printf("  %s { -s | -p } INDEX\n", progname());
+    printf("  %s { -V | -h }\n\n", progname());
+
+    puts("The first form indexes every regular file at or under PATH on the"
+            " same\nfilesystem, writing an index of where their extents are on"
+            " the disk to INDEX.\nIf the filesystem's device number isn't a"
+            " block device sysfs knows of, as on\nbtrfs, the offsets are the"
+            " filesystem's own instead, and INDEX records that.\n");
+
+    puts("The second form indexes every regular file in the unmounted ext4"
+            " filesystem\nIMAGE, on a device or in a file, by reading the"
+            " filesystem's own structures:\nits inode tables in large"
+            " sequential chunks, and each file's extent tree.\n");
+
+    puts("The other forms search INDEX for the extents that hold SECTOR, or"
+            " that overlap\nsectors FIRST up to but not including END. Sectors"
+            " are 512 bytes and are\ncounted from the start of the disk, as in"
+            " kernel I/O error messages, not from\nthe start of the"
+            " partition. Each extent found is shown as the offset in its"
+            "\nfile, in bytes, where the overlap begins; how many bytes"
+            " overlap; and the\nfile's path.\n");
+
+    puts("With -s, INDEX is searched for stretches of the disk that more than"
+            " one extent\nholds, as when files share extents through reflinks"
+            " or snapshots. With -p, a\nplan to read every stretch that holds"
+            " data just once is shown instead. Either\nway, each stretch is"
+            " shown as a line with its offset on the disk and its\nlength, in"
+            " bytes, and how many extents hold it, followed by a line for"
+            " each\nextent, indented, with the offset in its file and the"
+            " file's path. Unwritten\nextents are left out, since their data"
+            " are zeros.\n");
+
+    if (k_accept_longopts == (0)) {
+        puts("The -b option builds INDEX.");
+        puts("The -c option specifies CACHE.");
+        puts("The -C option specifies LIMIT.");
+        puts("The -e option specifies IMAGE.");
+        puts("The -s option shows shared stretches of the disk.");
+        puts("The -p option shows a plan to read each stretch once.");
+        puts("The -V option prints brief version information.");
+        puts("The -h option prints this help message.");
+    } else {
+        puts("The -b (--build) option builds INDEX.");
+        puts("The -c (--cache) option specifies CACHE.");
+        puts("The -C (--cache-limit) option specifies LIMIT.");
+        puts("The -e (--ext4) option specifies IMAGE.");
+        puts("The -s (--shared) option shows shared stretches of the disk.");
+        puts("The -p (--plan) option shows a plan to read each stretch"
+                " once.");
+        puts("The -V (--version) option prints brief version information.");
+        puts("The -h (--help) option prints this help message.");
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+// Short options this program accepts, in the getopt() shortopts notation.
+static const char *const k_shortopts = ":b:c:C:e:spVh";
+
+#ifdef NO_LONGOPTS
+// Processes short options.
+#define GETOPT(ac, av) (getopt(ac, av, k_shortopts))
+#else
+static const struct option k_longopts[] = {
+    { "build", required_argument, NULL, 'b' },
+    { "cache", required_argument, NULL, 'c' },
+    { "cache-limit", required_argument, NULL, 'C' },
+    { "ext4", required_argument, NULL, 'e' },
+    { "shared", no_argument, NULL, 's' },
+    { "plan", no_argument, NULL, 'p' },
+    { "version", no_argument, NULL, 'V' },
+    { "help", no_argument, NULL, 'h' },
+    { 0 }
+};
+
+// Processes short and long options.
+#define GETOPT(ac, av) (getopt_long(ac, av, k_shortopts, k_longopts, NULL))
+#endif
+
+// Prints an error about an unrecognized command-line option flag, and quits.
+static noreturn void die_unrecognized_option(char *const *const argv)
+{
+    if (optopt)
+        die("unrecognized option: -%c", optopt);
+    else if (k_accept_longopts != (0))
+        die("unrecognized option: %s", argv[optind - 1]);
+    else
+        die(BUG("unrecognized option diagnostic failed"));
+}
+
+// Process a single command-line option, including its operand(s) if any.
+static void process_option(char *const *restrict const argv, const int opt,
+                           struct revmap_conf *restrict const cp)
+{
+    switch (opt) {
+    case 'b':
+        if (optarg[0] == '\0') die("index path is empty");
+        cp->build_path = optarg;
+        break;
+
+    case 'c':
+        if (optarg[0] == '\0') die("cache path is empty");
+        cp->cache_path = optarg;
+        break;
+
+    case 'C':
+        cp->cache_limit = (size_t)parse_number(optarg, SIZE_MAX, true);
+        break;
+
+    case 'e':
+        if (optarg[0] == '\0') die("image path is empty");
+        cp->ext4_image = optarg;
+        break;
+
+    case 's':
+        cp->sweep = k_sweep_shared;
+        break;
+
+    case 'p':
+        cp->sweep = k_sweep_plan;
+        break;
+
+    case 'V':
+        show_version_and_quit();
+
+    case 'h':
+        show_help_and_quit();
+
+    case ':':
+        die("missing operand for -%c option", optopt);
+
+    case '?':
+        die_unrecognized_option(argv);
+
+    default:
+        die(BUG("getopt() returned %d '%c'"), opt, opt);
+    }
+}
+
+int get_revmap_configuration(int argc, char **restrict const argv,
+                             struct revmap_conf *restrict const cp)
+{
+    assert(argc > 0);
+    assert(argv);
+    assert(cp);
+
+    set_progname(argv[0]);
+
+    *cp = (struct revmap_conf){
+        .build_path = NULL,
+        .cache_path = NULL,
+        .cache_limit = k_default_cache_limit,
+        .ext4_image = NULL,
+        .sweep = k_sweep_none
+    };
+
+    opterr = false;
+    for (int opt = 0; (opt = GETOPT(argc, argv)) != -1; )
+        process_option(argv, opt, cp);
+
+    if (cp->cache_path && !cp->build_path)
+        die("a cache is only used when building an index");
+    if (cp->ext4_image && !cp->build_path)
+        die("an ext4 image is only read when building an index");
+    if (cp->ext4_image && cp->cache_path)
+        die("a cache isn't used when reading an ext4 image");
+    if (cp->sweep != k_sweep_none && cp->build_path)
+        die("-s and -p are for searching an index, not building one");
+
+    return optind - 1;
+}
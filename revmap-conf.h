@@ -0,0 +1,48 @@
+// revmap-conf.h - command-line parsing for revmap
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_REVMAP_CONF_H_
+#define HAVE_EXTENTS_FIEMAP_REVMAP_CONF_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stddef.h>
+
+// What revmap shows about how indexed extents overlap on the disk, if not
+// answering a query about sectors.
+enum sweep_output {
+    k_sweep_none,   // answer a query about sectors instead
+    k_sweep_shared, // each stretch of the disk more than one extent holds
+    k_sweep_plan    // a plan to read each stretch that holds data just once
+};
+
+// User-provided configuration for revmap.
+struct revmap_conf {
+    const char *build_path; // where to write a new index, or NULL to query
+    const char *cache_path; // where extents are cached between builds, if any
+    size_t cache_limit;     // the most bytes the cache may take
+    const char *ext4_image; // an ext4 filesystem to index offline, if any
+    enum sweep_output sweep;
+};
+
+// Parses options and their operands out of command-line arguments using
+// getopt(). Doesn't process non-option arguments. Returns an index to the
+// first non-option argument or, if there are no such arguments, argc.
+ATTRIBUTE((nonnull))
+int get_revmap_configuration(int argc, char **restrict argv,
+                             struct revmap_conf *restrict cp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_REVMAP_CONF_H_
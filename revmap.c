@@ -0,0 +1,601 @@
+// revmap.c - Finds which files own given sectors, using an index of extents.
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "cache.h"
+#include "coalesce.h"
+#include "constants.h"
+#include "device.h"
+#include "ext4.h"
+#include "pager.h"
+#include "revindex.h"
+#include "revmap-conf.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// The most directories nftw() keeps open at once.
+enum { k_walk_fd_limit = 64 };
+
+// State for building an index. nftw() has no way to pass it to the callback.
+static struct {
+    struct index_builder builder;
+    dev_t dev;                     // the filesystem being indexed
+    unsigned long long skipped;    // files that couldn't be indexed
+    struct extent_cache *cachep;   // extents from earlier builds, or NULL
+    struct fiemap_extent *extents; // a file's extents, to be cached
+    size_t extent_count;
+    size_t extent_capacity;
+} g_walk;
+
+// Adds a file's path and extents to the index. The path is only added if the
+// file has extents.
+ATTRIBUTE((nonnull))
+static void add_file(const char *restrict const path,
+                     const struct fiemap_extent *restrict extents,
+                     size_t count)
+{
+    assert(path);
+    assert(extents);
+
+    if (count == 0u) return;
+
+    const __u32 path_number = add_index_path(&g_walk.builder, path);
+
+    for (__u32 part = 0u; count != 0u; count -= part, extents += part) {
+        part = (count < k_extents_per_page ? (__u32)count
+                                           : k_extents_per_page);
+        add_index_extents(&g_walk.builder, path_number, extents, part);
+    }
+}
+
+// Holds on to a page of a file's extents, so they can be cached.
+ATTRIBUTE((nonnull))
+static void keep_extents(const struct fiemap *const fmp)
+{
+    assert(fmp);
+
+    const size_t count = g_walk.extent_count + fmp->fm_mapped_extents;
+
+    if (count > g_walk.extent_capacity) {
+        g_walk.extent_capacity = count * 2u;
+        g_walk.extents = xreallocarray(g_walk.extents, g_walk.extent_capacity,
+                                       sizeof g_walk.extents[0]);
+    }
+
+    memcpy(g_walk.extents + g_walk.extent_count, fmp->fm_extents,
+           sizeof fmp->fm_extents[0] * fmp->fm_mapped_extents);
+    g_walk.extent_count = count;
+}
+
+// Adds a file's extents to the index, merging those that continue each other.
+// If there is a cache, they are taken from it when the file is unchanged, and
+// otherwise cached. Returns false, with errno set, if the file can't be
+// opened or FIEMAP doesn't work on it.
+ATTRIBUTE((nonnull))
+static bool index_file(const char *restrict const path,
+                       const struct stat *restrict const stp)
+{
+    assert(path);
+    assert(stp);
+
+    if (g_walk.cachep) {
+        size_t count = 0u;
+        const struct fiemap_extent *const extents =
+                find_cached_extents(g_walk.cachep, stp, &count);
+
+        if (extents) {
+            add_file(path, extents, count);
+            return true;
+        }
+    }
+
+    const int fd = open(path, O_RDONLY | O_NOCTTY | O_NOFOLLOW);
+    if (fd < 0) return false;
+
+    if (!can_map_extents(fd)) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+
+    struct extent_pager pager = { 0 };
+    init_extent_pager(&pager, fd);
+    struct extent_coalescer coalescer = { 0 };
+    init_extent_coalescer(&coalescer, &pager, true);
+
+    bool have_path = false;
+    __u32 path_number = 0u;
+    g_walk.extent_count = 0u;
+
+    for (const struct fiemap *fmp = NULL;
+            (fmp = next_coalesced_page(&coalescer)); ) {
+        if (!have_path) {
+            path_number = add_index_path(&g_walk.builder, path);
+            have_path = true;
+        }
+
+        add_index_extents(&g_walk.builder, path_number, fmp->fm_extents,
+                          fmp->fm_mapped_extents);
+        if (g_walk.cachep) keep_extents(fmp);
+    }
+
+    destroy_extent_coalescer(&coalescer);
+    destroy_extent_pager(&pager);
+    if (close(fd) != 0) die("%s: %s", path, strerror(errno));
+
+    if (g_walk.cachep)
+        cache_extents(g_walk.cachep, stp, g_walk.extents, g_walk.extent_count);
+    return true;
+}
+
+// Called by nftw() for each file found. Indexes regular files on the
+// filesystem being indexed, and reports files that can't be examined.
+static int visit(const char *const path, const struct stat *const stp,
+                 const int type, struct FTW *const ftwp)
+{
+    (void)ftwp;
+
+    switch (type) {
+    case FTW_F:
+        if (!S_ISREG(stp->st_mode) || stp->st_dev != g_walk.dev) break;
+        if (index_file(path, stp)) break;
+
+        msg("skipping %s: %s", path, strerror(errno));
+        ++g_walk.skipped;
+        break;
+
+    case FTW_DNR:
+    case FTW_NS:
+        msg("skipping %s: can't %s it", path,
+                (type == FTW_DNR ? "read" : "stat"));
+        ++g_walk.skipped;
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+// Writes the index to conf->build_path. It is written under another name and
+// renamed, so that queries running while it is rebuilt see either the old
+// index or the new one.
+ATTRIBUTE((nonnull))
+static void save_index(const struct revmap_conf *const cp)
+{
+    assert(cp);
+    assert(cp->build_path);
+
+    const char *const index_path = cp->build_path;
+
+    static const char suffix[] = ".part";
+    char *const partial_path = xcalloc(strlen(index_path) + sizeof suffix, 1u);
+    strcat(strcpy(partial_path, index_path), suffix);
+
+    FILE *const fp = fopen(partial_path, "wb");
+    if (!fp) die("%s: %s", partial_path, strerror(errno));
+    write_index(&g_walk.builder, fp);
+    if (fclose(fp) != 0) die("%s: %s", partial_path, strerror(errno));
+
+    if (rename(partial_path, index_path) != 0)
+        die("can't rename %s to %s: %s",
+                partial_path, index_path, strerror(errno));
+
+    msg("Indexed %llu extents of %llu files (%llu skipped).",
+            g_walk.builder.header.entry_count,
+            g_walk.builder.header.path_count, g_walk.skipped);
+
+    free(partial_path);
+}
+
+// Indexes the files at or under root, writing the index to conf->build_path.
+ATTRIBUTE((nonnull))
+static void build_index(const struct revmap_conf *restrict const cp,
+                        const char *restrict const root)
+{
+    assert(cp);
+    assert(cp->build_path);
+    assert(root);
+
+    struct stat st = { 0 };
+    if (stat(root, &st) != 0) die("%s: %s", root, strerror(errno));
+
+    // On btrfs, for example, the device number is an anonymous one, not a
+    // real device, so the offsets are left as the filesystem reports them.
+    const bool known = is_known_device(st.st_dev);
+    if (!known) {
+        msg("%s is on device %u:%u, which sysfs doesn't know, so offsets are"
+                " the filesystem's own.", root, major(st.st_dev),
+                minor(st.st_dev));
+    }
+
+    g_walk.dev = st.st_dev;
+    init_index_builder(&g_walk.builder, major(st.st_dev), minor(st.st_dev),
+                       (known ? 0u : k_index_flag_unknown_device),
+                       (known ? get_offset(st.st_dev) : 0u));
+
+    struct extent_cache cache = { 0 };
+    if (cp->cache_path) {
+        load_extent_cache(&cache, cp->cache_path, cp->cache_limit);
+        g_walk.cachep = &cache;
+    }
+
+    if (nftw(root, visit, k_walk_fd_limit, FTW_PHYS | FTW_MOUNT) != 0)
+        die("%s: %s", root, strerror(errno));
+
+    save_index(cp);
+
+    if (cp->cache_path) {
+        save_extent_cache(&cache, cp->cache_path);
+        msg("Cache: %llu hits, %llu misses, %llu evicted.",
+                cache.hits, cache.misses, cache.evicted);
+        destroy_extent_cache(&cache);
+        g_walk.cachep = NULL;
+    }
+
+    free(g_walk.extents);
+    destroy_index_builder(&g_walk.builder);
+}
+
+// The paths of the regular files in an ext4 filesystem, found by walking its
+// directory tree, so they can be looked up by inode number while the inode
+// tables are read in order. A file's paths are chained together, one per hard
+// link.
+struct ext4_names {
+    size_t *first;  // for each inode, 1 + its first link's number, or 0
+    size_t *next;   // for each link, 1 + the next link's number, or 0
+    size_t *starts; // for each link, where its path starts in text
+    size_t count;
+    size_t capacity;
+    char *text;
+    size_t text_size;
+    size_t text_capacity;
+};
+
+// Records a path for a regular file found while walking the tree.
+static void name_file(const char *const path, const __u32 ino,
+                      void *const context)
+{
+    struct ext4_names *const np = context;
+
+    if (np->count == np->capacity) {
+        np->capacity = (np->capacity ? np->capacity * 2u : 1024u);
+        np->next = xreallocarray(np->next, np->capacity, sizeof np->next[0]);
+        np->starts = xreallocarray(np->starts, np->capacity,
+                                   sizeof np->starts[0]);
+    }
+
+    const size_t size = strlen(path) + 1u;
+
+    if (size > np->text_capacity - np->text_size) {
+        while (size > np->text_capacity - np->text_size)
+            np->text_capacity = (np->text_capacity ? np->text_capacity * 2u
+                                                   : 64u * 1024u);
+        np->text = xreallocarray(np->text, np->text_capacity, 1u);
+    }
+
+    memcpy(np->text + np->text_size, path, size);
+    np->starts[np->count] = np->text_size;
+    np->text_size += size;
+
+    np->next[np->count] = np->first[ino];
+    np->first[ino] = ++np->count;
+}
+
+// State for indexing an ext4 filesystem's inodes.
+struct ext4_scan {
+    const struct ext4_fs *fsp;
+    const struct ext4_names *names;
+    struct extent_list list; // the current file's extents
+};
+
+// Adds a regular file's extents to the index, once for each of its paths.
+static void index_inode(const struct ext4_inode *const ip,
+                        void *const context)
+{
+    struct ext4_scan *const esp = context;
+    const struct ext4_names *const np = esp->names;
+
+    if (!S_ISREG(ip->mode) || ip->ino > esp->fsp->inode_count
+            || np->first[ip->ino] == 0u)
+        return;
+
+    if (!can_map_ext4_inode(ip)) {
+        msg("skipping %s: %s", np->text + np->starts[np->first[ip->ino] - 1u],
+                strerror(errno));
+        ++g_walk.skipped;
+        return;
+    }
+
+    get_ext4_extents(esp->fsp, ip, &esp->list);
+
+    for (size_t link = np->first[ip->ino]; link != 0u;
+            link = np->next[link - 1u]) {
+        struct extent_pager pager = { 0 };
+        init_listed_pager(&pager, esp->list.extents, esp->list.count);
+        struct extent_coalescer coalescer = { 0 };
+        init_extent_coalescer(&coalescer, &pager, true);
+
+        bool have_path = false;
+        __u32 path_number = 0u;
+
+        for (const struct fiemap *fmp = NULL;
+                (fmp = next_coalesced_page(&coalescer)); ) {
+            if (!have_path) {
+                path_number = add_index_path(&g_walk.builder,
+                                             np->text + np->starts[link - 1u]);
+                have_path = true;
+            }
+
+            add_index_extents(&g_walk.builder, path_number, fmp->fm_extents,
+                              fmp->fm_mapped_extents);
+        }
+
+        destroy_extent_coalescer(&coalescer);
+        destroy_extent_pager(&pager);
+    }
+}
+
+// Indexes the regular files in the ext4 filesystem at conf->ext4_image,
+// without mounting it, writing the index to conf->build_path. The directory
+// tree is walked first, for paths, then the inode tables are read in order.
+ATTRIBUTE((nonnull))
+static void build_index_from_ext4(const struct revmap_conf *const cp)
+{
+    assert(cp);
+    assert(cp->build_path);
+    assert(cp->ext4_image);
+
+    struct ext4_fs fs = { 0 };
+    open_ext4(&fs, cp->ext4_image);
+
+    const bool is_device = major(fs.dev) != 0u || minor(fs.dev) != 0u;
+    init_index_builder(&g_walk.builder, major(fs.dev), minor(fs.dev), 0u,
+                       (is_device ? get_offset(fs.dev) : 0u));
+
+    struct ext4_names names = {
+        .first = xcalloc((size_t)fs.inode_count + 1u, sizeof names.first[0])
+    };
+    walk_ext4_tree(&fs, name_file, &names);
+
+    struct ext4_scan scan = { .fsp = &fs, .names = &names };
+    scan_ext4_inodes(&fs, index_inode, &scan);
+
+    save_index(cp);
+
+    destroy_extent_list(&scan.list);
+    free(names.text);
+    free(names.starts);
+    free(names.next);
+    free(names.first);
+    close_ext4(&fs);
+    destroy_index_builder(&g_walk.builder);
+}
+
+// Parses a sector number, which may be zero, but which must be small enough
+// that the sector after it can be given in bytes. Quits on failure.
+ATTRIBUTE((nonnull))
+static __u64 parse_sector(const char *const text)
+{
+    assert(text);
+
+    __u64 value = 0uLL;
+    const char *p = text;
+
+    for (; '0' <= *p && *p <= '9'; ++p) {
+        const unsigned digit = (unsigned)(*p - '0');
+        if (value > (ULLONG_MAX / k_sector_size - 1u - digit) / 10u)
+            die("%s is too big", text);
+        value = value * 10u + digit;
+    }
+
+    if (p == text || *p != '\0') die("%s is not a sector number", text);
+    return value;
+}
+
+// Shows the part of each indexed extent that overlaps bytes [start, end) on
+// the disk. Returns how many extents overlap.
+ATTRIBUTE((nonnull))
+static __u64 show_owners(const struct index_map *const imp, const __u64 start,
+                         const __u64 end)
+{
+    assert(imp);
+    assert(start < end);
+
+    __u64 found = 0u;
+
+    for (__u64 i = find_index_entry(imp, start);
+            i < imp->header.entry_count; ++i) {
+        struct index_entry entry = { 0 };
+        get_index_entry(imp, i, &entry);
+        if (entry.physical >= end) break;
+
+        const __u64 entry_end = (entry.length > ULLONG_MAX - entry.physical
+                                    ? ULLONG_MAX
+                                    : entry.physical + entry.length);
+        if (entry_end <= start) continue;
+
+        const __u64 from = (start > entry.physical ? start : entry.physical);
+        const __u64 to = (end < entry_end ? end : entry_end);
+
+        printf("%llu %llu %s\n", entry.logical + (from - entry.physical),
+                to - from, get_index_path(imp, entry.path));
+        ++found;
+    }
+
+    return found;
+}
+
+// Opens an index to search, noting if its offsets aren't from a disk's start.
+ATTRIBUTE((nonnull))
+static void open_index_to_search(struct index_map *restrict const imp,
+                                 const char *restrict const index_path)
+{
+    assert(imp);
+    assert(index_path);
+
+    open_index(imp, index_path);
+
+    if (imp->header.flags & k_index_flag_unknown_device) {
+        msg("%s: device %u:%u wasn't known, so sectors are the filesystem's"
+                " own.", index_path, imp->header.major, imp->header.minor);
+    }
+}
+
+// Searches the index for extents overlapping sectors [first, end).
+ATTRIBUTE((nonnull))
+static bool query_index(const char *const index_path, const __u64 first,
+                        const __u64 end)
+{
+    assert(index_path);
+
+    if (first >= end) die("the range of sectors is empty");
+
+    struct index_map map = { 0 };
+    open_index_to_search(&map, index_path);
+
+    const bool found = show_owners(&map, first * k_sector_size,
+                                   end * k_sector_size) != 0u;
+
+    close_index(&map);
+    return found;
+}
+
+// State for showing stretches of the disk that extents overlap on.
+struct sweep {
+    const struct index_map *imp;
+    size_t min_count;   // how many written extents must hold a stretch
+    __u64 stretches;    // how many were shown
+    __u64 disk_bytes;   // their total length
+    __u64 file_bytes;   // their total length in all the files that hold them
+};
+
+// Shows a stretch of the disk, if enough written extents hold it, and the
+// offset in each file at which it is held.
+static void show_stretch(const __u64 physical, const __u64 length,
+                         const struct index_entry *const entries,
+                         const size_t count, void *const context)
+{
+    struct sweep *const swp = context;
+
+    size_t written = 0u;
+    for (size_t i = 0u; i < count; ++i)
+        if (!(entries[i].flags & FIEMAP_EXTENT_UNWRITTEN)) ++written;
+
+    if (written < swp->min_count) return;
+
+    printf("%llu %llu %zu\n", physical, length, written);
+
+    for (size_t i = 0u; i < count; ++i) {
+        if (entries[i].flags & FIEMAP_EXTENT_UNWRITTEN) continue;
+
+        printf("  %llu %s\n", entries[i].logical
+                                + (physical - entries[i].physical),
+                get_index_path(swp->imp, entries[i].path));
+    }
+
+    ++swp->stretches;
+    swp->disk_bytes += length;
+    swp->file_bytes += length * written;
+}
+
+// Shows shared stretches of the disk, or a plan to read every stretch that
+// holds data once, as configured. Returns false if there were none to show.
+ATTRIBUTE((nonnull))
+static bool sweep(const char *restrict const index_path,
+                  const struct revmap_conf *restrict const cp)
+{
+    assert(index_path);
+    assert(cp);
+    assert(cp->sweep != k_sweep_none);
+
+    struct index_map map = { 0 };
+    open_index_to_search(&map, index_path);
+
+    struct sweep sw = {
+        .imp = &map,
+        .min_count = (cp->sweep == k_sweep_shared ? 2u : 1u)
+    };
+    sweep_index(&map, show_stretch, &sw);
+
+    if (cp->sweep == k_sweep_shared) {
+        msg("%llu stretches, %llu bytes of the disk, are shared, holding %llu"
+                " bytes of files.", sw.stretches, sw.disk_bytes,
+                sw.file_bytes);
+    } else {
+        msg("The plan reads %llu bytes, in %llu stretches, for %llu bytes of"
+                " files.", sw.disk_bytes, sw.stretches, sw.file_bytes);
+    }
+
+    close_index(&map);
+    return sw.stretches != 0u;
+}
+
+int main(int argc, char **argv)
+{
+    struct revmap_conf conf = { 0 };
+    const int arg_delta = get_revmap_configuration(argc, argv, &conf);
+    argc -= arg_delta;
+    argv += arg_delta;
+
+    if (conf.ext4_image) {
+        if (argc > 1) die("too many arguments");
+
+        build_index_from_ext4(&conf);
+        return EXIT_SUCCESS;
+    }
+
+    if (conf.build_path) {
+        if (argc < 2) die("too few arguments");
+        if (argc > 2) die("too many arguments");
+
+        build_index(&conf, argv[1]);
+        return EXIT_SUCCESS;
+    }
+
+    if (conf.sweep != k_sweep_none) {
+        if (argc < 2) die("too few arguments");
+        if (argc > 2) die("too many arguments");
+
+        return sweep(argv[1], &conf) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc < 3) die("too few arguments");
+    if (argc > 4) die("too many arguments");
+
+    const __u64 first = parse_sector(argv[2]);
+    const __u64 end = (argc == 4 ? parse_sector(argv[3]) : first + 1u);
+
+    if (query_index(argv[1], first, end)) return EXIT_SUCCESS;
+
+    msg("No indexed file has data there.");
+    return EXIT_FAILURE;
+}
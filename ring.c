@@ -0,0 +1,218 @@
+// ring.c - minimal io_uring interface via raw system calls (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// For more information about io_uring, see:
+//
+//  - https://kernel.dk/io_uring.pdf - the design, and how to use the rings
+//  - https://github.com/torvalds/linux/blob/master/include/uapi/linux/io_uring.h
+
+#include "ring.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+ATTRIBUTE((nonnull))
+static int io_uring_setup(const unsigned entries,
+                          struct io_uring_params *const paramsp)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, paramsp);
+}
+
+static int io_uring_enter(const int fd, const unsigned to_submit,
+                          const unsigned min_complete, const unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+// Maps part of an io_uring instance's memory. Returns MAP_FAILED on failure.
+static void *map_ring(const int fd, const size_t size, const off_t offset)
+{
+    return mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+// Finds a field at an offset the kernel gave, in mapped ring memory.
+ATTRIBUTE((nonnull, returns_nonnull))
+static void *at(void *const map, const __u32 offset)
+{
+    assert(map);
+    return (char *)map + offset;
+}
+
+// Maps the queues. Returns false, with errno set, on failure.
+ATTRIBUTE((nonnull))
+static bool map_queues(struct ring *restrict const rp,
+                       const struct io_uring_params *restrict const paramsp)
+{
+    assert(rp);
+    assert(paramsp);
+
+    rp->sq_map_size = paramsp->sq_off.array
+                        + paramsp->sq_entries * sizeof(__u32);
+    rp->cq_map_size = paramsp->cq_off.cqes
+                        + paramsp->cq_entries * sizeof(struct io_uring_cqe);
+    rp->sqes_map_size = paramsp->sq_entries * sizeof(struct io_uring_sqe);
+
+    const bool single_map = paramsp->features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map) {
+        if (rp->sq_map_size < rp->cq_map_size)
+            rp->sq_map_size = rp->cq_map_size;
+        rp->cq_map_size = rp->sq_map_size;
+    }
+
+    rp->sq_map = map_ring(rp->fd, rp->sq_map_size, IORING_OFF_SQ_RING);
+    if (rp->sq_map == MAP_FAILED) return false;
+
+    rp->cq_map = (single_map ? rp->sq_map
+                    : map_ring(rp->fd, rp->cq_map_size, IORING_OFF_CQ_RING));
+    if (rp->cq_map == MAP_FAILED) return false;
+
+    void *const sqes_map = map_ring(rp->fd, rp->sqes_map_size,
+                                    IORING_OFF_SQES);
+    if (sqes_map == MAP_FAILED) return false;
+    rp->sqes = sqes_map;
+
+    return true;
+}
+
+// Finds the queues' fields in the mapped memory. The SQ array is set to map
+// each index to the same SQE, so SQEs are used in order, as a ring.
+ATTRIBUTE((nonnull))
+static void locate_fields(struct ring *restrict const rp,
+                          const struct io_uring_params *restrict const paramsp)
+{
+    assert(rp);
+    assert(paramsp);
+
+    rp->sq_head = at(rp->sq_map, paramsp->sq_off.head);
+    rp->sq_ktail = at(rp->sq_map, paramsp->sq_off.tail);
+    rp->sq_mask = *(const unsigned *)at(rp->sq_map, paramsp->sq_off.ring_mask);
+    rp->sq_entries = paramsp->sq_entries;
+
+    __u32 *const array = at(rp->sq_map, paramsp->sq_off.array);
+    for (unsigned i = 0u; i < rp->sq_entries; ++i) array[i] = i;
+
+    rp->cq_head = at(rp->cq_map, paramsp->cq_off.head);
+    rp->cq_tail = at(rp->cq_map, paramsp->cq_off.tail);
+    rp->cq_mask = *(const unsigned *)at(rp->cq_map, paramsp->cq_off.ring_mask);
+    rp->cqes = at(rp->cq_map, paramsp->cq_off.cqes);
+
+    rp->sq_tail = atomic_load_explicit(rp->sq_ktail, memory_order_relaxed);
+    rp->unsubmitted = 0u;
+}
+
+bool open_ring(struct ring *const rp, const unsigned entries)
+{
+    assert(rp);
+    assert(entries != 0u);
+
+    *rp = (struct ring){ .fd = -1 };
+
+    struct io_uring_params params = { 0 };
+    rp->fd = io_uring_setup(entries, &params);
+    if (rp->fd < 0) return false;
+
+    if (!map_queues(rp, &params)) {
+        const int saved_errno = errno;
+        close_ring(rp);
+        errno = saved_errno;
+        return false;
+    }
+
+    locate_fields(rp, &params);
+    return true;
+}
+
+struct io_uring_sqe *get_sqe(struct ring *const rp)
+{
+    assert(rp);
+
+    const unsigned head =
+            atomic_load_explicit(rp->sq_head, memory_order_acquire);
+
+    if (rp->sq_tail - head >= rp->sq_entries) return NULL;
+
+    struct io_uring_sqe *const sqep = &rp->sqes[rp->sq_tail & rp->sq_mask];
+    memset(sqep, 0, sizeof *sqep);
+
+    ++rp->sq_tail;
+    ++rp->unsubmitted;
+    return sqep;
+}
+
+void enter_ring(struct ring *const rp, const unsigned min_complete)
+{
+    assert(rp);
+
+    atomic_store_explicit(rp->sq_ktail, rp->sq_tail, memory_order_release);
+
+    const __u64 start = start_timing();
+
+    for (;;) {
+        const int ret = io_uring_enter(rp->fd, rp->unsubmitted, min_complete,
+                                       IORING_ENTER_GETEVENTS);
+        if (ret >= 0) {
+            assert((unsigned)ret <= rp->unsubmitted);
+            rp->unsubmitted -= (unsigned)ret;
+            if (rp->unsubmitted == 0u || min_complete != 0u) break;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            die("can't submit I/O requests: %s", strerror(errno));
+        }
+    }
+
+    stop_timing(k_phase_io, start);
+}
+
+const struct io_uring_cqe *peek_cqe(const struct ring *const rp)
+{
+    assert(rp);
+
+    const unsigned head =
+            atomic_load_explicit(rp->cq_head, memory_order_relaxed);
+    const unsigned tail =
+            atomic_load_explicit(rp->cq_tail, memory_order_acquire);
+
+    return (head == tail ? NULL : &rp->cqes[head & rp->cq_mask]);
+}
+
+void consume_cqe(struct ring *const rp)
+{
+    assert(rp);
+
+    const unsigned head =
+            atomic_load_explicit(rp->cq_head, memory_order_relaxed);
+    atomic_store_explicit(rp->cq_head, head + 1u, memory_order_release);
+}
+
+void close_ring(struct ring *const rp)
+{
+    assert(rp);
+
+    if (rp->sqes) munmap(rp->sqes, rp->sqes_map_size);
+    if (rp->cq_map && rp->cq_map != MAP_FAILED && rp->cq_map != rp->sq_map)
+        munmap(rp->cq_map, rp->cq_map_size);
+    if (rp->sq_map && rp->sq_map != MAP_FAILED)
+        munmap(rp->sq_map, rp->sq_map_size);
+    if (rp->fd >= 0) close(rp->fd);
+
+    *rp = (struct ring){ .fd = -1 };
+}
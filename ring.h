@@ -0,0 +1,78 @@
+// ring.h - minimal io_uring interface via raw system calls
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_RING_H_
+#define HAVE_EXTENTS_FIEMAP_RING_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// An io_uring instance with its submission and completion queues mapped.
+struct ring {
+    int fd;
+    unsigned sq_tail;    // our copy of the SQ tail, ahead by unsubmitted SQEs
+    unsigned unsubmitted;
+
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_ktail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_map_size;
+};
+
+// Sets up an io_uring instance with room for at least entries submissions.
+// Returns false, with errno set, if io_uring is not available.
+ATTRIBUTE((nonnull))
+bool open_ring(struct ring *rp, unsigned entries);
+
+// Gets a zeroed submission queue entry to fill in, or a null pointer if the
+// submission queue is full. It is submitted by the next call to enter_ring().
+ATTRIBUTE((nonnull))
+struct io_uring_sqe *get_sqe(struct ring *rp);
+
+// Submits any new entries and waits until at least min_complete completions
+// are available. Quits on failure.
+ATTRIBUTE((nonnull))
+void enter_ring(struct ring *rp, unsigned min_complete);
+
+// Gets the oldest unconsumed completion, or a null pointer if there is none.
+ATTRIBUTE((nonnull))
+const struct io_uring_cqe *peek_cqe(const struct ring *rp);
+
+// Marks the completion most recently returned by peek_cqe() as consumed.
+ATTRIBUTE((nonnull))
+void consume_cqe(struct ring *rp);
+
+// Unmaps the queues and closes the io_uring instance.
+ATTRIBUTE((nonnull))
+void close_ring(struct ring *rp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_RING_H_
@@ -0,0 +1,489 @@
+// scan.c - walking trees of files with a pool of threads (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "scan.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+enum scan_internal_constants {
+    k_flush_size = 64 * 1024, // a thread's output is written once this big
+    k_min_deque_capacity = 64
+};
+
+// What is known about a path waiting to be visited.
+enum item_kind {
+    k_item_root,      // named by the user, so symbolic links are followed
+    k_item_unknown,   // found in a directory that didn't say its type
+    k_item_directory,
+    k_item_file
+};
+
+struct scan_item {
+    char *path;
+    enum item_kind kind;
+};
+
+// A thread's work. The owner pushes and pops at the back; thieves take from
+// the front. It's a ring buffer, guarded by its own lock, so a thief only
+// contends with the owner and other thieves of the same deque.
+struct deque {
+    pthread_mutex_t lock;
+    struct scan_item *items;
+    size_t front;
+    size_t count;
+    size_t capacity;
+};
+
+// State shared by all threads.
+struct scan {
+    struct deque *deques;
+    unsigned jobs;
+    atomic_size_t pending; // items not yet finished, plus 1 while seeding
+    atomic_size_t queued;  // items in deques, waiting to be taken
+    atomic_uint sleepers;  // threads waiting for work
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_ready;
+    pthread_mutex_t output_lock;
+    scan_visitor *visit;
+    void *context;
+};
+
+// A thread, and the buffer its output collects in.
+struct worker {
+    struct scan *sp;
+    unsigned index;
+    pthread_t thread;
+    FILE *out;
+    char *buf;
+    size_t size;
+};
+
+ATTRIBUTE((nonnull))
+static void lock(pthread_mutex_t *const mutexp)
+{
+    if (pthread_mutex_lock(mutexp) != 0) die(BUG("can't lock mutex"));
+}
+
+ATTRIBUTE((nonnull))
+static void unlock(pthread_mutex_t *const mutexp)
+{
+    if (pthread_mutex_unlock(mutexp) != 0) die(BUG("can't unlock mutex"));
+}
+
+// Doubles a deque's capacity, moving its items to the start of the new ring.
+ATTRIBUTE((nonnull))
+static void grow_deque(struct deque *const dqp)
+{
+    assert(dqp);
+
+    const size_t capacity = (dqp->capacity ? dqp->capacity * 2u
+                                           : k_min_deque_capacity);
+    struct scan_item *const items = xcalloc(capacity, sizeof items[0]);
+
+    for (size_t i = 0u; i < dqp->count; ++i)
+        items[i] = dqp->items[(dqp->front + i) % dqp->capacity];
+
+    free(dqp->items);
+    dqp->items = items;
+    dqp->front = 0u;
+    dqp->capacity = capacity;
+}
+
+// Adds an item to the back of thread index's deque, waking a thread that is
+// waiting for work, if any.
+ATTRIBUTE((nonnull))
+static void push_item(struct scan *const sp, const unsigned index,
+                      char *const path, const enum item_kind kind)
+{
+    assert(sp);
+    assert(index < sp->jobs);
+    assert(path);
+
+    struct deque *const dqp = &sp->deques[index];
+    atomic_fetch_add(&sp->pending, 1u);
+
+    lock(&dqp->lock);
+    if (dqp->count == dqp->capacity) grow_deque(dqp);
+    dqp->items[(dqp->front + dqp->count++) % dqp->capacity] =
+            (struct scan_item){ .path = path, .kind = kind };
+    unlock(&dqp->lock);
+
+    atomic_fetch_add(&sp->queued, 1u);
+
+    if (atomic_load(&sp->sleepers) != 0u) {
+        lock(&sp->idle_lock);
+        pthread_cond_signal(&sp->work_ready);
+        unlock(&sp->idle_lock);
+    }
+}
+
+// Takes an item from the back of a deque, if steal is false, or else from the
+// front. Returns false if the deque is empty.
+ATTRIBUTE((nonnull))
+static bool pop_item(struct deque *restrict const dqp,
+                     struct scan_item *restrict const itemp, const bool steal)
+{
+    assert(dqp);
+    assert(itemp);
+
+    lock(&dqp->lock);
+
+    const bool found = dqp->count != 0u;
+
+    if (found && steal) {
+        *itemp = dqp->items[dqp->front];
+        dqp->front = (dqp->front + 1u) % dqp->capacity;
+        --dqp->count;
+    } else if (found) {
+        *itemp = dqp->items[(dqp->front + --dqp->count) % dqp->capacity];
+    }
+
+    unlock(&dqp->lock);
+    return found;
+}
+
+// Takes the next item from the thread's own deque, or steals one from another
+// thread's. Returns false if none could be found.
+ATTRIBUTE((nonnull))
+static bool take_item(struct scan *restrict const sp, const unsigned index,
+                      struct scan_item *restrict const itemp)
+{
+    assert(sp);
+    assert(itemp);
+
+    for (unsigned i = 0u; i < sp->jobs; ++i) {
+        if (pop_item(&sp->deques[(index + i) % sp->jobs], itemp, i != 0u)) {
+            atomic_fetch_sub(&sp->queued, 1u);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Marks an item (or the seeding) finished. Once nothing is pending, wakes all
+// waiting threads so they can stop.
+ATTRIBUTE((nonnull))
+static void finish_item(struct scan *const sp)
+{
+    assert(sp);
+
+    if (atomic_fetch_sub(&sp->pending, 1u) != 1u) return;
+
+    lock(&sp->idle_lock);
+    pthread_cond_broadcast(&sp->work_ready);
+    unlock(&sp->idle_lock);
+}
+
+// Waits until there may be work to take. Returns false if there never will
+// be, because nothing is pending.
+ATTRIBUTE((nonnull))
+static bool wait_for_work(struct scan *const sp)
+{
+    assert(sp);
+
+    lock(&sp->idle_lock);
+    atomic_fetch_add(&sp->sleepers, 1u);
+
+    while (atomic_load(&sp->queued) == 0u && atomic_load(&sp->pending) != 0u)
+        pthread_cond_wait(&sp->work_ready, &sp->idle_lock);
+
+    atomic_fetch_sub(&sp->sleepers, 1u);
+    const bool more = atomic_load(&sp->pending) != 0u;
+    unlock(&sp->idle_lock);
+
+    return more;
+}
+
+// Starts a fresh output buffer for the thread.
+ATTRIBUTE((nonnull))
+static void open_output_buffer(struct worker *const wp)
+{
+    assert(wp);
+
+    wp->buf = NULL;
+    wp->size = 0u;
+    wp->out = open_memstream(&wp->buf, &wp->size);
+    if (!wp->out) die("can't buffer output: %s", strerror(errno));
+}
+
+// Writes what the thread's buffer holds to standard output, in one piece.
+ATTRIBUTE((nonnull))
+static void flush_output_buffer(struct worker *const wp)
+{
+    assert(wp);
+
+    if (fclose(wp->out) != 0) die("can't buffer output: %s", strerror(errno));
+
+    if (wp->size != 0u) {
+        lock(&wp->sp->output_lock);
+        write_fully(STDOUT_FILENO, wp->buf, wp->size);
+        unlock(&wp->sp->output_lock);
+    }
+
+    free(wp->buf);
+    wp->out = NULL;
+    wp->buf = NULL;
+    wp->size = 0u;
+}
+
+// Makes the path of a directory entry.
+ATTRIBUTE((nonnull, malloc, returns_nonnull))
+static char *join_path(const char *restrict const dir,
+                       const char *restrict const name)
+{
+    assert(dir);
+    assert(name);
+
+    const size_t dir_len = strlen(dir);
+    const bool slash = dir_len == 0u || dir[dir_len - 1u] != '/';
+    char *const path = xcalloc(dir_len + slash + strlen(name) + 1u, 1u);
+
+    strcpy(path, dir);
+    if (slash) path[dir_len] = '/';
+    strcpy(path + dir_len + slash, name);
+    return path;
+}
+
+// Queues the entries of a directory, on the thread's own deque.
+ATTRIBUTE((nonnull))
+static void read_directory(struct worker *restrict const wp,
+                           const char *restrict const path)
+{
+    assert(wp);
+    assert(path);
+
+    DIR *const dirp = opendir(path);
+    if (!dirp) {
+        msg("skipping %s: %s", path, strerror(errno));
+        return;
+    }
+
+    for (;;) {
+        errno = 0;
+        const struct dirent *const entp = readdir(dirp);
+        if (!entp) break;
+
+        const char *const name = entp->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        switch (entp->d_type) {
+        case DT_DIR:
+            push_item(wp->sp, wp->index, join_path(path, name),
+                      k_item_directory);
+            break;
+        case DT_REG:
+            push_item(wp->sp, wp->index, join_path(path, name), k_item_file);
+            break;
+        case DT_UNKNOWN:
+            push_item(wp->sp, wp->index, join_path(path, name),
+                      k_item_unknown);
+            break;
+        default:
+            break; // Symbolic links and special files are skipped.
+        }
+    }
+
+    if (errno != 0) msg("error reading %s: %s", path, strerror(errno));
+    closedir(dirp);
+}
+
+// Visits a regular file, flushing the thread's output if it has grown big.
+ATTRIBUTE((nonnull))
+static void visit_file(struct worker *restrict const wp,
+                       const char *restrict const path)
+{
+    assert(wp);
+    assert(path);
+
+    wp->sp->visit(path, wp->out, wp->sp->context);
+
+    if (fflush(wp->out) != 0) die("can't buffer output: %s", strerror(errno));
+
+    if (wp->size >= k_flush_size) {
+        flush_output_buffer(wp);
+        open_output_buffer(wp);
+    }
+}
+
+// Visits a file, or reads a directory, finding out which it is if need be.
+ATTRIBUTE((nonnull))
+static void process_item(struct worker *restrict const wp,
+                         const struct scan_item *restrict const itemp)
+{
+    assert(wp);
+    assert(itemp);
+
+    enum item_kind kind = itemp->kind;
+
+    if (kind == k_item_root || kind == k_item_unknown) {
+        struct stat st = { 0 };
+        const int ret = (kind == k_item_root ? stat(itemp->path, &st)
+                                             : lstat(itemp->path, &st));
+        if (ret != 0) {
+            msg("skipping %s: %s", itemp->path, strerror(errno));
+            return;
+        }
+
+        if (S_ISDIR(st.st_mode))
+            kind = k_item_directory;
+        else if (S_ISREG(st.st_mode))
+            kind = k_item_file;
+        else if (itemp->kind == k_item_root)
+            msg("skipping %s: not a regular file or directory", itemp->path);
+    }
+
+    if (kind == k_item_directory)
+        read_directory(wp, itemp->path);
+    else if (kind == k_item_file)
+        visit_file(wp, itemp->path);
+}
+
+// Processes items until none are pending. This is each thread's start
+// routine.
+static void *run_worker(void *const arg)
+{
+    struct worker *const wp = arg;
+    assert(wp);
+
+    open_output_buffer(wp);
+
+    for (;;) {
+        struct scan_item item = { 0 };
+
+        if (take_item(wp->sp, wp->index, &item)) {
+            process_item(wp, &item);
+            free(item.path);
+            finish_item(wp->sp);
+        } else if (!wait_for_work(wp->sp)) {
+            break;
+        }
+    }
+
+    flush_output_buffer(wp);
+    return NULL;
+}
+
+// Copies a path, so that the thread that visits it can free it.
+ATTRIBUTE((nonnull, malloc, returns_nonnull))
+static char *copy_path(const char *const path)
+{
+    assert(path);
+
+    char *const copy = xcalloc(strlen(path) + 1u, 1u);
+    return strcpy(copy, path);
+}
+
+// Deals out the roots, then the listed paths, to the threads in turn.
+ATTRIBUTE((nonnull(1, 2)))
+static void seed(struct scan *const sp, char *const *const roots,
+                 const size_t count, FILE *const list_fp)
+{
+    assert(sp);
+    assert(roots);
+
+    unsigned next = 0u;
+
+    for (size_t i = 0u; i < count; ++i) {
+        push_item(sp, next, copy_path(roots[i]), k_item_root);
+        next = (next + 1u) % sp->jobs;
+    }
+
+    if (!list_fp) return;
+
+    char *line = NULL;
+    size_t capacity = 0u;
+
+    for (ssize_t len = 0; (len = getline(&line, &capacity, list_fp)) > 0; ) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) continue;
+
+        push_item(sp, next, copy_path(line), k_item_root);
+        next = (next + 1u) % sp->jobs;
+    }
+
+    if (ferror(list_fp)) die("can't read path list: %s", strerror(errno));
+    free(line);
+}
+
+void scan_files(char *const *const roots, const size_t count,
+                FILE *const list_fp, const unsigned jobs,
+                scan_visitor *const visit, void *const context)
+{
+    assert(roots);
+    assert(jobs != 0u);
+    assert(visit);
+
+    struct scan scan = {
+        .deques = xcalloc(jobs, sizeof scan.deques[0]),
+        .jobs = jobs,
+        .visit = visit,
+        .context = context
+    };
+
+    atomic_init(&scan.pending, 1u); // until seeding is done
+    atomic_init(&scan.queued, 0u);
+    atomic_init(&scan.sleepers, 0u);
+
+    if (pthread_mutex_init(&scan.idle_lock, NULL) != 0
+            || pthread_mutex_init(&scan.output_lock, NULL) != 0
+            || pthread_cond_init(&scan.work_ready, NULL) != 0)
+        die("can't initialize thread synchronization");
+
+    for (unsigned i = 0u; i < jobs; ++i) {
+        if (pthread_mutex_init(&scan.deques[i].lock, NULL) != 0)
+            die("can't initialize mutex");
+    }
+
+    struct worker *const workers = xcalloc(jobs, sizeof workers[0]);
+
+    for (unsigned i = 0u; i < jobs; ++i) {
+        workers[i] = (struct worker){ .sp = &scan, .index = i };
+
+        const int err = pthread_create(&workers[i].thread, NULL, run_worker,
+                                       &workers[i]);
+        if (err != 0) die("can't create thread: %s", strerror(err));
+    }
+
+    seed(&scan, roots, count, list_fp);
+    finish_item(&scan);
+
+    for (unsigned i = 0u; i < jobs; ++i) {
+        const int err = pthread_join(workers[i].thread, NULL);
+        if (err != 0) die(BUG("can't join thread: %s"), strerror(err));
+    }
+
+    for (unsigned i = 0u; i < jobs; ++i) {
+        pthread_mutex_destroy(&scan.deques[i].lock);
+        free(scan.deques[i].items);
+    }
+
+    pthread_cond_destroy(&scan.work_ready);
+    pthread_mutex_destroy(&scan.output_lock);
+    pthread_mutex_destroy(&scan.idle_lock);
+    free(workers);
+    free(scan.deques);
+}
@@ -0,0 +1,53 @@
+// scan.h - walking trees of files with a pool of threads
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A scan visits every regular file at or under some paths. Each thread has a
+// deque of directories and files to visit. It takes work from the back of its
+// own deque, so it goes depth first through the directories it finds, and
+// when that is empty it steals from the front of another thread's, where the
+// biggest subtrees tend to be. Each thread writes what it has to say about a
+// file to its own buffer, which goes to standard output, in one piece, only
+// between files, so the output of different files is never interleaved.
+
+#ifndef HAVE_EXTENTS_FIEMAP_SCAN_H_
+#define HAVE_EXTENTS_FIEMAP_SCAN_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum scan_constants {
+    k_default_scan_jobs = 8,
+    k_max_scan_jobs = 1024
+};
+
+// Called, in any thread, for each regular file, with its path, a stream to
+// write what it has to say about the file, and the context. The stream is the
+// thread's own, so the visitor must not hold on to it.
+typedef void scan_visitor(const char *path, FILE *out, void *context);
+
+// Visits the regular files at or under each of the count paths in roots, and
+// those at or under each path listed, one per line, in list_fp, if it isn't
+// null. Symbolic links are followed only if they are named directly. Files
+// and directories that can't be examined are reported and skipped. Uses jobs
+// threads, and returns once every file has been visited and all output has
+// been written.
+ATTRIBUTE((nonnull(1, 5)))
+void scan_files(char *const *roots, size_t count, FILE *list_fp,
+                unsigned jobs, scan_visitor *visit, void *context);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_SCAN_H_
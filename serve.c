@@ -0,0 +1,947 @@
+// serve.c - answering extent queries on a Unix socket (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "serve.h"
+
+#include "cache.h"
+#include "constants.h"
+#include "device.h"
+#include "ext4.h"
+#include "pager.h"
+#include "record.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/types.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
+
+enum {
+    k_max_events = 256,          // events taken from epoll at once
+    k_max_fds_per_message = 253, // SCM_MAX_FD, the most the kernel sends
+    k_read_size = 65536,         // room made in a client's input to read into
+    k_initial_watch_buckets = 1024
+};
+
+// The inotify events that mean a file's extents may have changed.
+static const __u32 k_watch_mask = IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF;
+
+// What a descriptor in the epoll set is for.
+enum channel_kind {
+    k_channel_listener,
+    k_channel_watcher,
+    k_channel_signals,
+    k_channel_client
+};
+
+struct channel {
+    enum channel_kind kind;
+    int fd;
+};
+
+// A growable run of bytes, of which those before start have been used up.
+struct buffer {
+    unsigned char *bytes;
+    size_t start;
+    size_t size;
+    size_t capacity;
+};
+
+struct client {
+    struct channel channel; // first, so a pointer to it is one to the client
+    struct buffer in;
+    struct buffer out;
+    int *fds;        // descriptors received but not yet queried
+    size_t fd_start; // index of the first of them not yet used
+    size_t fd_count;
+    size_t fd_capacity;
+    bool writing;    // waiting for the socket to take more output
+    bool closing;    // the client is done sending, so close when output is
+    struct client *prev;
+    struct client *next;
+};
+
+// Which file an inotify watch is for.
+struct watch {
+    int wd;
+    __u64 dev;
+    __u64 ino;
+    struct watch *next;
+};
+
+struct server {
+    int epoll_fd;
+    struct channel listener;
+    struct channel watcher;
+    struct channel signals;
+    bool accepting;             // the listener is in the epoll set
+    struct extent_cache cache;
+    struct watch **watches;     // hash table of chains, keyed by wd
+    size_t watch_buckets;       // a power of two
+    size_t watch_count;
+    struct extent_list extents; // a file's extents, as they are retrieved
+    struct client *client_list; // every connected client
+    unsigned long long clients;
+    unsigned long long queries;
+};
+
+// Makes room for extra more bytes at the end of a buffer, first moving its
+// unused bytes to the beginning.
+ATTRIBUTE((nonnull))
+static void reserve_bytes(struct buffer *const bp, const size_t extra)
+{
+    assert(bp);
+
+    if (bp->start != 0u) {
+        memmove(bp->bytes, bp->bytes + bp->start, bp->size - bp->start);
+        bp->size -= bp->start;
+        bp->start = 0u;
+    }
+
+    if (extra <= bp->capacity - bp->size) return;
+    if (extra > SIZE_MAX / 2u - bp->size) die("out of memory");
+
+    size_t capacity = (bp->capacity ? bp->capacity : 4096u);
+    while (capacity - bp->size < extra) capacity *= 2u;
+
+    bp->bytes = xreallocarray(bp->bytes, capacity, 1u);
+    bp->capacity = capacity;
+}
+
+// Appends len zero bytes to a buffer. Returns a pointer to them, which is
+// valid until the buffer next grows.
+ATTRIBUTE((nonnull, returns_nonnull))
+static unsigned char *append_bytes(struct buffer *const bp, const size_t len)
+{
+    assert(bp);
+
+    if (len > bp->capacity - bp->size) reserve_bytes(bp, len);
+
+    unsigned char *const bytes = bp->bytes + bp->size;
+    memset(bytes, 0, len);
+    bp->size += len;
+    return bytes;
+}
+
+ATTRIBUTE((nonnull))
+static void destroy_buffer(struct buffer *const bp)
+{
+    assert(bp);
+
+    free(bp->bytes);
+    *bp = (struct buffer){ 0 };
+}
+
+// Hashes a watch descriptor to a bucket.
+ATTRIBUTE((nonnull, pure))
+static size_t watch_bucket(const struct server *const sp, const int wd)
+{
+    return (size_t)((unsigned)wd * 0x9E3779B9u) & (sp->watch_buckets - 1u);
+}
+
+// Finds the link that points to the watch with descriptor wd, or to null if
+// there is none.
+ATTRIBUTE((nonnull, returns_nonnull))
+static struct watch **find_watch(struct server *const sp, const int wd)
+{
+    assert(sp);
+
+    struct watch **linkp = &sp->watches[watch_bucket(sp, wd)];
+    while (*linkp && (*linkp)->wd != wd) linkp = &(*linkp)->next;
+    return linkp;
+}
+
+// Doubles the number of buckets in the watch table.
+ATTRIBUTE((nonnull))
+static void grow_watches(struct server *const sp)
+{
+    assert(sp);
+
+    struct watch **const old = sp->watches;
+    const size_t old_buckets = sp->watch_buckets;
+
+    sp->watch_buckets *= 2u;
+    sp->watches = xcalloc(sp->watch_buckets, sizeof sp->watches[0]);
+
+    for (size_t i = 0u; i < old_buckets; ++i) {
+        for (struct watch *wp = old[i], *next = NULL; wp; wp = next) {
+            next = wp->next;
+            struct watch **const headp =
+                    &sp->watches[watch_bucket(sp, wp->wd)];
+            wp->next = *headp;
+            *headp = wp;
+        }
+    }
+
+    free(old);
+}
+
+// Watches a file whose extents are about to be cached. If the watch can't be
+// added, as when there are too many, the file goes unwatched, and the cache
+// relies on its timestamps alone.
+ATTRIBUTE((nonnull))
+static void watch_file(struct server *restrict const sp,
+                       const char *restrict const path,
+                       const struct stat *restrict const stp)
+{
+    assert(sp);
+    assert(path);
+    assert(stp);
+
+    const int wd = inotify_add_watch(sp->watcher.fd, path,
+                                     k_watch_mask | IN_ONESHOT);
+    if (wd < 0) return;
+
+    struct watch **const linkp = find_watch(sp, wd);
+    if (!*linkp) {
+        *linkp = xcalloc(1u, sizeof **linkp);
+        (*linkp)->wd = wd;
+        if (++sp->watch_count > sp->watch_buckets * 2u) grow_watches(sp);
+    }
+
+    struct watch *const wp = *find_watch(sp, wd);
+    wp->dev = (__u64)stp->st_dev;
+    wp->ino = (__u64)stp->st_ino;
+}
+
+// Acts on an inotify event: drops the cached extents of a file that changed,
+// and forgets a watch the kernel removed.
+ATTRIBUTE((nonnull))
+static void handle_watch_event(struct server *restrict const sp,
+                               const struct inotify_event *restrict const ep)
+{
+    assert(sp);
+    assert(ep);
+
+    if (ep->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so nothing cached can be trusted.
+        destroy_extent_cache(&sp->cache);
+        return;
+    }
+
+    struct watch **const linkp = find_watch(sp, ep->wd);
+    struct watch *const wp = *linkp;
+    if (!wp) return;
+
+    if (ep->mask & k_watch_mask)
+        forget_cached_extents(&sp->cache, wp->dev, wp->ino);
+
+    if (ep->mask & IN_IGNORED) {
+        *linkp = wp->next;
+        free(wp);
+        --sp->watch_count;
+    }
+}
+
+// Handles all pending inotify events. This is done before each batch of
+// queries, so none is answered from an entry a change should have dropped.
+ATTRIBUTE((nonnull))
+static void drain_watcher(struct server *const sp)
+{
+    assert(sp);
+
+    enum { bufsz = 4096 };
+    union {
+        struct inotify_event event;
+        char bytes[bufsz];
+    } buf;
+
+    for (;;) {
+        const ssize_t len = read(sp->watcher.fd, buf.bytes, sizeof buf);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            die("can't read inotify events: %s", strerror(errno));
+        }
+
+        for (ssize_t pos = 0; pos < len; ) {
+            struct inotify_event event;
+            memcpy(&event, buf.bytes + pos, sizeof event);
+            handle_watch_event(sp, &event);
+            pos += (ssize_t)(sizeof event + event.len);
+        }
+    }
+}
+
+// Retrieves the extents of the open file fd into sp->extents. Returns false,
+// with errno set, if FIEMAP doesn't work on it.
+ATTRIBUTE((nonnull))
+static bool retrieve_extents(struct server *const sp, const int fd)
+{
+    assert(sp);
+
+    if (!can_map_extents(fd)) return false;
+
+    struct extent_list *const elp = &sp->extents;
+    elp->count = 0u;
+
+    struct extent_pager pager = { 0 };
+    init_extent_pager(&pager, fd);
+
+    for (const struct fiemap *fmp = NULL; (fmp = next_extent_page(&pager)); ) {
+        const size_t count = elp->count + fmp->fm_mapped_extents;
+
+        if (count > elp->capacity) {
+            elp->capacity = count * 2u;
+            elp->extents = xreallocarray(elp->extents, elp->capacity,
+                                         sizeof elp->extents[0]);
+        }
+
+        memcpy(elp->extents + elp->count, fmp->fm_extents,
+               sizeof fmp->fm_extents[0] * fmp->fm_mapped_extents);
+        elp->count = count;
+    }
+
+    destroy_extent_pager(&pager);
+    return true;
+}
+
+// Appends a result with its listing.
+ATTRIBUTE((nonnull(1, 2)))
+static void put_listing(struct buffer *restrict const out,
+                        const struct stat *restrict const stp,
+                        const struct fiemap_extent *restrict const extents,
+                        const size_t count)
+{
+    assert(out);
+    assert(stp);
+    assert(extents || count == 0u);
+
+    const __u64 device_start = get_offset(stp->st_dev);
+    const size_t listing_size =
+            k_record_header_size + (count + 1u) * k_record_size;
+
+    unsigned char *p = append_bytes(out, k_result_header_size + listing_size);
+    put_le64(p + 8, listing_size);
+    p += k_result_header_size;
+
+    encode_record_header(p, &(struct record_header){
+        .version = k_record_version,
+        .record_size = k_record_size,
+        .sector_size = k_sector_size,
+        .major = major(stp->st_dev),
+        .minor = minor(stp->st_dev),
+        .device_start = device_start,
+        .file_size = (__u64)stp->st_size
+    });
+    p += k_record_header_size;
+
+    for (size_t i = 0u; i < count; ++i, p += k_record_size) {
+        encode_extent_record(p, &(struct extent_record){
+            .logical = extents[i].fe_logical,
+            .physical = extents[i].fe_physical + device_start,
+            .length = extents[i].fe_length,
+            .flags = extents[i].fe_flags
+        });
+    }
+
+    encode_extent_record(p, &(struct extent_record){ .logical = count });
+}
+
+// Appends a result for a query that failed.
+ATTRIBUTE((nonnull))
+static void put_error(struct buffer *const out, const int error)
+{
+    assert(out);
+    assert(error > 0);
+
+    put_le32(append_bytes(out, k_result_header_size), (__u32)error);
+}
+
+// Answers a query about the open file fd, appending the result to out.
+ATTRIBUTE((nonnull))
+static void answer_open_query(struct server *restrict const sp, const int fd,
+                              struct buffer *restrict const out)
+{
+    assert(sp);
+    assert(fd >= 0);
+    assert(out);
+
+    struct stat st = { 0 };
+    if (fstat(fd, &st) != 0) {
+        put_error(out, errno);
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        put_error(out, (S_ISDIR(st.st_mode) ? EISDIR : EINVAL));
+        return;
+    }
+
+    size_t count = 0u;
+    const struct fiemap_extent *const cached =
+            find_cached_extents(&sp->cache, &st, &count);
+    if (cached) {
+        put_listing(out, &st, cached, count);
+        return;
+    }
+
+    // The watch goes on first, so a change made while FIEMAP runs is seen. It
+    // is placed through the descriptor, so it is on the file that was statted.
+    char fd_path[64] = {0};
+    snprintf(fd_path, sizeof fd_path, "/proc/self/fd/%d", fd);
+    watch_file(sp, fd_path, &st);
+
+    if (!retrieve_extents(sp, fd)) {
+        put_error(out, errno);
+    } else if (!is_known_device(st.st_dev)) {
+        put_error(out, ENODEV);
+    } else {
+        const struct extent_list *const elp = &sp->extents;
+        cache_extents(&sp->cache, &st, elp->extents, elp->count);
+        if (sp->cache.bytes > sp->cache.limit)
+            trim_extent_cache(&sp->cache, sp->cache.limit / 4u * 3u);
+        put_listing(out, &st, elp->extents, elp->count);
+    }
+}
+
+// Answers a query about the file at path, or, if path is null, the open file
+// fd, appending the result to out. A path is opened before anything is asked
+// about it, so everything in the answer is about the same file, even if the
+// path is pointed at another one meanwhile.
+ATTRIBUTE((nonnull(1, 4)))
+static void answer_query(struct server *restrict const sp,
+                         const char *restrict const path, const int fd,
+                         struct buffer *restrict const out)
+{
+    assert(sp);
+    assert(path || fd >= 0);
+    assert(out);
+
+    ++sp->queries;
+
+    if (!path) {
+        answer_open_query(sp, fd, out);
+        return;
+    }
+
+    const int file_fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK
+                                   | O_CLOEXEC);
+    if (file_fd < 0) {
+        put_error(out, errno);
+        return;
+    }
+
+    answer_open_query(sp, file_fd, out);
+    close(file_fd);
+}
+
+// Checks that a request's queries are well-formed, and that enough
+// descriptors have been received for those that need them.
+ATTRIBUTE((nonnull))
+static bool check_request(const struct client *restrict const clp,
+                          const unsigned char *restrict const body,
+                          const size_t len)
+{
+    assert(clp);
+    assert(body);
+
+    if (len < 4u) return false;
+
+    const __u32 count = get_le32(body);
+    size_t pos = 4u, fd_queries = 0u;
+
+    for (__u32 i = 0u; i < count; ++i) {
+        if (len - pos < 4u) return false;
+        const __u32 path_len = get_le32(body + pos);
+        pos += 4u;
+
+        if (path_len == 0u) ++fd_queries;
+        else if (path_len > len - pos) return false;
+        else pos += path_len;
+    }
+
+    return pos == len && fd_queries <= clp->fd_count - clp->fd_start;
+}
+
+// Answers each query in a request, which has been checked, appending the
+// reply to the client's output.
+ATTRIBUTE((nonnull))
+static void answer_request(struct server *restrict const sp,
+                           struct client *restrict const clp,
+                           const unsigned char *restrict const body)
+{
+    assert(sp);
+    assert(clp);
+    assert(body);
+
+    struct buffer *const out = &clp->out;
+    const __u32 count = get_le32(body);
+
+    const size_t reply_start = out->size - out->start;
+    put_le32(append_bytes(out, k_reply_header_size) + 8, count);
+
+    for (size_t i = 0u, pos = 4u; i < count; ++i) {
+        const __u32 path_len = get_le32(body + pos);
+        pos += 4u;
+
+        if (path_len == 0u) {
+            const int fd = clp->fds[clp->fd_start++];
+            answer_query(sp, NULL, fd, out);
+            close(fd);
+            continue;
+        }
+
+        const char *const name = (const char *)body + pos;
+        pos += path_len;
+
+        if (memchr(name, '\0', path_len)) {
+            put_error(out, EINVAL);
+        } else if (path_len >= PATH_MAX) {
+            put_error(out, ENAMETOOLONG);
+        } else {
+            char path[PATH_MAX];
+            memcpy(path, name, path_len);
+            path[path_len] = '\0';
+            answer_query(sp, path, -1, out);
+        }
+    }
+
+    const size_t reply_end = out->size - out->start;
+    put_le64(out->bytes + out->start + reply_start,
+             reply_end - reply_start - 8u);
+}
+
+// Changes which events epoll reports for a client.
+ATTRIBUTE((nonnull))
+static void set_writing(const struct server *restrict const sp,
+                        struct client *restrict const clp, const bool writing)
+{
+    assert(sp);
+    assert(clp);
+
+    if (clp->writing == writing) return;
+
+    struct epoll_event event = {
+        .events = (writing ? EPOLLOUT : EPOLLIN),
+        .data.ptr = &clp->channel
+    };
+    if (epoll_ctl(sp->epoll_fd, EPOLL_CTL_MOD, clp->channel.fd, &event) != 0)
+        die("can't change epoll events: %s", strerror(errno));
+
+    clp->writing = writing;
+}
+
+// Starts or stops accepting new clients.
+ATTRIBUTE((nonnull))
+static void set_accepting(struct server *const sp, const bool accepting)
+{
+    assert(sp);
+
+    if (sp->accepting == accepting) return;
+
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = &sp->listener
+    };
+    if (epoll_ctl(sp->epoll_fd, (accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL),
+                  sp->listener.fd, &event) != 0)
+        die("can't change epoll events: %s", strerror(errno));
+
+    sp->accepting = accepting;
+}
+
+ATTRIBUTE((nonnull))
+static void close_client(struct server *restrict const sp,
+                         struct client *restrict const clp)
+{
+    assert(sp);
+    assert(clp);
+
+    close(clp->channel.fd);
+    for (size_t i = clp->fd_start; i < clp->fd_count; ++i) close(clp->fds[i]);
+
+    if (clp->prev) clp->prev->next = clp->next;
+    else sp->client_list = clp->next;
+    if (clp->next) clp->next->prev = clp->prev;
+
+    free(clp->fds);
+    destroy_buffer(&clp->in);
+    destroy_buffer(&clp->out);
+    free(clp);
+
+    // A descriptor is free now, if running out is why accepting stopped.
+    set_accepting(sp, true);
+}
+
+// Sends as much of a client's output as the socket takes. Returns false if
+// the client was closed, because it's finished or the connection failed.
+ATTRIBUTE((nonnull))
+static bool flush_client(struct server *restrict const sp,
+                         struct client *restrict const clp)
+{
+    assert(sp);
+    assert(clp);
+
+    struct buffer *const out = &clp->out;
+
+    while (out->start != out->size) {
+        const ssize_t len = send(clp->channel.fd, out->bytes + out->start,
+                                 out->size - out->start, MSG_NOSIGNAL);
+        if (len >= 0) {
+            out->start += (size_t)len;
+        } else if (errno == EAGAIN) {
+            set_writing(sp, clp, true);
+            return true;
+        } else if (errno != EINTR) {
+            close_client(sp, clp);
+            return false;
+        }
+    }
+
+    out->start = out->size = 0u;
+
+    if (clp->closing) {
+        close_client(sp, clp);
+        return false;
+    }
+
+    set_writing(sp, clp, false);
+    return true;
+}
+
+// Keeps descriptors that arrived with a client's input, for fd queries.
+ATTRIBUTE((nonnull))
+static void keep_fds(struct client *restrict const clp,
+                     const struct msghdr *restrict const mhp)
+{
+    assert(clp);
+    assert(mhp);
+
+    for (struct cmsghdr *cmp = CMSG_FIRSTHDR(mhp); cmp;
+            cmp = CMSG_NXTHDR((struct msghdr *)mhp, cmp)) {
+        if (cmp->cmsg_level != SOL_SOCKET || cmp->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        const size_t count = (cmp->cmsg_len - CMSG_LEN(0u)) / sizeof(int);
+
+        if (clp->fd_start == clp->fd_count) clp->fd_start = clp->fd_count = 0u;
+        if (clp->fd_count + count > clp->fd_capacity) {
+            clp->fd_capacity = (clp->fd_count + count) * 2u;
+            clp->fds = xreallocarray(clp->fds, clp->fd_capacity,
+                                     sizeof clp->fds[0]);
+        }
+
+        memcpy(clp->fds + clp->fd_count, CMSG_DATA(cmp), count * sizeof(int));
+        clp->fd_count += count;
+    }
+}
+
+// Reads all a client has sent, with any descriptors. Returns false if the
+// connection failed or descriptors were lost.
+ATTRIBUTE((nonnull))
+static bool receive(struct client *const clp)
+{
+    assert(clp);
+
+    for (;;) {
+        struct buffer *const in = &clp->in;
+        reserve_bytes(in, k_read_size);
+
+        struct iovec iov = {
+            .iov_base = in->bytes + in->size,
+            .iov_len = in->capacity - in->size
+        };
+        union {
+            struct cmsghdr header;
+            char bytes[CMSG_SPACE(sizeof(int) * k_max_fds_per_message)];
+        } control;
+        struct msghdr mh = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.bytes,
+            .msg_controllen = sizeof control
+        };
+
+        const ssize_t len = recvmsg(clp->channel.fd, &mh, MSG_CMSG_CLOEXEC);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN;
+        }
+
+        keep_fds(clp, &mh);
+        if (mh.msg_flags & MSG_CTRUNC) return false;
+
+        if (len == 0) {
+            clp->closing = true;
+            return true;
+        }
+
+        in->size += (size_t)len;
+    }
+}
+
+// Reads and answers a client's complete requests, and sends what it can of
+// the replies.
+ATTRIBUTE((nonnull))
+static void serve_client(struct server *restrict const sp,
+                         struct client *restrict const clp)
+{
+    assert(sp);
+    assert(clp);
+
+    if (!receive(clp)) {
+        close_client(sp, clp);
+        return;
+    }
+
+    drain_watcher(sp);
+
+    struct buffer *const in = &clp->in;
+    while (in->size - in->start >= 4u) {
+        const unsigned char *const bytes = in->bytes + in->start;
+        const __u32 len = get_le32(bytes);
+
+        if (len > k_max_request_size
+                || (in->size - in->start - 4u >= len
+                    && !check_request(clp, bytes + 4, len))) {
+            close_client(sp, clp);
+            return;
+        }
+        if (in->size - in->start - 4u < len) break;
+
+        answer_request(sp, clp, bytes + 4);
+        in->start += 4u + len;
+    }
+
+    flush_client(sp, clp);
+}
+
+// Accepts every client waiting to connect.
+ATTRIBUTE((nonnull))
+static void accept_clients(struct server *const sp)
+{
+    assert(sp);
+
+    for (;;) {
+        const int fd = accept4(sp->listener.fd, NULL, NULL,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                msg("out of descriptors; not accepting clients for now");
+                set_accepting(sp, false);
+                return;
+            }
+            if (errno == EAGAIN) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            die("can't accept connection: %s", strerror(errno));
+        }
+
+        struct client *const clp = xcalloc(1u, sizeof *clp);
+        clp->channel = (struct channel){ .kind = k_channel_client, .fd = fd };
+
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = &clp->channel
+        };
+        if (epoll_ctl(sp->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            die("can't add client to epoll: %s", strerror(errno));
+
+        clp->next = sp->client_list;
+        if (clp->next) clp->next->prev = clp;
+        sp->client_list = clp;
+        ++sp->clients;
+    }
+}
+
+// Binds a socket to path, replacing a socket nothing is listening on.
+ATTRIBUTE((nonnull))
+static void bind_socket(const int fd, const char *const path)
+{
+    assert(path);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path)
+        die("%s: socket path is too long", path);
+    strcpy(addr.sun_path, path);
+
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof addr) == 0) return;
+    if (errno != EADDRINUSE) die("%s: %s", path, strerror(errno));
+
+    struct stat st = { 0 };
+    if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+        die("%s: already exists and isn't a socket", path);
+
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) die("can't create socket: %s", strerror(errno));
+    const bool live = connect(probe, (const struct sockaddr *)&addr,
+                              sizeof addr) == 0 || errno != ECONNREFUSED;
+    close(probe);
+    if (live) die("%s: another server is listening", path);
+
+    if (unlink(path) != 0) die("%s: %s", path, strerror(errno));
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof addr) != 0)
+        die("%s: %s", path, strerror(errno));
+}
+
+// Allows as many open descriptors as the hard limit does, since each client
+// takes one.
+static void raise_fd_limit(void)
+{
+    struct rlimit limit = { 0 };
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+// Adds a channel to the epoll set.
+ATTRIBUTE((nonnull))
+static void add_channel(const struct server *restrict const sp,
+                        struct channel *restrict const chp)
+{
+    assert(sp);
+    assert(chp);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = chp };
+    if (epoll_ctl(sp->epoll_fd, EPOLL_CTL_ADD, chp->fd, &event) != 0)
+        die("can't add to epoll: %s", strerror(errno));
+}
+
+// Sets up the listening socket, inotify, signal handling, and epoll.
+ATTRIBUTE((nonnull))
+static void start_server(struct server *restrict const sp,
+                         const char *restrict const path)
+{
+    assert(sp);
+    assert(path);
+
+    raise_fd_limit();
+
+    *sp = (struct server){
+        .listener = { .kind = k_channel_listener },
+        .watcher = { .kind = k_channel_watcher },
+        .signals = { .kind = k_channel_signals },
+        .watch_buckets = k_initial_watch_buckets
+    };
+    sp->watches = xcalloc(sp->watch_buckets, sizeof sp->watches[0]);
+    init_extent_cache(&sp->cache, k_default_cache_limit);
+
+    sp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sp->epoll_fd < 0) die("can't create epoll: %s", strerror(errno));
+
+    sp->watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (sp->watcher.fd < 0) die("can't start inotify: %s", strerror(errno));
+    add_channel(sp, &sp->watcher);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+        die("can't block signals: %s", strerror(errno));
+    sp->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sp->signals.fd < 0) die("can't create signalfd: %s", strerror(errno));
+    add_channel(sp, &sp->signals);
+
+    sp->listener.fd = socket(AF_UNIX,
+                             SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sp->listener.fd < 0) die("can't create socket: %s", strerror(errno));
+    bind_socket(sp->listener.fd, path);
+    if (listen(sp->listener.fd, SOMAXCONN) != 0)
+        die("%s: %s", path, strerror(errno));
+    set_accepting(sp, true);
+}
+
+// Closes every client and descriptor, and frees the memory the server holds.
+ATTRIBUTE((nonnull))
+static void stop_server(struct server *const sp)
+{
+    assert(sp);
+
+    while (sp->client_list) close_client(sp, sp->client_list);
+
+    for (size_t i = 0u; i < sp->watch_buckets; ++i) {
+        for (struct watch *wp = sp->watches[i], *next = NULL; wp; wp = next) {
+            next = wp->next;
+            free(wp);
+        }
+    }
+
+    free(sp->watches);
+    destroy_extent_cache(&sp->cache);
+    destroy_extent_list(&sp->extents);
+
+    close(sp->listener.fd);
+    close(sp->watcher.fd);
+    close(sp->signals.fd);
+    close(sp->epoll_fd);
+}
+
+void serve(const char *const path)
+{
+    assert(path);
+
+    struct server server;
+    start_server(&server, path);
+    msg("Listening on %s.", path);
+
+    for (bool running = true; running; ) {
+        struct epoll_event events[k_max_events];
+        const int count = epoll_wait(server.epoll_fd, events, k_max_events,
+                                     -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            die("can't wait for events: %s", strerror(errno));
+        }
+
+        for (int i = 0; i < count; ++i) {
+            struct channel *const chp = events[i].data.ptr;
+
+            switch (chp->kind) {
+            case k_channel_listener:
+                accept_clients(&server);
+                break;
+            case k_channel_watcher:
+                drain_watcher(&server);
+                break;
+            case k_channel_signals:
+                running = false;
+                break;
+            case k_channel_client:
+                if (((struct client *)chp)->writing)
+                    flush_client(&server, (struct client *)chp);
+                else
+                    serve_client(&server, (struct client *)chp);
+                break;
+            default:
+                die(BUG("unrecognized epoll channel"));
+            }
+        }
+    }
+
+    if (unlink(path) != 0) msg("can't remove %s: %s", path, strerror(errno));
+
+    msg("Answered %llu queries from %llu clients.",
+            server.queries, server.clients);
+    msg("Cache: %llu hits, %llu misses, %llu evicted.",
+            server.cache.hits, server.cache.misses, server.cache.evicted);
+
+    stop_server(&server);
+}
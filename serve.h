@@ -0,0 +1,72 @@
+// serve.h - answering extent queries on a Unix socket
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// The server listens on a stream socket and handles every client in one epoll
+// loop. Extents are kept in an in-memory cache (see cache.h), so a file asked
+// about again is answered without FIEMAP if it is unchanged. A file is
+// watched with inotify once its extents are cached, and its entry is dropped
+// as soon as it is modified, so even changes too quick to alter its
+// timestamps aren't missed.
+//
+// A client sends requests, and gets one reply per request, in order. All
+// integers are little-endian.
+//
+// Request:
+//
+//    0  length         u32, how many bytes follow, at most k_max_request_size
+//    4  query count    u32
+//    8  queries        one after another, each:
+//                        0  path length  u32
+//                        4  path         that many bytes, not NUL-terminated
+//
+// A query whose path length is zero is for a file descriptor instead, sent
+// with SCM_RIGHTS along with any part of the request. Descriptors are used
+// by such queries in the order they are received, and then closed.
+//
+// Reply:
+//
+//    0  length         u64, how many bytes follow
+//    8  result count   u32, the same as the query count
+//   12  results        one per query, in order, each:
+//                        0  error        u32, 0 or an errno value
+//                        4  (reserved)   u32, zero
+//                        8  size         u64, how many bytes of listing follow
+//                       16  listing      if error is 0, a binary listing, as
+//                                        fiemap -b writes (see record.h)
+//
+// A malformed request, or one that needs a descriptor that wasn't sent, gets
+// no reply: the server closes the connection.
+
+#ifndef HAVE_EXTENTS_FIEMAP_SERVE_H_
+#define HAVE_EXTENTS_FIEMAP_SERVE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+enum serve_constants {
+    k_max_request_size = 1024 * 1024,
+    k_request_header_size = 8,
+    k_reply_header_size = 12,
+    k_result_header_size = 16
+};
+
+// Listens on a socket created at path, serving queries until SIGINT or
+// SIGTERM, then removes the socket. If something is already at path, it's
+// replaced only if it's a socket nothing is listening on. Quits on failure to
+// listen.
+ATTRIBUTE((nonnull))
+void serve(const char *path);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_SERVE_H_
@@ -0,0 +1,105 @@
+// source.c - where fiemap gets the extents it shows (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "source.h"
+
+#include "device.h"
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+void open_file_source(struct extent_source *const esp, const int fd)
+{
+    assert(esp);
+
+    struct stat st = { 0 };
+    if (fstat(fd, &st) != 0) die("can't stat: %s", strerror(errno));
+    if (st.st_size < 0)
+        die("file has negative size %lld", (long long)st.st_size);
+
+    *esp = (struct extent_source){
+        .dev = st.st_dev,
+        .device_start = get_offset(st.st_dev),
+        .device_size = get_device_size(st.st_dev),
+        .file_size = (__u64)st.st_size
+    };
+
+    init_extent_pager(&esp->pager, fd);
+}
+
+void open_synthetic_source(struct extent_source *restrict const esp,
+                           const struct synthetic_spec *restrict const ssp)
+{
+    assert(esp);
+    assert(ssp);
+
+    *esp = (struct extent_source){ .dev = makedev(0u, 0u) };
+
+    measure_synthetic(ssp, &esp->file_size, &esp->device_size);
+    init_synthesizer(&esp->synth, ssp);
+    init_synthetic_pager(&esp->pager, &esp->synth);
+}
+
+void open_ext4_source(struct extent_source *restrict const esp,
+                      const char *restrict const image,
+                      const char *restrict const path)
+{
+    assert(esp);
+    assert(image);
+    assert(path);
+
+    const __u64 start = start_timing();
+
+    struct ext4_fs fs = { 0 };
+    open_ext4(&fs, image);
+
+    struct ext4_inode inode = { 0 };
+    read_ext4_inode(&fs, find_ext4_path(&fs, path), &inode);
+    if (!S_ISREG(inode.mode) && !S_ISDIR(inode.mode))
+        die("%s: %s: not a regular file or directory", image, path);
+    if (!can_map_ext4_inode(&inode))
+        die("%s: %s: %s", image, path, strerror(errno));
+
+    stop_timing(k_phase_retrieve, start);
+
+    const bool is_device = major(fs.dev) != 0u || minor(fs.dev) != 0u;
+
+    *esp = (struct extent_source){
+        .dev = fs.dev,
+        .device_start = (is_device ? get_offset(fs.dev) : 0u),
+        .device_size = (is_device ? get_device_size(fs.dev)
+                                  : fs.block_count * fs.block_size),
+        .file_size = inode.size
+    };
+
+    const __u64 restart = start_timing();
+    get_ext4_extents(&fs, &inode, &esp->list);
+    close_ext4(&fs);
+    stop_timing(k_phase_retrieve, restart);
+
+    init_listed_pager(&esp->pager, esp->list.extents, esp->list.count);
+}
+
+void close_extent_source(struct extent_source *const esp)
+{
+    assert(esp);
+
+    destroy_extent_pager(&esp->pager);
+    destroy_extent_list(&esp->list);
+}
@@ -0,0 +1,66 @@
+// source.h - where fiemap gets the extents it shows
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// An extent source is a pager for a file's extents, together with what else
+// fiemap needs to know to show them: the file's size, and the device it is on.
+// The extents either come from a real file, with FIEMAP, or from a file in an
+// unmounted ext4 filesystem, read from the filesystem's own structures, or are
+// made up by a synthesizer, so that output and parsing can be tested and timed
+// with any number of extents without making such a file.
+
+#ifndef HAVE_EXTENTS_FIEMAP_SOURCE_H_
+#define HAVE_EXTENTS_FIEMAP_SOURCE_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "ext4.h"
+#include "pager.h"
+#include "synthetic.h"
+
+#include <linux/types.h>
+#include <sys/types.h>
+
+struct extent_source {
+    dev_t dev;          // the device, or 0:0 for synthetic extents
+    __u64 device_start; // where the device starts on its disk
+    __u64 device_size;  // how big the device is, or 0 if unknown
+    __u64 file_size;
+    struct extent_pager pager;
+    struct synthesizer synth; // used only for synthetic extents
+    struct extent_list list;  // used only for extents read from ext4
+};
+
+// Prepares to retrieve the extents of the open file fd with FIEMAP.
+ATTRIBUTE((nonnull))
+void open_file_source(struct extent_source *esp, int fd);
+
+// Prepares to retrieve extents made up as the specification describes, for a
+// file exactly as big as the extents reach, on a device just big enough.
+ATTRIBUTE((nonnull))
+void open_synthetic_source(struct extent_source *restrict esp,
+                           const struct synthetic_spec *restrict ssp);
+
+// Prepares to retrieve the extents of the file at path (see find_ext4_path())
+// in the ext4 filesystem on the device or image file at image. They are all
+// read up front. If image is a regular file, it is treated as its own device.
+ATTRIBUTE((nonnull))
+void open_ext4_source(struct extent_source *restrict esp,
+                      const char *restrict image, const char *restrict path);
+
+// Frees the pager's buffer, and any extents read up front.
+ATTRIBUTE((nonnull))
+void close_extent_source(struct extent_source *esp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_SOURCE_H_
@@ -0,0 +1,168 @@
+// stats.c - timing and counting what a program does (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "stats.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const k_phase_names[k_stats_phases] = {
+    [k_phase_options] = "options",
+    [k_phase_device] = "device",
+    [k_phase_count] = "count",
+    [k_phase_retrieve] = "retrieve",
+    [k_phase_parse] = "parse",
+    [k_phase_format] = "format",
+    [k_phase_io] = "io"
+};
+
+static const char *const k_counter_names[k_stats_counters] = {
+    [k_stat_ioctls] = "ioctls",
+    [k_stat_reads] = "reads",
+    [k_stat_read_bytes] = "read_bytes",
+    [k_stat_writes] = "writes",
+    [k_stat_written_bytes] = "written_bytes",
+    [k_stat_extents] = "extents"
+};
+
+static bool g_enabled;
+static const char *g_program;
+static __u64 g_start;
+static FILE *g_report;
+
+static atomic_ullong g_phase_times[k_stats_phases];
+static atomic_ullong g_counters[k_stats_counters];
+
+static _Thread_local __u64 t_phase_times[k_stats_phases];
+
+__u64 read_clock(void)
+{
+    struct timespec now = { 0 };
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+        die("can't read clock: %s", strerror(errno));
+
+    return (__u64)now.tv_sec * 1000000000uLL + (__u64)now.tv_nsec;
+}
+
+// Writes a rate, in bytes per second, if any time was spent.
+ATTRIBUTE((nonnull))
+static void report_rate(const char *const key, const __u64 bytes,
+                        const __u64 nanoseconds)
+{
+    assert(key);
+
+    if (nanoseconds == 0u) return;
+
+    fprintf(g_report, "%s=%.0f\n",
+            key, (double)bytes * 1e9 / (double)nanoseconds);
+}
+
+// Writes everything measured, one key=value pair per line.
+static void report_stats(void)
+{
+    assert(g_enabled);
+    assert(g_report);
+
+    const __u64 wall_time = read_clock() - g_start;
+
+    fprintf(g_report, "program=%s\n", g_program);
+    fprintf(g_report, "wall_ns=%llu\n", wall_time);
+
+    for (int phase = 0; phase < k_stats_phases; ++phase) {
+        fprintf(g_report, "%s_ns=%llu\n", k_phase_names[phase],
+                atomic_load(&g_phase_times[phase]));
+    }
+
+    for (int counter = 0; counter < k_stats_counters; ++counter) {
+        fprintf(g_report, "%s=%llu\n", k_counter_names[counter],
+                atomic_load(&g_counters[counter]));
+    }
+
+    // Phase times may add up to more than the wall time when several threads
+    // work at once, so rates are over the wall time.
+    report_rate("read_bytes_per_s",
+                atomic_load(&g_counters[k_stat_read_bytes]), wall_time);
+    report_rate("written_bytes_per_s",
+                atomic_load(&g_counters[k_stat_written_bytes]), wall_time);
+
+    if (g_report == stderr)
+        fflush(g_report);
+    else if (fclose(g_report) != 0)
+        msg("can't write stats: %s", strerror(errno));
+}
+
+void enable_stats(const char *const program, const char *const path,
+                  const __u64 start)
+{
+    assert(program);
+    assert(path);
+    assert(!g_enabled);
+
+    if (strcmp(path, "-") == 0) {
+        g_report = stderr;
+    } else {
+        g_report = fopen(path, "w");
+        if (!g_report) die("%s: %s", path, strerror(errno));
+    }
+
+    g_program = program;
+    g_start = start;
+    g_enabled = true;
+
+    if (atexit(report_stats) != 0) die("can't arrange to report stats");
+}
+
+bool stats_enabled(void)
+{
+    return g_enabled;
+}
+
+__u64 start_timing(void)
+{
+    return g_enabled ? read_clock() : 0u;
+}
+
+void stop_timing(const enum stats_phase phase, const __u64 start)
+{
+    if (g_enabled) add_phase_time(phase, read_clock() - start);
+}
+
+void add_phase_time(const enum stats_phase phase, const __u64 nanoseconds)
+{
+    assert(phase < k_stats_phases);
+
+    if (!g_enabled) return;
+
+    atomic_fetch_add(&g_phase_times[phase], nanoseconds);
+    t_phase_times[phase] += nanoseconds;
+}
+
+__u64 get_thread_phase_time(const enum stats_phase phase)
+{
+    assert(phase < k_stats_phases);
+    return t_phase_times[phase];
+}
+
+void count_stat(const enum stats_counter counter, const __u64 amount)
+{
+    assert(counter < k_stats_counters);
+    if (g_enabled) atomic_fetch_add(&g_counters[counter], amount);
+}
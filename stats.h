@@ -0,0 +1,81 @@
+// stats.h - timing and counting what a program does
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Time spent in each phase is measured with the monotonic clock, and summed
+// over all threads. Calls and bytes are counted as they happen. When stats
+// are not enabled, nothing is measured or counted, and timing a phase costs
+// only a check of a flag. Everything here is safe to call from several
+// threads, but enable_stats must be called before any other threads start.
+
+#ifndef HAVE_EXTENTS_FIEMAP_STATS_H_
+#define HAVE_EXTENTS_FIEMAP_STATS_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+enum stats_phase {
+    k_phase_options,  // parsing the command line
+    k_phase_device,   // finding out about block devices
+    k_phase_count,    // asking how many extents a file has
+    k_phase_retrieve, // getting extents
+    k_phase_parse,    // reading a listing
+    k_phase_format,   // turning extents into output
+    k_phase_io,       // reading and writing data and output
+    k_stats_phases    // how many phases there are
+};
+
+enum stats_counter {
+    k_stat_ioctls,        // ioctl calls, including FIEMAP
+    k_stat_reads,         // calls that read data
+    k_stat_read_bytes,    // bytes they read
+    k_stat_writes,        // calls that write data or output
+    k_stat_written_bytes, // bytes they wrote
+    k_stat_extents,       // extents retrieved
+    k_stats_counters      // how many counters there are
+};
+
+// Reads the monotonic clock, in nanoseconds.
+__u64 read_clock(void);
+
+// Turns on measuring, and arranges for a report to be written to path, or to
+// standard error if path is "-", when the program exits. The program name and
+// the clock reading taken when it started appear in the report.
+ATTRIBUTE((nonnull))
+void enable_stats(const char *program, const char *path, __u64 start);
+
+// Checks if stats are being kept.
+bool stats_enabled(void);
+
+// Starts timing a phase. Returns the time to pass to stop_timing.
+__u64 start_timing(void);
+
+// Adds the time since start to a phase.
+void stop_timing(enum stats_phase phase, __u64 start);
+
+// Adds time, in nanoseconds, to a phase.
+void add_phase_time(enum stats_phase phase, __u64 nanoseconds);
+
+// Gets the time the calling thread has spent in a phase so far. Subtracting
+// this across a call gives the time the call spent in the phase, even while
+// other threads are busy.
+__u64 get_thread_phase_time(enum stats_phase phase);
+
+// Adds amount to a counter.
+void count_stat(enum stats_counter counter, __u64 amount);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_STATS_H_
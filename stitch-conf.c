@@ -0,0 +1,324 @@
+// stitch-conf.c - get user-provided configuration for stitch (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "stitch-conf.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NO_LONGOPTS
+#include <getopt.h>
+#endif
+
+enum compile_time_longopts_configuration {
+#ifdef NO_LONGOPTS
+    k_accept_longopts = 0
+#else
+    k_accept_longopts = 1
+#endif
+};
+
+// Prints brief version information and exits indicating success.
+static noreturn void show_version_and_quit(void)
+{
+    puts("stitch, v0.1 (alpha)");
+    exit(EXIT_SUCCESS);
+}
+
+// Prints a help message and exits indicating success.
+static noreturn void show_help_and_quit(void)
+{
+    puts("Usage:\n");
+
+    printf("  %s [-n] [-S] [-d] [-s ORDER] [-e ENGINE] [-q DEPTH] [-j JOBS]"
+            " [-c SIZE]\n         [-M STATS] [-o FILE] <LISTING\n",
+            progname());
+    printf("  %s [-S] [-d] [-c SIZE] [-M STATS] -v FILE <LISTING\n",
+            progname());
+    printf("  %s { -V | -h }\n\n", progname());
+
+    puts("LISTING is the output of fiemap for a file. The file's contents are"
+            " read from\nthe disk, which requires root, and written to"
+            " standard output or FILE.\n");
+
+    puts("With -v, nothing is written. Instead, FILE is read through the"
+            " filesystem and\ncompared in memory, a chunk at a time, with its"
+            " data on the disk. The first\nlogical offset that differs is"
+            " reported, with its row in LISTING.\n");
+
+    if (k_accept_longopts == (0)) {
+        puts("The -e option specifies how data are read from the disk:\n");
+    } else {
+        puts("The -e (--engine) option specifies how data are read from the"
+                " disk:\n");
+    }
+
+    puts("  auto    splice if the output is a regular file, else io_uring if"
+            " the kernel\n          supports it, else pread (default)");
+    puts("  uring   io_uring, keeping up to DEPTH reads in flight");
+    puts("  pread   pread, one read at a time");
+    puts("  splice  copy_file_range or splice, never copying data to"
+            " userspace");
+    puts("  threads JOBS threads, each writing what it reads at its offset in"
+            " FILE\n");
+
+    if (k_accept_longopts == (0))
+        puts("The -s option specifies the order extents are read in:\n");
+    else
+        puts("The -s (--schedule) option specifies the order extents are read"
+                " in:\n");
+
+    puts("  auto      physical if the disk is rotational and FILE is a regular"
+            " file, else\n            logical (default)");
+    puts("  logical   the order of the listing");
+    puts("  physical  one ascending sweep across the disk, which needs FILE to"
+            " be a\n            regular file\n");
+
+    printf("DEPTH defaults to %d. JOBS defaults to %d. SIZE, the most bytes"
+            " read at once,\ndefaults to %d KiB.", k_default_queue_depth,
+            k_default_thread_count, k_default_chunk_size / 1024);
+    puts(" The threads engine needs FILE to be a regular file.");
+    puts("SIZE may have a K, M, or G suffix, for KiB, MiB, or GiB.\n");
+
+    puts("STATS is where to write timings and counts of system calls and"
+            " bytes, as\nkey=value lines. If it is -, they go to standard"
+            " error.\n");
+
+    if (k_accept_longopts == (0)) {
+        puts("The -q option specifies DEPTH.");
+        puts("The -j option specifies JOBS.");
+        puts("The -c option specifies SIZE.");
+        puts("The -o option writes to FILE, creating or truncating it.");
+        puts("The -v option verifies FILE against the disk.");
+        puts("The -d option reads with O_DIRECT, bypassing the page cache.");
+        puts("The -S option starts reading each extent as soon as its row is"
+                " read, checking\nthe interpretation guide at the end. This"
+                " implies -s logical.");
+        puts("The -n option stops after checking LISTING, reading no blocks.");
+        puts("The -M option writes statistics to STATS.");
+        puts("The -V option prints brief version information.");
+        puts("The -h option prints this help message.");
+    } else {
+        puts("The -q (--queue-depth) option specifies DEPTH.");
+        puts("The -j (--jobs) option specifies JOBS.");
+        puts("The -c (--chunk-size) option specifies SIZE.");
+        puts("The -o (--output) option writes to FILE, creating or truncating"
+                " it.");
+        puts("The -v (--verify) option verifies FILE against the disk.");
+        puts("The -d (--direct) option reads with O_DIRECT, bypassing the"
+                " page cache.");
+        puts("The -S (--stream) option starts reading each extent as soon as"
+                " its row is\nread, checking the interpretation guide at the"
+                " end. This implies -s logical.");
+        puts("The -n (--parse-only) option stops after checking LISTING,"
+                " reading no blocks.");
+        puts("The -M (--stats) option writes statistics to STATS.");
+        puts("The -V (--version) option prints brief version information.");
+        puts("The -h (--help) option prints this help message.");
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+// Short options this program accepts, in the getopt() shortopts notation.
+static const char *const k_shortopts = ":s:e:q:j:c:o:v:M:dSnVh";
+
+#ifdef NO_LONGOPTS
+// Processes short options.
+#define GETOPT(ac, av) (getopt(ac, av, k_shortopts))
+#else
+static const struct option k_longopts[] = {
+    { "schedule", required_argument, NULL, 's' },
+    { "engine", required_argument, NULL, 'e' },
+    { "queue-depth", required_argument, NULL, 'q' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "chunk-size", required_argument, NULL, 'c' },
+    { "output", required_argument, NULL, 'o' },
+    { "verify", required_argument, NULL, 'v' },
+    { "stats", required_argument, NULL, 'M' },
+    { "direct", no_argument, NULL, 'd' },
+    { "stream", no_argument, NULL, 'S' },
+    { "parse-only", no_argument, NULL, 'n' },
+    { "version", no_argument, NULL, 'V' },
+    { "help", no_argument, NULL, 'h' },
+    { 0 }
+};
+
+// Processes short and long options.
+#define GETOPT(ac, av) (getopt_long(ac, av, k_shortopts, k_longopts, NULL))
+#endif
+
+// Parses the operand of -e.
+ATTRIBUTE((nonnull))
+static enum copy_engine parse_engine(const char *const name)
+{
+    assert(name);
+
+    if (strcmp(name, "auto") == 0) return k_engine_auto;
+    if (strcmp(name, "pread") == 0) return k_engine_pread;
+    if (strcmp(name, "uring") == 0) return k_engine_uring;
+    if (strcmp(name, "splice") == 0) return k_engine_splice;
+    if (strcmp(name, "threads") == 0) return k_engine_threads;
+
+    die("unrecognized engine \"%s\"", name);
+}
+
+// Parses the operand of -s.
+ATTRIBUTE((nonnull))
+static enum read_order parse_order(const char *const name)
+{
+    assert(name);
+
+    if (strcmp(name, "auto") == 0) return k_order_auto;
+    if (strcmp(name, "logical") == 0) return k_order_logical;
+    if (strcmp(name, "physical") == 0) return k_order_physical;
+
+    die("unrecognized order \"%s\"", name);
+}
+
+// Prints an error about an unrecognized command-line option flag, and quits.
+static noreturn void die_unrecognized_option(char *const *const argv)
+{
+    if (optopt)
+        die("unrecognized option: -%c", optopt);
+    else if (k_accept_longopts != (0))
+        die("unrecognized option: %s", argv[optind - 1]);
+    else
+        die(BUG("unrecognized option diagnostic failed"));
+}
+
+// Process a single command-line option, including its operand(s) if any.
+static void process_option(char *const *restrict const argv, const int opt,
+                           struct stitch_conf *restrict const cp)
+{
+    switch (opt) {
+    case 's':
+        cp->order = parse_order(optarg);
+        break;
+
+    case 'e':
+        cp->copy.engine = parse_engine(optarg);
+        break;
+
+    case 'q':
+        cp->copy.queue_depth =
+                (unsigned)parse_number(optarg, k_max_queue_depth, false);
+        break;
+
+    case 'j':
+        cp->copy.thread_count =
+                (unsigned)parse_number(optarg, k_max_thread_count, false);
+        break;
+
+    case 'c':
+        cp->copy.chunk_size =
+                (size_t)parse_number(optarg, k_max_chunk_size, true);
+        break;
+
+    case 'o':
+        if (optarg[0] == '\0') die("output path is empty");
+        cp->output_path = optarg;
+        break;
+
+    case 'v':
+        if (optarg[0] == '\0') die("path to verify is empty");
+        cp->verify_path = optarg;
+        break;
+
+    case 'M':
+        if (optarg[0] == '\0') die("statistics path is empty");
+        cp->stats_path = optarg;
+        break;
+
+    case 'd':
+        cp->copy.direct = true;
+        break;
+
+    case 'S':
+        cp->stream = true;
+        break;
+
+    case 'n':
+        cp->parse_only = true;
+        break;
+
+    case 'V':
+        show_version_and_quit();
+
+    case 'h':
+        show_help_and_quit();
+
+    case ':':
+        die("missing operand for -%c option", optopt);
+
+    case '?':
+        die_unrecognized_option(argv);
+
+    default:
+        die(BUG("getopt() returned %d '%c'"), opt, opt);
+    }
+}
+
+int get_stitch_configuration(int argc, char **restrict const argv,
+                             struct stitch_conf *restrict const cp)
+{
+    assert(argc > 0);
+    assert(argv);
+    assert(cp);
+
+    set_progname(argv[0]);
+
+    *cp = (struct stitch_conf){
+        .parse_only = false,
+        .stream = false,
+        .output_path = NULL,
+        .verify_path = NULL,
+        .stats_path = NULL,
+        .order = k_order_auto,
+        .copy = {
+            .engine = k_engine_auto,
+            .queue_depth = k_default_queue_depth,
+            .chunk_size = k_default_chunk_size,
+            .thread_count = k_default_thread_count,
+            .direct = false,
+            .alignment = 1u
+        }
+    };
+
+    opterr = false;
+    for (int opt = 0; (opt = GETOPT(argc, argv)) != -1; )
+        process_option(argv, opt, cp);
+
+    if (cp->copy.direct && cp->copy.engine == k_engine_splice)
+        die("the splice engine can't do direct I/O");
+    if (cp->stream && cp->order == k_order_physical)
+        die("can't read in physical order while streaming");
+
+    if (cp->verify_path) {
+        if (cp->output_path) die("can't both verify and write output");
+        if (cp->order == k_order_physical)
+            die("can't verify in physical order");
+        if (cp->copy.engine != k_engine_auto
+                && cp->copy.engine != k_engine_pread)
+            die("verification always uses the pread engine");
+    }
+
+    return optind - 1;
+}
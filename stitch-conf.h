@@ -0,0 +1,50 @@
+// stitch-conf.h - get user-provided configuration for stitch
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#ifndef HAVE_EXTENTS_FIEMAP_STITCH_CONF_H_
+#define HAVE_EXTENTS_FIEMAP_STITCH_CONF_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "copy.h"
+
+#include <stdbool.h>
+
+// Orders in which extents may be read.
+enum read_order {
+    k_order_auto,    // physical if the disk is rotational and output seekable
+    k_order_logical, // the order of the table, writing the output sequentially
+    k_order_physical // ascending disk offset, writing at logical offsets
+};
+
+// User-provided configuration for stitch.
+struct stitch_conf {
+    bool parse_only;         // stop after checking the input, reading nothing
+    bool stream;             // start reading before the whole input is read
+    const char *output_path; // where to write the file, or NULL for stdout
+    const char *verify_path; // a file to compare instead of writing, if any
+    const char *stats_path;  // where to report statistics, if anywhere
+    enum read_order order;
+    struct copy_options copy;
+};
+
+// Parses options and their operands out of command-line arguments using
+// getopt(). Doesn't process non-option arguments. Returns an index to the
+// first non-option argument or, if there are no such arguments, argc.
+ATTRIBUTE((nonnull))
+int get_stitch_configuration(int argc, char **restrict argv,
+                             struct stitch_conf *restrict cp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_STITCH_CONF_H_
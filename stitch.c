@@ -0,0 +1,304 @@
+// stitch.c - Reads a file's contents from disk, given fiemap's listing of it.
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "copy.h"
+#include "device.h"
+#include "plan.h"
+#include "stats.h"
+#include "stitch-conf.h"
+#include "util.h"
+#include "verify.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
+
+// Finds the disk that contains the volume described by the listing's intro.
+// That is the lowest device under the volume where the volume starts at the
+// offset the listing gives, since fiemap may not have seen as far down.
+ATTRIBUTE((nonnull, malloc, returns_nonnull))
+static char *find_disk(const struct device_info *const dip)
+{
+    assert(dip);
+
+    const dev_t dev = makedev(dip->major, dip->minor);
+    char *const volume = find_device_node(dev);
+    if (!volume)
+        die("can't find node for volume %u:%u", dip->major, dip->minor);
+    msg("The volume seems to be %u:%u (%s).", dip->major, dip->minor, volume);
+    free(volume);
+
+    const struct device_stack *const sp = resolve_device(dev);
+
+    for (size_t i = sp->depth; i-- != 0u; ) {
+        const struct device_level *const lp = &sp->levels[i];
+        if (lp->offset != dip->start_byte) continue;
+
+        char *const disk = find_device_node(lp->dev);
+        if (!disk) {
+            die("can't find node for disk %u:%u",
+                    major(lp->dev), minor(lp->dev));
+        }
+        msg("The disk seems to be %u:%u (%s).",
+                major(lp->dev), minor(lp->dev), disk);
+        return disk;
+    }
+
+    die("volume %u:%u doesn't start at byte %llu of anything it's on",
+            dip->major, dip->minor, dip->start_byte);
+}
+
+// While output is being written as the listing is read, what to call the
+// output if stitch quits before it's finished. Otherwise a null pointer.
+static const char *g_pending_output;
+
+// Reports, at exit, if output written while streaming is incomplete.
+static void report_pending_output(void)
+{
+    if (g_pending_output) msg("%s is incomplete.", g_pending_output);
+}
+
+// Makes the path of the file that output goes to until streaming is done.
+ATTRIBUTE((nonnull, malloc, returns_nonnull))
+static char *make_partial_path(const char *const path)
+{
+    assert(path);
+
+    static const char suffix[] = ".part";
+    char *const partial = xcalloc(strlen(path) + sizeof suffix, 1u);
+    return strcat(strcpy(partial, path), suffix);
+}
+
+// Checks if the disk holding the volume is rotational, as sysfs reports.
+// Returns false if this can't be determined.
+ATTRIBUTE((nonnull))
+static bool is_rotational(const struct device_info *const dip)
+{
+    assert(dip);
+
+    const struct device_stack *const sp =
+        resolve_device(makedev(dip->major, dip->minor));
+    const dev_t disk = sp->levels[sp->depth - 1u].dev;
+
+    enum { bufsz = 1024 };
+    char path[bufsz] = {0};
+    if (snprintf(path, bufsz, "/sys/dev/block/%u:%u/queue/rotational",
+                 major(disk), minor(disk)) >= bufsz)
+        die(BUG("sysfs path exceeds buffer"));
+
+    FILE *const fp = fopen(path, "r");
+    if (!fp) return false;
+
+    int rotational = 0;
+    const bool ok = fscanf(fp, "%d", &rotational) == 1;
+    fclose(fp);
+    return ok && rotational == 1;
+}
+
+// Decides whether to read in physical order, and if so, sorts the plan into
+// that order and reports how much seeking it saves. Returns true if sorted.
+ATTRIBUTE((nonnull))
+static bool schedule_reads(struct plan *const pp, const enum read_order order,
+                           const int out_fd)
+{
+    assert(pp);
+
+    if (!pp->complete) {
+        assert(order != k_order_physical);
+        return false;
+    }
+
+    switch (order) {
+    case k_order_logical:
+        return false;
+
+    case k_order_auto:
+        if (!is_rotational(&pp->dev) || !is_regular_file(out_fd))
+            return false;
+        break;
+
+    case k_order_physical:
+        if (!is_regular_file(out_fd))
+            die("physical order needs a regular output file");
+        break;
+
+    default:
+        die(BUG("unrecognized read order"));
+    }
+
+    const __u64 before = seek_distance(pp);
+    sort_physically(pp);
+    const __u64 after = seek_distance(pp);
+
+    msg("Reading in physical order: %llu bytes of seeking, down from %llu"
+            " (%llu saved).", after, before, (before > after ? before - after
+                                                             : 0uLL));
+    return true;
+}
+
+// Opens the output file, or returns standard output if there is none.
+static int open_output(const char *const path)
+{
+    if (!path) return STDOUT_FILENO;
+
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) die("%s: %s", path, strerror(errno));
+    return fd;
+}
+
+// Opens the disk holding the plan's volume for reading, quitting on failure or
+// if not root. If direct I/O is requested, finds the alignment it needs.
+ATTRIBUTE((nonnull))
+static int open_disk(const struct plan *restrict const pp,
+                     struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(cop);
+
+    char *const disk = find_disk(&pp->dev);
+
+    if (geteuid() != 0) die("you're not root; not trying to read blocks");
+
+    const int disk_fd = open(disk, O_RDONLY | (cop->direct ? O_DIRECT : 0));
+    if (disk_fd < 0) die("%s: %s", disk, strerror(errno));
+
+    if (cop->direct) cop->alignment = get_direct_alignment(disk_fd);
+
+    free(disk);
+    return disk_fd;
+}
+
+// Reads the file's data from the disk and writes them to the output. If the
+// plan is incomplete, the rest of the listing is read along the way, and the
+// output, if it's a file, is written under another name until it is complete.
+ATTRIBUTE((nonnull))
+static void stitch(struct plan *restrict const pp,
+                   struct stitch_conf *restrict const cp)
+{
+    assert(pp);
+    assert(cp);
+    assert(pp->count);
+
+    struct copy_options *const cop = &cp->copy;
+    const char *const output_path = cp->output_path;
+
+    const int disk_fd = open_disk(pp, cop);
+
+    const bool streaming = !pp->complete;
+    char *const partial_path = (streaming && output_path
+                                    ? make_partial_path(output_path) : NULL);
+    const char *const write_path = (partial_path ? partial_path
+                                                 : output_path);
+
+    const int out_fd = open_output(write_path);
+    if (streaming)
+        g_pending_output = (write_path ? write_path : "standard output");
+
+    if (schedule_reads(pp, cp->order, out_fd)) cop->positioned = true;
+    copy_segments(pp, disk_fd, out_fd, cop);
+    assert(pp->complete);
+
+    if (write_path && close(out_fd) != 0)
+        die("%s: %s", write_path, strerror(errno));
+    if (partial_path && rename(partial_path, output_path) != 0)
+        die("can't rename %s to %s: %s",
+                partial_path, output_path, strerror(errno));
+
+    g_pending_output = NULL;
+    free(partial_path);
+    if (close(disk_fd) != 0) die("can't close disk: %s", strerror(errno));
+}
+
+// Compares the file at cp->verify_path with its data on the disk. Returns true
+// if they match. If the plan has no segments, the disk isn't needed.
+ATTRIBUTE((nonnull))
+static bool verify(struct plan *restrict const pp,
+                   struct stitch_conf *restrict const cp)
+{
+    assert(pp);
+    assert(cp);
+    assert(cp->verify_path);
+
+    const int disk_fd = (pp->count != 0u ? open_disk(pp, &cp->copy) : -1);
+
+    const int file_fd = open(cp->verify_path, O_RDONLY | O_NOCTTY);
+    if (file_fd < 0) die("%s: %s", cp->verify_path, strerror(errno));
+
+    const bool same = verify_segments(pp, disk_fd, file_fd, cp->verify_path,
+                                      &cp->copy);
+
+    if (close(file_fd) != 0)
+        die("%s: %s", cp->verify_path, strerror(errno));
+    if (disk_fd >= 0 && close(disk_fd) != 0)
+        die("can't close disk: %s", strerror(errno));
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    const __u64 start = read_clock();
+
+    struct stitch_conf conf = { 0 };
+    const int arg_delta = get_stitch_configuration(argc, argv, &conf);
+    argc -= arg_delta;
+    argv += arg_delta;
+
+    if (conf.stats_path) {
+        enable_stats("stitch", conf.stats_path, start);
+        stop_timing(k_phase_options, start);
+    }
+
+    if (argc > 1) die("too many arguments");
+
+    struct plan plan = { 0 };
+    open_plan(&plan, stdin);
+
+    // Unless streaming, read the whole listing first. Either way, read at
+    // least one row, so an empty file never needs the disk.
+    if (conf.stream && !conf.parse_only)
+        extend_plan(&plan);
+    else
+        finish_plan(&plan);
+
+    if (atexit(report_pending_output) != 0)
+        die("can't register exit handler");
+
+    bool ok = true;
+
+    if (conf.parse_only) {
+        // Don't touch the output file.
+    } else if (conf.verify_path) {
+        ok = verify(&plan, &conf);
+    } else if (plan.count != 0u) {
+        stitch(&plan, &conf);
+        msg("Stitching completed.");
+    } else {
+        // The file is empty, or all one hole, so don't touch the disk.
+        const int out_fd = open_output(conf.output_path);
+        write_zeros(out_fd, plan.size);
+        if (conf.output_path && close(out_fd) != 0)
+            die("%s: %s", conf.output_path, strerror(errno));
+    }
+
+    destroy_plan(&plan);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
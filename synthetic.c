@@ -0,0 +1,205 @@
+// synthetic.c - made-up extents, for testing and benchmarking (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "synthetic.h"
+
+#include "util.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The keys a specification may have, in the order getsubopt() numbers them.
+enum spec_key { k_key_count, k_key_seed, k_key_size, k_key_gap, k_key_hole };
+
+static char *const k_spec_keys[] = {
+    "count", "seed", "size", "gap", "hole", NULL
+};
+
+// Parses a byte count, which may be zero. Quits on failure.
+ATTRIBUTE((nonnull))
+static __u64 parse_bytes(const char *const text)
+{
+    assert(text);
+
+    if (strcmp(text, "0") == 0) return 0u;
+    return parse_number(text, ULLONG_MAX, true);
+}
+
+// Parses a range, MIN:MAX or a single value, of byte counts that must be
+// multiples of the block size. Quits on failure.
+ATTRIBUTE((nonnull))
+static void parse_range(char *restrict const text,
+                        struct byte_range *restrict const rp,
+                        const char *restrict const key)
+{
+    assert(text);
+    assert(rp);
+    assert(key);
+
+    char *const colon = strchr(text, ':');
+    if (colon) *colon = '\0';
+
+    rp->min = parse_bytes(text);
+    rp->max = (colon ? parse_bytes(colon + 1) : rp->min);
+
+    if (rp->min > rp->max) die("%s range is backwards", key);
+    if (rp->min % k_synthetic_block_size != 0u
+            || rp->max % k_synthetic_block_size != 0u)
+        die("%s must be a multiple of %d bytes", key, k_synthetic_block_size);
+}
+
+void parse_synthetic_spec(const char *restrict const text,
+                          struct synthetic_spec *restrict const ssp)
+{
+    assert(text);
+    assert(ssp);
+
+    *ssp = (struct synthetic_spec){
+        .seed = 1u,
+        .size = { .min = 4096u, .max = 1024u * 1024u },
+        .gap = { .min = 0u, .max = 1024u * 1024u },
+        .hole = { .min = 0u, .max = 0u }
+    };
+
+    char *const copy = xcalloc(strlen(text) + 1u, 1u);
+    strcpy(copy, text);
+
+    for (char *p = copy, *value = NULL; *p != '\0'; ) {
+        const int key = getsubopt(&p, k_spec_keys, &value);
+        if (key < 0) die("unrecognized synthetic extent parameter: %s", value);
+        if (!value) die("no value for %s", k_spec_keys[key]);
+
+        switch ((enum spec_key)key) {
+        case k_key_count:
+            ssp->count = parse_number(value, ULLONG_MAX, true);
+            break;
+        case k_key_seed:
+            ssp->seed = (strcmp(value, "0") == 0
+                            ? 0u : parse_number(value, ULLONG_MAX, false));
+            break;
+        case k_key_size:
+            parse_range(value, &ssp->size, "size");
+            break;
+        case k_key_gap:
+            parse_range(value, &ssp->gap, "gap");
+            break;
+        case k_key_hole:
+            parse_range(value, &ssp->hole, "hole");
+            break;
+        }
+    }
+
+    free(copy);
+
+    if (ssp->count == 0u) die("how many synthetic extents? (count=N)");
+    if (ssp->size.min == 0u) die("synthetic extents can't be empty");
+}
+
+void init_synthesizer(struct synthesizer *restrict const syp,
+                      const struct synthetic_spec *restrict const ssp)
+{
+    assert(syp);
+    assert(ssp);
+
+    *syp = (struct synthesizer){ .spec = *ssp, .state = ssp->seed };
+}
+
+// Gets the next pseudorandom number, by the SplitMix64 algorithm.
+ATTRIBUTE((nonnull))
+static __u64 next_random(struct synthesizer *const syp)
+{
+    assert(syp);
+
+    __u64 z = (syp->state += 0x9E3779B97F4A7C15uLL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9uLL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBuLL;
+    return z ^ (z >> 31);
+}
+
+// Draws a multiple of the block size from a range.
+ATTRIBUTE((nonnull))
+static __u64 draw(struct synthesizer *restrict const syp,
+                  const struct byte_range *restrict const rp)
+{
+    assert(syp);
+    assert(rp);
+
+    const __u64 span = (rp->max - rp->min) / k_synthetic_block_size;
+    if (span == 0u) return rp->min;
+
+    const __u64 blocks = (span == ULLONG_MAX ? next_random(syp)
+                                             : next_random(syp) % (span + 1u));
+    return rp->min + blocks * k_synthetic_block_size;
+}
+
+// Adds, quitting instead of wrapping around.
+static __u64 checked_add(const __u64 first, const __u64 second)
+{
+    if (second > ULLONG_MAX - first) die("synthetic extents are too big");
+    return first + second;
+}
+
+__u32 synthesize_extents(struct synthesizer *restrict const syp,
+                         struct fiemap_extent *restrict const extents,
+                         const __u32 max)
+{
+    assert(syp);
+    assert(extents);
+
+    __u32 i = 0u;
+
+    for (; i < max && syp->made < syp->spec.count; ++i) {
+        const __u64 logical = checked_add(syp->logical,
+                                          draw(syp, &syp->spec.hole));
+        const __u64 physical = checked_add(syp->physical,
+                                           draw(syp, &syp->spec.gap));
+        const __u64 length = draw(syp, &syp->spec.size);
+
+        syp->logical = checked_add(logical, length);
+        syp->physical = checked_add(physical, length);
+        ++syp->made;
+
+        extents[i] = (struct fiemap_extent){
+            .fe_logical = logical,
+            .fe_physical = physical,
+            .fe_length = length,
+            .fe_flags = (syp->made == syp->spec.count ? FIEMAP_EXTENT_LAST
+                                                      : 0u)
+        };
+    }
+
+    return i;
+}
+
+void measure_synthetic(const struct synthetic_spec *restrict const ssp,
+                       __u64 *restrict const file_endp,
+                       __u64 *restrict const disk_endp)
+{
+    assert(ssp);
+    assert(file_endp);
+    assert(disk_endp);
+
+    enum { k_batch = 256 };
+    struct fiemap_extent batch[k_batch];
+
+    struct synthesizer synth = { 0 };
+    init_synthesizer(&synth, ssp);
+    while (synthesize_extents(&synth, batch, k_batch) != 0u) continue;
+
+    *file_endp = synth.logical;
+    *disk_endp = synth.physical;
+}
@@ -0,0 +1,84 @@
+// synthetic.h - made-up extents, for testing and benchmarking
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// A synthesizer makes up a file's extents, as many as asked for, without any
+// filesystem. Each extent's length, the gap on the disk before it, and the
+// hole in the file before it are drawn uniformly from ranges, by a
+// pseudorandom generator, so the same seed always gives the same extents.
+// Extents are laid out in ascending order both logically and physically.
+
+#ifndef HAVE_EXTENTS_FIEMAP_SYNTHETIC_H_
+#define HAVE_EXTENTS_FIEMAP_SYNTHETIC_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+
+#include <linux/fiemap.h>
+#include <linux/types.h>
+
+enum synthetic_constants {
+    k_synthetic_block_size = 4096 // all lengths are multiples of this
+};
+
+// A range of byte counts, from min to max inclusive.
+struct byte_range {
+    __u64 min;
+    __u64 max;
+};
+
+// What extents to make up.
+struct synthetic_spec {
+    __u64 count;
+    __u64 seed;
+    struct byte_range size; // how long each extent is
+    struct byte_range gap;  // how far on the disk each is from the one before
+    struct byte_range hole; // how far in the file each is from the one before
+};
+
+// State for making up extents a page at a time.
+struct synthesizer {
+    struct synthetic_spec spec;
+    __u64 state;    // the pseudorandom generator's state
+    __u64 made;     // how many extents have been made so far
+    __u64 logical;  // where the last extent made ended in the file
+    __u64 physical; // where the last extent made ended on the disk
+};
+
+// Parses a specification like "count=N,seed=N,size=MIN:MAX,gap=MIN:MAX,
+// hole=MIN:MAX". Only count is required. A range may be a single value, and
+// values may have a K, M, or G suffix. Quits on failure.
+ATTRIBUTE((nonnull))
+void parse_synthetic_spec(const char *restrict text,
+                          struct synthetic_spec *restrict ssp);
+
+// Prepares to make up the extents the specification describes.
+ATTRIBUTE((nonnull))
+void init_synthesizer(struct synthesizer *restrict syp,
+                      const struct synthetic_spec *restrict ssp);
+
+// Makes up to max more extents, stored in extents. The last extent has the
+// FIEMAP_EXTENT_LAST flag. Returns how many were made, which is 0 once all
+// have been.
+ATTRIBUTE((nonnull))
+__u32 synthesize_extents(struct synthesizer *restrict syp,
+                         struct fiemap_extent *restrict extents, __u32 max);
+
+// Finds where the last extent the specification describes will end in the
+// file and on the disk, by making them all up and throwing them away.
+ATTRIBUTE((nonnull))
+void measure_synthetic(const struct synthetic_spec *restrict ssp,
+                       __u64 *restrict file_endp, __u64 *restrict disk_endp);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_SYNTHETIC_H_
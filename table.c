@@ -19,6 +19,7 @@
 #include "util.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,25 @@
 #include <linux/types.h>
 #include <sys/ioctl.h>
 
+enum table_constants {
+    k_outbuf_size = 64 * 1024, // rows are buffered, then written in one go
+    k_u64_digits_max = 20      // a __u64 has at most this many decimal digits
+};
+
+// What follows the last cell of a row for an unwritten extent.
+static const char *const k_unwritten_note = "unwritten";
+
+// What follows that (if present) for an extent not allocated on disk yet.
+static const char *const k_unallocated_note = "unallocated";
+
+// What follows those (if present) for an extent past the end of the file.
+static const char *const k_past_eof_note = "past EOF";
+
+// Flags of extents whose physical offsets mean nothing until they are
+// allocated, as when writing them out is delayed.
+static const __u32 k_unallocated_flags = FIEMAP_EXTENT_UNKNOWN
+                                         | FIEMAP_EXTENT_DELALLOC;
+
 ATTRIBUTE((malloc, returns_nonnull))
 static struct tablespec *alloc_tablespec(const int col_count)
 {
@@ -44,32 +64,84 @@ static struct tablespec *alloc_tablespec(const int col_count)
 }
 
 ATTRIBUTE((nonnull))
-static inline __u64 get_raw(const struct fiemap_extent *const fep,
-                            const enum datum datum)
+static __u64 get_logical(const struct fiemap_extent *const fep)
 {
     assert(fep);
+    return fep->fe_logical;
+}
 
+ATTRIBUTE((nonnull))
+static __u64 get_physical(const struct fiemap_extent *const fep)
+{
+    assert(fep);
+    return fep->fe_physical;
+}
+
+ATTRIBUTE((nonnull))
+static __u64 get_length(const struct fiemap_extent *const fep)
+{
+    assert(fep);
+    return fep->fe_length;
+}
+
+ATTRIBUTE((nonnull))
+static __u64 get_physical_end(const struct fiemap_extent *const fep)
+{
+    assert(fep);
+    return fep->fe_physical + fep->fe_length;
+}
+
+// Selects the function that retrieves a datum, so this is decided once for
+// each column, rather than again for each cell.
+ATTRIBUTE((returns_nonnull))
+static __u64 (*select_getter(const enum datum datum))
+        (const struct fiemap_extent *)
+{
     switch (datum) {
-        case k_datum_logical:         return fep->fe_logical;
-        case k_datum_physical:        return fep->fe_physical;
-        case k_datum_length:          return fep->fe_length;
-        case k_datum_physical_end:    return fep->fe_physical + fep->fe_length;
+        case k_datum_logical:         return get_logical;
+        case k_datum_physical:        return get_physical;
+        case k_datum_length:          return get_length;
+        case k_datum_physical_end:    return get_physical_end;
     }
 
     die(BUG("unrecognized datum selection"));
 }
 
+// Converts a raw value to the units, and from the origin, of its column.
 ATTRIBUTE((nonnull))
-static inline __u64
-get(const struct fiemap *restrict const fmp,
-    const struct colspec *restrict const csp, const __u32 row_index)
+static inline __u64 scale(const struct colspec *const csp, const __u64 raw)
 {
-    assert(fmp);
     assert(csp);
-    assert(row_index < fmp->fm_mapped_extents);
+    return (raw + csp->offset) >> csp->shift;
+}
 
-    const __u64 raw = get_raw(&fmp->fm_extents[row_index], csp->datum);
-    return (raw + csp->offset) / csp->divisor;
+// Gets the greatest raw value a column's datum may have, given the bounds.
+ATTRIBUTE((nonnull))
+static __u64 get_raw_bound(const struct table_bounds *const bp,
+                           const enum datum datum)
+{
+    assert(bp);
+
+    switch (datum) {
+        case k_datum_logical:         return bp->logical;
+        case k_datum_physical:        return bp->physical;
+        case k_datum_length:          return bp->physical;
+        case k_datum_physical_end:    return bp->physical;
+    }
+
+    die(BUG("unrecognized datum selection"));
+}
+
+// Counts the digits needed to write a value in decimal.
+ATTRIBUTE((const))
+static int count_digits(__u64 value)
+{
+    int digits = 1;
+
+    for (; value >= 100u; value /= 100u) digits += 2;
+    if (value >= 10u) ++digits;
+
+    return digits;
 }
 
 ATTRIBUTE((nonnull))
@@ -89,28 +161,29 @@ static void set_widths_from_labels(struct tablespec *const tsp)
 }
 
 ATTRIBUTE((nonnull))
-static void update_widths_from_values(struct tablespec *const tsp)
+static void
+update_widths_from_bounds(struct tablespec *restrict const tsp,
+                          const struct table_bounds *restrict const bp)
 {
     assert(tsp);
+    assert(bp);
     assert(tsp->col_count >= 0);
 
-    const __u32 row_count = tsp->fmp->fm_mapped_extents;
-
-    for (__u32 row_index = 0u; row_index < row_count; ++row_index) {
-        for (int col_index = 0; col_index < tsp->col_count; ++col_index) {
-            struct colspec *const csp = &tsp->cols[col_index];
-            const __u64 value = get(tsp->fmp, csp, row_index);
-            csp->width = max(csp->width, snprintf(NULL, 0u, "%llu", value));
-        }
+    for (int col_index = 0; col_index < tsp->col_count; ++col_index) {
+        struct colspec *const csp = &tsp->cols[col_index];
+        const __u64 value = scale(csp, get_raw_bound(bp, csp->datum));
+        csp->width = max(csp->width, count_digits(value));
     }
 }
 
 ATTRIBUTE((nonnull))
-static void populate_widths(struct tablespec *const tsp)
+static void populate_widths(struct tablespec *restrict const tsp,
+                            const struct table_bounds *restrict const bp)
 {
     assert(tsp);
+    assert(bp);
     set_widths_from_labels(tsp);
-    update_widths_from_values(tsp);
+    update_widths_from_bounds(tsp, bp);
 }
 
 ATTRIBUTE((nonnull))
@@ -122,37 +195,123 @@ static void show_labels(const struct tablespec *const tsp)
     for (int col_index = 0; col_index < tsp->col_count; ++col_index) {
         const struct colspec *const csp = &tsp->cols[col_index];
         assert(csp->label);
-        printf("%*s", tsp->gap_width + csp->width, csp->label);
+        fprintf(tsp->out, "%*s", tsp->gap_width + csp->width, csp->label);
     }
 
-    putchar('\n');
+    putc('\n', tsp->out);
 }
 
+// Text written to the table's stream, collected so that rows are written many
+// at a time, rather than with a separate printf() call for each cell.
+struct outbuf {
+    FILE *fp;
+    size_t len;
+    char data[k_outbuf_size];
+};
+
+// Pairs of decimal digits, for converting numbers two digits at a time.
+static const char k_digit_pairs[] =
+        "00010203040506070809" "10111213141516171819"
+        "20212223242526272829" "30313233343536373839"
+        "40414243444546474849" "50515253545556575859"
+        "60616263646566676869" "70717273747576777879"
+        "80818283848586878889" "90919293949596979899";
+
 ATTRIBUTE((nonnull))
-static void show_all_rows(const struct tablespec *const tsp)
+static void flush_outbuf(struct outbuf *const obp)
 {
-    assert(tsp);
-    assert(tsp->gap_width > 0 && tsp->col_count >= 0);
+    assert(obp);
+    assert(obp->len <= k_outbuf_size);
 
-    const __u32 row_count = tsp->fmp->fm_mapped_extents;
+    if (obp->len != 0u && fwrite(obp->data, 1u, obp->len, obp->fp) != obp->len)
+        die("can't write output: %s", strerror(errno));
 
-    for (__u32 row_index = 0u; row_index < row_count; ++row_index) {
-        for (int col_index = 0; col_index < tsp->col_count; ++col_index) {
-            const struct colspec *const csp = &tsp->cols[col_index];
-            const __u64 value = get(tsp->fmp, csp, row_index);
-            printf("%*llu", tsp->gap_width + csp->width, value);
-        }
+    obp->len = 0u;
+}
 
-        putchar('\n');
+// Flushes the buffer if it doesn't have room for size more characters.
+ATTRIBUTE((nonnull))
+static void reserve(struct outbuf *const obp, const size_t size)
+{
+    assert(obp);
+    assert(size <= k_outbuf_size);
+
+    if (k_outbuf_size - obp->len < size) flush_outbuf(obp);
+}
+
+// Writes value in decimal, ending just before end. Returns where it begins.
+ATTRIBUTE((nonnull, returns_nonnull))
+static char *format_u64(__u64 value, char *const end)
+{
+    assert(end);
+
+    char *p = end;
+
+    for (; value >= 100u; value /= 100u) {
+        const size_t pair = (size_t)(value % 100u) * 2u;
+        *--p = k_digit_pairs[pair + 1u];
+        *--p = k_digit_pairs[pair];
     }
+
+    if (value >= 10u) {
+        const size_t pair = (size_t)value * 2u;
+        *--p = k_digit_pairs[pair + 1u];
+        *--p = k_digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    return p;
 }
 
+// Writes value in decimal, right-aligned in a field at least width wide.
+// This behaves like printf() with "%*llu" but is much faster.
 ATTRIBUTE((nonnull))
-static void show_populated_table(const struct tablespec *const tsp)
+static void put_cell(struct outbuf *const obp, const __u64 value,
+                     const int width)
 {
-    assert(tsp);
-    show_labels(tsp);
-    show_all_rows(tsp);
+    ASSERT_NONNEGATIVE_INT_FITS_IN_SIZE_T();
+    assert(obp);
+    assert(width >= 0);
+
+    char digits[k_u64_digits_max];
+    char *const end = digits + k_u64_digits_max;
+    const char *const begin = format_u64(value, end);
+    const size_t len = (size_t)(end - begin);
+    const size_t pad = ((size_t)width > len ? (size_t)width - len : 0u);
+
+    if (pad + len > k_outbuf_size) die(BUG("table cell too wide to format"));
+    reserve(obp, pad + len);
+
+    memset(obp->data + obp->len, ' ', pad);
+    memcpy(obp->data + obp->len + pad, begin, len);
+    obp->len += pad + len;
+}
+
+// Writes a gap, then text, after the last cell of a row.
+ATTRIBUTE((nonnull))
+static void put_note(struct outbuf *restrict const obp, const int gap_width,
+                     const char *restrict const text)
+{
+    ASSERT_NONNEGATIVE_INT_FITS_IN_SIZE_T();
+    assert(obp);
+    assert(gap_width >= 0);
+    assert(text);
+
+    const size_t len = strlen(text);
+    reserve(obp, (size_t)gap_width + len);
+
+    memset(obp->data + obp->len, ' ', (size_t)gap_width);
+    memcpy(obp->data + obp->len + (size_t)gap_width, text, len);
+    obp->len += (size_t)gap_width + len;
+}
+
+ATTRIBUTE((nonnull))
+static void put_newline(struct outbuf *const obp)
+{
+    assert(obp);
+    reserve(obp, 1u);
+    obp->data[obp->len++] = '\n';
 }
 
 // Currently this is just the length of the string, because the user specifies
@@ -182,56 +341,56 @@ static void specify_column(struct colspec *const colp,
         colp->label = "LOGICAL (B)";
         colp->datum = k_datum_logical;
         colp->offset = 0uLL;
-        colp->divisor = 1uLL;
+        colp->shift = 0u;
         break;
 
     case 'l':
         colp->label = "LOGICAL (sec)";
         colp->datum = k_datum_logical;
         colp->offset = 0uLL;
-        colp->divisor = k_sector_size;
+        colp->shift = k_sector_shift;
         break;
 
     case 'I':
         colp->label = "INITIAL (B)";
         colp->datum = k_datum_physical;
         colp->offset = offset;
-        colp->divisor = 1uLL;
+        colp->shift = 0u;
         break;
 
     case 'i':
         colp->label = "INITIAL (sec)";
         colp->datum = k_datum_physical;
         colp->offset = offset;
-        colp->divisor = k_sector_size;
+        colp->shift = k_sector_shift;
         break;
 
     case 'F':
         colp->label = "FINAL (B)";
         colp->datum = k_datum_physical_end;
         colp->offset = offset - 1uLL;
-        colp->divisor = 1uLL;
+        colp->shift = 0u;
         break;
 
     case 'f':
         colp->label = "FINAL (sec)";
         colp->datum = k_datum_physical_end;
         colp->offset = offset - 1uLL;
-        colp->divisor = k_sector_size;
+        colp->shift = k_sector_shift;
         break;
 
     case 'C':
         colp->label = "COUNT (B)";
         colp->datum = k_datum_length;
         colp->offset = 0uLL;
-        colp->divisor = 1uLL;
+        colp->shift = 0u;
         break;
 
     case 'c':
         colp->label = "COUNT (sec)";
         colp->datum = k_datum_length;
         colp->offset = 0uLL;
-        colp->divisor = k_sector_size;
+        colp->shift = k_sector_shift;
         break;
 
     default:
@@ -241,22 +400,68 @@ static void specify_column(struct colspec *const colp,
     }
 }
 
-void
-show_extent_table(const struct fiemap *restrict const fmp, const __u64 offset,
-                  const char *restrict const columns)
+struct tablespec *
+start_extent_table(FILE *restrict const out,
+                   const char *restrict const columns, const __u64 offset,
+                   const __u64 file_size,
+                   const struct table_bounds *restrict const bp)
 {
     enum { gap_width = 3 }; // TODO: Let the user customize this.
-    assert(fmp);
+    assert(out);
     assert(columns);
+    assert(bp);
 
     struct tablespec *const tsp = alloc_tablespec(count_columns(columns));
-    tsp->fmp = fmp;
+    tsp->out = out;
+    tsp->file_size = file_size;
     tsp->gap_width = gap_width;
 
-    for (int i = 0; i < tsp->col_count; ++i)
+    for (int i = 0; i < tsp->col_count; ++i) {
         specify_column(&tsp->cols[i], offset, columns[i]);
+        tsp->cols[i].get_raw = select_getter(tsp->cols[i].datum);
+    }
+
+    populate_widths(tsp, bp);
+    show_labels(tsp);
+    return tsp;
+}
+
+void show_extent_rows(const struct tablespec *restrict const tsp,
+                      const struct fiemap_extent *restrict const extents,
+                      const __u32 count)
+{
+    assert(tsp);
+    assert(extents);
+    assert(tsp->gap_width > 0 && tsp->col_count >= 0);
+
+    struct outbuf out;
+    out.fp = tsp->out;
+    out.len = 0u;
 
-    populate_widths(tsp);
-    show_populated_table(tsp);
+    for (__u32 row_index = 0u; row_index < count; ++row_index) {
+        const struct fiemap_extent *const fep = &extents[row_index];
+
+        for (int col_index = 0; col_index < tsp->col_count; ++col_index) {
+            const struct colspec *const csp = &tsp->cols[col_index];
+            const __u64 value = scale(csp, csp->get_raw(fep));
+            put_cell(&out, value, tsp->gap_width + csp->width);
+        }
+
+        if (fep->fe_flags & FIEMAP_EXTENT_UNWRITTEN)
+            put_note(&out, tsp->gap_width, k_unwritten_note);
+        if (fep->fe_flags & k_unallocated_flags)
+            put_note(&out, tsp->gap_width, k_unallocated_note);
+        if (fep->fe_logical >= tsp->file_size)
+            put_note(&out, tsp->gap_width, k_past_eof_note);
+
+        put_newline(&out);
+    }
+
+    flush_outbuf(&out);
+}
+
+void finish_extent_table(struct tablespec *const tsp)
+{
+    assert(tsp);
     free(tsp);
 }
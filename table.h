@@ -20,6 +20,7 @@
 #include "attribute.h"
 
 #include <stddef.h>
+#include <stdio.h>
 #include <linux/fiemap.h>
 #include <linux/types.h>
 #include <sys/ioctl.h>
@@ -35,19 +36,48 @@ struct colspec {
     const char *label;
     int width;
     enum datum datum;
+    __u64 (*get_raw)(const struct fiemap_extent *fep); // selected from datum
     __u64 offset;
-    __u64 divisor;
+    unsigned shift; // values are divided by 2 to the power of shift
 };
 
 struct tablespec {
-    const struct fiemap *fmp;
+    FILE *out;       // where the table is written
+    __u64 file_size; // extents starting here or later are past the end
     int gap_width;
     int col_count;
     struct colspec cols[];
 };
 
+// Upper bounds on the raw values of the data shown in a table. Columns are
+// made wide enough for any values within these bounds, so that rows can be
+// shown as soon as their extents are retrieved, without seeing the rest.
+struct table_bounds {
+    __u64 logical;  // greatest possible logical offset
+    __u64 physical; // greatest possible physical offset (or extent length)
+};
+
+// Prepares a table with the specified columns and shows its column labels on
+// out, where the rows will also be shown. The file is file_size bytes long.
+ATTRIBUTE((nonnull, returns_nonnull))
+struct tablespec *start_extent_table(FILE *restrict out,
+                                     const char *restrict columns,
+                                     __u64 offset, __u64 file_size,
+                                     const struct table_bounds *restrict bp);
+
+// Shows a row of the table for each of count extents. Rows for unwritten
+// extents, which are allocated but read as zeros, end with "unwritten". Rows
+// for extents not yet allocated, whose physical offsets mean nothing, end
+// with "unallocated". Rows for extents that start at or past the end of the
+// file, such as space preallocated without changing its size, end with
+// "past EOF".
+ATTRIBUTE((nonnull))
+void show_extent_rows(const struct tablespec *restrict tsp,
+                      const struct fiemap_extent *restrict extents,
+                      __u32 count);
+
+// Frees a table's specification, once all its rows have been shown.
 ATTRIBUTE((nonnull))
-void show_extent_table(const struct fiemap *restrict fmp, const __u64 offset,
-                       const char *restrict columns);
+void finish_extent_table(struct tablespec *tsp);
 
 #endif // ! HAVE_EXTENTS_FIEMAP_TABLE_H_
@@ -14,10 +14,17 @@
 
 #include "util.h"
 
+#include "stats.h"
+
 #include <assert.h>
+#include <endian.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 static const char *g_progname;
 
@@ -34,6 +41,19 @@ const char *progname(void)
     return g_progname;
 }
 
+void msg(const char *restrict const format, ...)
+{
+    assert(format);
+    fprintf(stderr, "%s: ", progname());
+
+    va_list vlist;
+    va_start(vlist, format);
+    vfprintf(stderr, format, vlist);
+    va_end(vlist);
+
+    putc('\n', stderr);
+}
+
 noreturn void die(const char *restrict const format, ...)
 {
     assert(format);
@@ -56,4 +76,117 @@ void *xcalloc(const size_t count, const size_t size)
     return ret;
 }
 
+void *xaligned_alloc(const size_t alignment, const size_t size)
+{
+    assert(alignment != 0u && (alignment & (alignment - 1u)) == 0u);
+
+    void *ret = NULL;
+    const int err = posix_memalign(&ret, (alignment < sizeof(void *)
+                                            ? sizeof(void *) : alignment),
+                                   size ? size : 1u);
+    if (err != 0) die("out of memory");
+    return ret;
+}
+
+void *xreallocarray(void *const ptr, const size_t count, const size_t size)
+{
+    if (size != 0u && count > SIZE_MAX / size) die("out of memory");
+
+    const size_t bytes = count * size;
+    void *const ret = realloc(ptr, bytes ? bytes : 1u);
+    if (!ret) die("out of memory");
+    return ret;
+}
+
+void write_fully(const int fd, const void *const buf, const size_t len)
+{
+    assert(buf);
+
+    const __u64 start = start_timing();
+
+    for (const char *p = buf, *const end = p + len; p != end; ) {
+        const ssize_t ret = write(fd, p, (size_t)(end - p));
+
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            die("can't write output: %s", strerror(errno));
+        }
+
+        count_stat(k_stat_writes, 1u);
+        count_stat(k_stat_written_bytes, (__u64)ret);
+        p += ret;
+    }
+
+    stop_timing(k_phase_io, start);
+}
+
+unsigned long long parse_number(const char *const text,
+                                const unsigned long long max_value,
+                                const bool allow_suffix)
+{
+    assert(text);
+
+    unsigned long long value = 0uLL;
+    const char *p = text;
+
+    for (; '0' <= *p && *p <= '9'; ++p) {
+        const unsigned digit = (unsigned)(*p - '0');
+        if (value > (max_value - digit) / 10u) die("%s is too big", text);
+        value = value * 10u + digit;
+    }
+
+    if (p == text) die("%s is not a number", text);
+
+    if (allow_suffix && *p != '\0' && p[1] == '\0') {
+        unsigned shift = 0u;
+
+        switch (*p++) {
+            case 'K': shift = 10u; break;
+            case 'M': shift = 20u; break;
+            case 'G': shift = 30u; break;
+            default: die("unrecognized suffix in %s", text);
+        }
+
+        if (value > max_value >> shift) die("%s is too big", text);
+        value <<= shift;
+    }
+
+    if (*p != '\0') die("%s is not a number", text);
+    if (value == 0u) die("%s must be positive", text);
+    return value;
+}
+
+void put_le32(unsigned char *const bytes, const __u32 value)
+{
+    const __u32 le = htole32(value);
+    memcpy(bytes, &le, sizeof le);
+}
+
+void put_le64(unsigned char *const bytes, const __u64 value)
+{
+    const __u64 le = htole64(value);
+    memcpy(bytes, &le, sizeof le);
+}
+
+__u16 get_le16(const unsigned char *const bytes)
+{
+    __u16 le = 0u;
+    memcpy(&le, bytes, sizeof le);
+    return le16toh(le);
+}
+
+__u32 get_le32(const unsigned char *const bytes)
+{
+    __u32 le = 0u;
+    memcpy(&le, bytes, sizeof le);
+    return le32toh(le);
+}
+
+__u64 get_le64(const unsigned char *const bytes)
+{
+    __u64 le = 0u;
+    memcpy(&le, bytes, sizeof le);
+    return le64toh(le);
+}
+
 extern inline int max(int first, int second);
@@ -19,8 +19,10 @@
 
 #include "attribute.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdnoreturn.h>
+#include <linux/types.h>
 
 #define BUG(format) format " (this is a bug!)"
 
@@ -34,12 +36,56 @@ void set_progname(const char *name);
 ATTRIBUTE((returns_nonnull))
 const char *progname(void);
 
+// Prints a message, prefixed by the program name, to standard error.
+ATTRIBUTE((format(printf, 1, 2), nonnull(1)))
+void msg(const char *restrict format, ...);
+
 ATTRIBUTE((format(printf, 1, 2), nonnull(1)))
 noreturn void die(const char *restrict format, ...);
 
 ATTRIBUTE((malloc, returns_nonnull))
 void *xcalloc(size_t count, size_t size);
 
+// Allocates size bytes at a multiple of alignment, which must be a power of
+// two, quitting on failure. The memory is not initialized.
+ATTRIBUTE((malloc, returns_nonnull))
+void *xaligned_alloc(size_t alignment, size_t size);
+
+// Resizes an array of count elements of the given size, quitting on failure.
+ATTRIBUTE((returns_nonnull))
+void *xreallocarray(void *ptr, size_t count, size_t size);
+
+// Writes all len bytes to fd, retrying after partial writes. Quits on failure.
+ATTRIBUTE((nonnull))
+void write_fully(int fd, const void *buf, size_t len);
+
+// Parses a positive decimal integer no greater than max_value, which may be
+// followed by a K, M, or G suffix if allow_suffix is true. Quits on failure.
+ATTRIBUTE((nonnull))
+unsigned long long parse_number(const char *text,
+                                unsigned long long max_value,
+                                bool allow_suffix);
+
+// Stores a 32-bit value at bytes, little-endian.
+ATTRIBUTE((nonnull))
+void put_le32(unsigned char *bytes, __u32 value);
+
+// Stores a 64-bit value at bytes, little-endian.
+ATTRIBUTE((nonnull))
+void put_le64(unsigned char *bytes, __u64 value);
+
+// Loads a little-endian 16-bit value from bytes.
+ATTRIBUTE((nonnull, pure))
+__u16 get_le16(const unsigned char *bytes);
+
+// Loads a little-endian 32-bit value from bytes.
+ATTRIBUTE((nonnull, pure))
+__u32 get_le32(const unsigned char *bytes);
+
+// Loads a little-endian 64-bit value from bytes.
+ATTRIBUTE((nonnull, pure))
+__u64 get_le64(const unsigned char *bytes);
+
 ATTRIBUTE((const))
 inline int max(const int first, const int second)
 {
@@ -0,0 +1,233 @@
+// verify.c - checking a file against its data on the disk (implementation)
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include "verify.h"
+
+#include "stats.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// State for comparing a file with the disk.
+struct verifier {
+    int file_fd;
+    const char *file_path;
+    char *file_buf; // the file's data, read through the filesystem
+    char *zeros;    // what holes and unwritten extents must hold
+    size_t buf_size;
+    __u64 checked;  // how many bytes have matched so far
+};
+
+// Reads up to len bytes of the file at offset, stopping early only at the end
+// of the file. Returns how many were read. Quits on failure.
+ATTRIBUTE((nonnull))
+static size_t read_file(const struct verifier *const vp, const size_t len,
+                        const __u64 offset)
+{
+    assert(vp);
+    assert(len <= vp->buf_size);
+
+    size_t done = 0u;
+    const __u64 start = start_timing();
+
+    while (done < len) {
+        if (offset + done > (__u64)LLONG_MAX) break;
+
+        const ssize_t ret = pread(vp->file_fd, vp->file_buf + done, len - done,
+                                  (off_t)(offset + done));
+
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) die("%s: %s", vp->file_path, strerror(errno));
+        if (ret == 0) break;
+
+        count_stat(k_stat_reads, 1u);
+        count_stat(k_stat_read_bytes, (__u64)ret);
+        done += (size_t)ret;
+    }
+
+    stop_timing(k_phase_io, start);
+    return done;
+}
+
+// Finds where two buffers that memcmp() says differ first differ.
+ATTRIBUTE((nonnull, pure))
+static size_t first_difference(const char *const first,
+                               const char *const second, const size_t len)
+{
+    assert(first);
+    assert(second);
+
+    size_t i = 0u;
+    while (i < len && first[i] == second[i]) ++i;
+    return i;
+}
+
+// Reports where the file differs from a chunk, and what the chunk is.
+ATTRIBUTE((nonnull))
+static void report_mismatch(const struct verifier *restrict const vp,
+                            const struct chunk *restrict const cp,
+                            const __u64 logical)
+{
+    assert(vp);
+    assert(cp);
+
+    if (!cp->zero) {
+        msg("%s differs from the disk at logical byte %llu (row %zu, disk"
+                " byte %llu).", vp->file_path, logical, cp->row,
+                cp->physical + (logical - cp->logical));
+    } else if (cp->row != 0u) {
+        msg("%s isn't zero at logical byte %llu (row %zu, unwritten).",
+                vp->file_path, logical, cp->row);
+    } else {
+        msg("%s isn't zero at logical byte %llu (in a hole).",
+                vp->file_path, logical);
+    }
+}
+
+// Reports that the file ends before a chunk's data do.
+ATTRIBUTE((nonnull))
+static void report_short_file(const struct verifier *restrict const vp,
+                              const struct chunk *restrict const cp,
+                              const __u64 end)
+{
+    assert(vp);
+    assert(cp);
+
+    if (cp->row != 0u) {
+        msg("%s ends at byte %llu, in row %zu.", vp->file_path, end, cp->row);
+    } else {
+        msg("%s ends at byte %llu, in a hole.", vp->file_path, end);
+    }
+}
+
+// Compares the file with len bytes at logical, which are expected to be as in
+// expected. Returns false, after reporting it, if they differ.
+ATTRIBUTE((nonnull))
+static bool compare_piece(struct verifier *restrict const vp,
+                          const struct chunk *restrict const cp,
+                          const char *restrict const expected,
+                          const size_t len, const __u64 logical)
+{
+    assert(vp);
+    assert(cp);
+    assert(expected);
+
+    const size_t got = read_file(vp, len, logical);
+
+    if (memcmp(vp->file_buf, expected, got) != 0) {
+        report_mismatch(vp, cp, logical + first_difference(vp->file_buf,
+                                                           expected, got));
+        return false;
+    }
+
+    if (got < len) {
+        report_short_file(vp, cp, logical + got);
+        return false;
+    }
+
+    vp->checked += got;
+    return true;
+}
+
+// Compares the file with a chunk whose data have been read into disk_buf.
+// Returns false, after reporting it, if they differ.
+ATTRIBUTE((nonnull))
+static bool compare_chunk(struct verifier *restrict const vp,
+                          const struct chunk *restrict const cp,
+                          const char *restrict const disk_buf)
+{
+    assert(vp);
+    assert(cp);
+    assert(disk_buf);
+
+    if (!cp->zero) {
+        assert(cp->length <= vp->buf_size);
+        return compare_piece(vp, cp, disk_buf + cp->skip, cp->length,
+                             cp->logical);
+    }
+
+    for (size_t done = 0u; done < cp->length; ) {
+        const size_t len = (cp->length - done < vp->buf_size
+                                ? cp->length - done : vp->buf_size);
+
+        if (!compare_piece(vp, cp, vp->zeros, len, cp->logical + done))
+            return false;
+
+        done += len;
+    }
+
+    return true;
+}
+
+// Checks that the file ends where the plan says it does.
+ATTRIBUTE((nonnull))
+static bool check_file_end(const struct verifier *restrict const vp,
+                           const struct plan *restrict const pp)
+{
+    assert(vp);
+    assert(pp);
+    assert(pp->complete);
+
+    if (read_file(vp, 1u, pp->size) == 0u) return true;
+
+    msg("%s is longer than the listing says (%llu bytes).",
+            vp->file_path, pp->size);
+    return false;
+}
+
+bool verify_segments(struct plan *restrict const pp, const int disk_fd,
+                     const int file_fd, const char *restrict const file_path,
+                     const struct copy_options *restrict const cop)
+{
+    assert(pp);
+    assert(file_path);
+    assert(cop);
+
+    struct chunker chunker = { 0 };
+    init_chunker(&chunker, pp, cop->chunk_size, cop->alignment, true);
+
+    const size_t buf_size = chunk_buffer_size(&chunker);
+    char *const disk_buf = xaligned_alloc(cop->alignment, buf_size);
+
+    struct verifier verifier = {
+        .file_fd = file_fd,
+        .file_path = file_path,
+        .file_buf = xcalloc(buf_size, 1u),
+        .zeros = xcalloc(buf_size, 1u),
+        .buf_size = buf_size,
+        .checked = 0u
+    };
+
+    bool same = true;
+
+    for (struct chunk chunk = { 0 }; same && next_chunk(&chunker, &chunk); ) {
+        read_chunk(disk_fd, disk_buf, &chunk);
+        same = compare_chunk(&verifier, &chunk, disk_buf);
+    }
+
+    if (same) same = check_file_end(&verifier, pp);
+
+    if (same) msg("%s matches (%llu bytes).", file_path, verifier.checked);
+
+    free(verifier.zeros);
+    free(verifier.file_buf);
+    free(disk_buf);
+    return same;
+}
@@ -0,0 +1,43 @@
+// verify.h - checking a file against its data on the disk
+//
+// This file is part of extents, tools for querying and accessing file extents.
+//
+// Written in 2019 by Eliah Kagan <degeneracypressure@gmail.com>.
+//
+// To the extent possible under law, the author(s) have dedicated all copyright
+// and related and neighboring rights to this software to the public domain
+// worldwide. This software is distributed without any warranty.
+//
+// You should have received a copy of the CC0 Public Domain Dedication along
+// with this software. If not, see
+// <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+// Verification reads the file through the filesystem and its extents from the
+// disk, a chunk at a time, in logical order, and compares them in memory, so
+// a listing can be checked without writing a stitched copy anywhere. Holes and
+// unwritten extents must read back as zeros, and the file must end where the
+// listing says.
+
+#ifndef HAVE_EXTENTS_FIEMAP_VERIFY_H_
+#define HAVE_EXTENTS_FIEMAP_VERIFY_H_
+
+#include "feature-test.h"
+
+#include "attribute.h"
+#include "copy.h"
+#include "plan.h"
+
+#include <stdbool.h>
+
+// Compares the file open as file_fd, whose path is file_path, with what the
+// plan says it holds, reading chunks from disk_fd with pread() as the options
+// specify. An incomplete plan is extended as verification proceeds. If every
+// byte matches, reports how many were checked and returns true. Otherwise
+// reports the first logical offset that differs, and what the listing says is
+// there, and returns false. Quits if either side can't be read.
+ATTRIBUTE((nonnull))
+bool verify_segments(struct plan *restrict pp, int disk_fd, int file_fd,
+                     const char *restrict file_path,
+                     const struct copy_options *restrict cop);
+
+#endif // ! HAVE_EXTENTS_FIEMAP_VERIFY_H_